@@ -0,0 +1,108 @@
+#include "../compiler_to_uxn/compiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Measures the time of `compile_to_uxn` on functions with more and more
+// statements: the time per statement should not grow with the function. Then
+// prints the memory used by the program of a small function.
+// Usage : compiler_bench [number of statements of the longest function]
+
+// Writes a function of `nb_statements` statements in `file`
+void generate_function(FILE *file, long nb_statements) {
+	fprintf(file, "fn main() void = {\n");
+	fprintf(file, "\tlet counter : u8 = 0;\n");
+	for (long i = 1; i < nb_statements; i++) {
+		fprintf(file, "\tcounter = counter + %ld;\n", i % 100);
+	}
+	fprintf(file, "};\n");
+}
+
+double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Returns the best time of `compile_to_uxn` on a function of `nb_statements`
+double bench_compile(long nb_statements) {
+	FILE *file = tmpfile();
+	if (file == NULL) {
+		printf("Error: cannot create the benchmark file\n");
+		exit(-1);
+	}
+	generate_function(file, nb_statements);
+	fflush(file);
+
+	double best = 0;
+	for (int i = 0; i < 3; i++) {
+		rewind(file);
+		Ast *ast = parse(stderr, lexify(stderr, file));
+		if (ast == NULL) {
+			printf("Error: parsing the benchmark file\n");
+			exit(-1);
+		}
+		double start = now();
+		Program *program = compile_to_uxn(stderr, ast);
+		double elapsed = now() - start;
+		if (program == NULL) {
+			printf("Error: compiling the benchmark file\n");
+			exit(-1);
+		}
+		uxn_program_delete(program);
+		symbols_delete();
+		if (best == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	fclose(file);
+	return best;
+}
+
+// Returns the number of bytes used by the segments of `program`
+size_t program_bytes(Program *program) {
+	size_t bytes = sizeof(*program);
+	for (uint32_t i = 0; i < program->len; i++) {
+		Segment *segment = &program->segments[i];
+		bytes += sizeof(*segment) +
+			 segment->cap * (sizeof(*segment->memory) +
+					 sizeof(*segment->is_instruction));
+		if (segment->comments != NULL) {
+			bytes += segment->cap * sizeof(*segment->comments);
+		}
+	}
+	return bytes;
+}
+
+// Prints the time of compiling a function of `nb_statements` statements and
+// the memory used by its program
+void bench_small(long nb_statements) {
+	double best = bench_compile(nb_statements);
+	FILE *file = tmpfile();
+	generate_function(file, nb_statements);
+	rewind(file);
+	Program *program =
+	    compile_to_uxn(stderr, parse(stderr, lexify(stderr, file)));
+	printf("small: %ld statements, %.2f us, %u segments, %zu bytes\n",
+	       nb_statements, best * 1e6, program->len,
+	       program_bytes(program));
+	uxn_program_delete(program);
+	symbols_delete();
+	fclose(file);
+}
+
+int main(int argc, char **argv) {
+	// Every statement takes 8 bytes and the function has to fit in the
+	// 0xff00 bytes after 0x100
+	long nb_statements = 7000;
+	if (argc >= 2) {
+		nb_statements = atol(argv[1]);
+	}
+	for (long n = nb_statements / 8; n <= nb_statements; n *= 2) {
+		double best = bench_compile(n);
+		printf("compile: %ld statements, %.4f s, %.0f ns/statement\n",
+		       n, best, best * 1e9 / n);
+	}
+	bench_small(10);
+	return 0;
+}
@@ -0,0 +1,78 @@
+#include "../lexer/lexer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Measures the throughput of `lexify` (in MB/s) on a generated Hare file.
+// Usage : lexer_bench [size in MB] [number of chunks]
+// Without a number of chunks, `lexify` chooses it from the number of cores.
+
+// Writes functions in `file` until it is at least `size` bytes long
+void generate_source(FILE *file, long size) {
+	for (int i = 0; ftell(file) < size; i++) {
+		fprintf(file, "fn function_%d(a : u8, b : u16) u8 = {\n", i);
+		fprintf(file, "\tlet output : u8 = 0x18; // console\n");
+		fprintf(file, "\tlet counter_%d : u16 = %d;\n", i, i % 1000);
+		fprintf(file, "\tif (a <= %d) {\n", i % 256);
+		fprintf(file, "\t\t*output = 'h';\n");
+		fprintf(file, "\t} else {\n");
+		fprintf(file, "\t\tcounter_%d = a * 12 + b / 3 - 42;\n", i);
+		fprintf(file, "\t};\n");
+		fprintf(file, "\treturn counter_%d == b;\n", i);
+		fprintf(file, "};\n\n");
+	}
+}
+
+double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+	long size = 16;
+	long nb_chunks = 0;
+	if (argc >= 2) {
+		size = atol(argv[1]);
+	}
+	if (argc >= 3) {
+		nb_chunks = atol(argv[2]);
+	}
+	size *= 1000 * 1000;
+
+	FILE *file = tmpfile();
+	if (file == NULL) {
+		printf("Error: cannot create the benchmark file\n");
+		return -1;
+	}
+	generate_source(file, size);
+	fflush(file);
+	size = ftell(file);
+
+	int runs = 5;
+	double best = 0;
+	uint32_t len = 0;
+	for (int i = 0; i < runs; i++) {
+		rewind(file);
+		double start = now();
+		Tokens *tokens = (nb_chunks == 0)
+				     ? lexify(stderr, file)
+				     : lexify_chunks(stderr, file, nb_chunks);
+		double elapsed = now() - start;
+		if (tokens == NULL) {
+			printf("Error: lexing the benchmark file\n");
+			return -1;
+		}
+		len = tokens->len;
+		tokens_delete(tokens);
+		symbols_delete();
+		if (best == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	fclose(file);
+
+	printf("lexify: %.1f MB, %u tokens, %.3f s, %.1f MB/s\n", size / 1e6,
+	       len, best, size / 1e6 / best);
+	return 0;
+}
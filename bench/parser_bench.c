@@ -0,0 +1,241 @@
+#include "../parser/parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures the time of `parse` on a function with a lot of statements, and on
+// long arithmetic expressions mixing every precedence, then the size of the
+// nodes of the Ast and the time of a walk over all of them, and the time of
+// `parse_chunks` on a module of thousands of functions and of loading its Ast
+// from a .hast file.
+// Usage : parser_bench [number of statements] [chunks]
+
+// Writes a function of `nb_statements` statements in `file`
+void generate_function(FILE *file, long nb_statements) {
+	fprintf(file, "fn main() void = {\n");
+	fprintf(file, "\tlet counter : u16 = 0;\n");
+	for (long i = 1; i < nb_statements; i++) {
+		fprintf(file, "\tcounter = counter + %ld;\n", i % 100);
+	}
+	fprintf(file, "};\n");
+}
+
+// Writes a function of `nb_statements` long arithmetic expressions in `file`
+void generate_expressions(FILE *file, long nb_statements) {
+	const char *operators[] = {"*", "+", "/", "-", "==", "*", "<="};
+	fprintf(file, "fn main() void = {\n");
+	fprintf(file, "\tlet counter : u16 = 0;\n");
+	for (long i = 1; i < nb_statements; i++) {
+		fprintf(file, "\tcounter = counter");
+		for (int j = 0; j < 32; j++) {
+			fprintf(file, " %s %d", operators[(i + j) % 7], j + 1);
+		}
+		fprintf(file, ";\n");
+	}
+	fprintf(file, "};\n");
+}
+
+// Writes `nb_functions` small functions in `file`
+void generate_module(FILE *file, long nb_functions) {
+	for (long i = 0; i < nb_functions; i++) {
+		fprintf(file, "fn f%ld(x: u16) u16 = {\n", i);
+		fprintf(file, "\tlet y : u16 = x * %ld + 1;\n", i % 100);
+		fprintf(file, "\tif (y < 10) { y = y + 1; }");
+		fprintf(file, " else { y = 0; };\n");
+		fprintf(file, "\treturn y;\n");
+		fprintf(file, "};\n");
+	}
+}
+
+double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Returns the best time of `parse_chunks` on the content of `file`
+double bench_parse(FILE *file, uint32_t nb_chunks) {
+	int runs = 3;
+	double best = 0;
+	for (int i = 0; i < runs; i++) {
+		rewind(file);
+		Tokens *tokens = lexify(stderr, file);
+		if (tokens == NULL) {
+			printf("Error: lexing the benchmark file\n");
+			exit(-1);
+		}
+		double start = now();
+		Ast *ast = parse_chunks(stderr, tokens, nb_chunks);
+		double elapsed = now() - start;
+		if (ast == NULL) {
+			printf("Error: parsing the benchmark file\n");
+			exit(-1);
+		}
+		ast_delete(ast);
+		symbols_delete();
+		if (best == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	return best;
+}
+
+// Visits every node under `id` in depth first order, returns their number
+long walk(Ast *ast, ExprId id) {
+	Expression *expr = ast_node(ast, id);
+	switch (expr->tag) {
+	case LET_E:
+		return 1 + walk(ast, expr->let.e);
+	case ASSIGN_E:
+		return 1 + walk(ast, expr->assign.e);
+	case DEREF_ASSIGN_E:
+		return 1 + walk(ast, expr->deref_assign.e1) +
+		       walk(ast, expr->deref_assign.e2);
+	case DEREF_E:
+		return 1 + walk(ast, expr->deref.e);
+	case RETURN_E:
+		return 1 + walk(ast, expr->ret.e);
+	case SEQUENCE_E: {
+		long nodes = 1;
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			ExprId item = ast->items[expr->sequence.first + i];
+			nodes += walk(ast, item);
+		}
+		return nodes;
+	}
+	case IF_ELSE_E: {
+		long nodes = 1 + walk(ast, expr->if_else.cond) +
+			     walk(ast, expr->if_else.if_body);
+		if (expr->if_else.else_body != NO_EXPR) {
+			nodes += walk(ast, expr->if_else.else_body);
+		}
+		return nodes;
+	}
+	case VARIABLE_E:
+	case NUMBER_E:
+	case FUNCTION_CALL_E:
+	case CHAR_LITERAL_E:
+	case STRING_LITERAL_E:
+		return 1;
+	default: // binary operators
+		return 1 + walk(ast, expr->binary.lhs) +
+		       walk(ast, expr->binary.rhs);
+	}
+}
+
+// Prints the memory used by the nodes of the Ast of `file` and the best time
+// of a walk over them
+void bench_walk(FILE *file) {
+	rewind(file);
+	Ast *ast = parse(stderr, lexify(stderr, file));
+	if (ast == NULL) {
+		printf("Error: parsing the benchmark file\n");
+		exit(-1);
+	}
+	size_t bytes = ast->nodes_len * sizeof(*ast->nodes) +
+		       ast->items_len * sizeof(*ast->items);
+	printf("ast: %u nodes of %zu bytes, %u items, %.1f bytes/node\n",
+	       ast->nodes_len, sizeof(*ast->nodes), ast->items_len,
+	       (double)bytes / ast->nodes_len);
+
+	double best = 0;
+	long nodes = 0;
+	for (int i = 0; i < 3; i++) {
+		double start = now();
+		nodes = walk(ast, ast->functions[0].expr);
+		double elapsed = now() - start;
+		if (best == 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+	printf("walk: %ld nodes, %.4f s, %.0f nodes/s\n", nodes, best,
+	       nodes / best);
+	ast_delete(ast);
+	symbols_delete();
+}
+
+// Prints the best times of lexing and parsing `file`, and of loading its Ast
+// saved in a .hast file
+void bench_cache(FILE *file) {
+	double best_parse = 0;
+	double best_load = 0;
+	char path[] = "/tmp/parser_bench.hast";
+	uint64_t hash = ast_cache_hash_file(file);
+	for (int i = 0; i < 3; i++) {
+		rewind(file);
+		double start = now();
+		Ast *ast = parse(stderr, lexify(stderr, file));
+		double elapsed = now() - start;
+		if (ast == NULL || !ast_cache_write(ast, hash, path)) {
+			printf("Error: saving the Ast\n");
+			exit(-1);
+		}
+		ast_delete(ast);
+		if (best_parse == 0 || elapsed < best_parse) {
+			best_parse = elapsed;
+		}
+
+		start = now();
+		ast = ast_cache_load(path, hash);
+		elapsed = now() - start;
+		if (ast == NULL) {
+			printf("Error: loading the saved Ast\n");
+			exit(-1);
+		}
+		ast_delete(ast);
+		symbols_delete();
+		if (best_load == 0 || elapsed < best_load) {
+			best_load = elapsed;
+		}
+	}
+	remove(path);
+	printf("cache: lex and parse %.4f s, load .hast %.4f s\n", best_parse,
+	       best_load);
+}
+
+int main(int argc, char **argv) {
+	long nb_statements = 100 * 1000;
+	if (argc >= 2) {
+		nb_statements = atol(argv[1]);
+	}
+	uint32_t nb_chunks = 4;
+	if (argc >= 3) {
+		nb_chunks = atol(argv[2]);
+	}
+
+	FILE *file = tmpfile();
+	if (file == NULL) {
+		printf("Error: cannot create the benchmark file\n");
+		return -1;
+	}
+	generate_function(file, nb_statements);
+	fflush(file);
+	double best = bench_parse(file, 1);
+	printf("parse: %ld statements, %.3f s, %.0f statements/s\n",
+	       nb_statements, best, nb_statements / best);
+
+	rewind(file);
+	ftruncate(fileno(file), 0);
+	generate_expressions(file, nb_statements / 10);
+	fflush(file);
+	best = bench_parse(file, 1);
+	printf("parse: %ld expressions of 32 operators, %.3f s, %.0f "
+	       "operators/s\n",
+	       nb_statements / 10, best, nb_statements / 10 * 32 / best);
+	bench_walk(file);
+
+	rewind(file);
+	ftruncate(fileno(file), 0);
+	long nb_functions = nb_statements / 10;
+	generate_module(file, nb_functions);
+	fflush(file);
+	best = bench_parse(file, 1);
+	printf("parse: %ld functions, 1 chunk, %.3f s\n", nb_functions, best);
+	best = bench_parse(file, nb_chunks);
+	printf("parse: %ld functions, %u chunks, %.3f s\n", nb_functions,
+	       nb_chunks, best);
+	bench_cache(file);
+	fclose(file);
+	return 0;
+}
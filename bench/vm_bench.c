@@ -0,0 +1,88 @@
+#include "../vm/vm.h"
+#include "vm_roms.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures the instructions per second of the reference interpreter
+// (`uxn_eval`), of the threaded interpreter (`uxn_eval_threaded`), of the JIT
+// (`uxn_eval_jit`) and of `uxn/uxncli` (when it is built) on the two roms of
+// `vm_roms.h`.
+// Usage : vm_bench [path of uxncli]
+
+typedef UxnStatus (*Engine)(Uxn *uxn, uint16_t pc, uint64_t budget);
+
+double now(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Runs `rom` with `engine`, prints the instructions per second and returns the
+// number of instructions
+uint64_t bench_engine(const char *name, const char *engine_name,
+		      Engine engine, const uint8_t *rom, size_t len) {
+	char output[16] = {0};
+	FILE *out = fmemopen(output, sizeof(output), "w");
+	Uxn *uxn = uxn_new(out, stderr);
+	uxn_load_rom(uxn, rom, len);
+	double start = now();
+	UxnStatus status = engine(uxn, UXN_PAGE, UINT64_MAX);
+	double elapsed = now() - start;
+	fclose(out);
+	uint64_t steps = uxn->steps;
+	printf("%s: %-8s %10lu instructions, %.3f s, %6.1f M instructions/s "
+	       "(%s, output %02x)\n",
+	       name, engine_name, steps, elapsed, steps / elapsed * 1e-6,
+	       uxn_status_name(status), (uint8_t)output[0]);
+	uxn_delete(uxn);
+	return steps;
+}
+
+// Runs `rom` in `uxncli` (a new process) and prints the instructions per
+// second with the number of instructions `steps` counted by the machine
+void bench_uxncli(const char *name, const char *uxncli, const uint8_t *rom,
+		  size_t len, uint64_t steps) {
+	char path[] = "/tmp/vm_benchXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || write(fd, rom, len) != (ssize_t)len) {
+		printf("Error: cannot write the rom of the benchmark\n");
+		exit(-1);
+	}
+	close(fd);
+	char command[256];
+	snprintf(command, sizeof(command), "%s %s </dev/null >/dev/null",
+		 uxncli, path);
+	double start = now();
+	int result = system(command);
+	double elapsed = now() - start;
+	unlink(path);
+	if (result != 0) {
+		printf("%s: uxncli failed\n", name);
+		return;
+	}
+	printf("%s: %-8s %10lu instructions, %.3f s, %6.1f M instructions/s\n",
+	       name, "uxncli", steps, elapsed, steps / elapsed * 1e-6);
+}
+
+void bench_rom(const char *name, const char *uxncli, const uint8_t *rom,
+	       size_t len) {
+	uint64_t steps = bench_engine(name, "eval", uxn_eval, rom, len);
+	bench_engine(name, "threaded", uxn_eval_threaded, rom, len);
+	bench_engine(name, "jit", uxn_eval_jit, rom, len);
+	if (access(uxncli, X_OK) == 0) {
+		bench_uxncli(name, uxncli, rom, len, steps);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *uxncli = "uxn/uxncli";
+	if (argc >= 2) {
+		uxncli = argv[1];
+	}
+	bench_rom("fib_loop", uxncli, fib_loop, sizeof(fib_loop));
+	bench_rom("fib_recursive", uxncli, fib_recursive,
+		  sizeof(fib_recursive));
+	return 0;
+}
@@ -0,0 +1,46 @@
+#include <stdint.h>
+
+// Roms of the benchmark of the machine (bench/vm_bench.c), also run by the
+// test of the machine (test_vm.c). The compiler has no loops nor functions
+// calls yet, so they are written in Uxntal (assembled with `uxnasm`) with the
+// sequences that the compiler emits.
+
+// Fibonacci(25) (modulo 256) computed 0x8000 times with the variables in the
+// zero page (like the compiler does):
+// |0100
+//	#0000 #04 STZ2
+//	&outer
+//	#00 #01 STZ #01 #02 STZ #00 #00 STZ
+//	&loop
+//		#01 LDZ #02 LDZ ADD #03 STZ
+//		#02 LDZ #01 STZ
+//		#03 LDZ #02 STZ
+//		#00 LDZ #00 #01 ADD ADD #00 STZ
+//		#00 LDZ #18 LTH ,&loop JCN
+//	#04 LDZ2 INC2 DUP2 #04 STZ2 #8000 NEQ2 ?&outer
+//	#02 LDZ #18 DEO
+// BRK
+const uint8_t fib_loop[] = {
+    0xa0, 0x00, 0x00, 0x80, 0x04, 0x31, 0x80, 0x00, 0x80, 0x01, 0x11,
+    0x80, 0x01, 0x80, 0x02, 0x11, 0x80, 0x00, 0x80, 0x00, 0x11, 0x80,
+    0x01, 0x10, 0x80, 0x02, 0x10, 0x18, 0x80, 0x03, 0x11, 0x80, 0x02,
+    0x10, 0x80, 0x01, 0x11, 0x80, 0x03, 0x10, 0x80, 0x02, 0x11, 0x80,
+    0x00, 0x10, 0x80, 0x00, 0x80, 0x01, 0x18, 0x18, 0x80, 0x00, 0x11,
+    0x80, 0x00, 0x10, 0x80, 0x18, 0x0b, 0x80, 0xd5, 0x0d, 0x80, 0x04,
+    0x30, 0x21, 0x26, 0x80, 0x04, 0x31, 0xa0, 0x80, 0x00, 0x29, 0x20,
+    0xff, 0xb7, 0x80, 0x02, 0x10, 0x80, 0x18, 0x17, 0x00,
+};
+
+// Fibonacci(30) (modulo 256) with the recursive function, 1.6 million calls:
+// |0100
+//	#1e fib #18 DEO
+// BRK
+// @fib
+//	DUP #02 LTH ?&base
+//	DUP #01 SUB fib SWP #02 SUB fib ADD
+//	&base JMP2r
+const uint8_t fib_recursive[] = {
+    0x80, 0x1e, 0x60, 0x00, 0x04, 0x80, 0x18, 0x17, 0x00, 0x06, 0x80,
+    0x02, 0x0b, 0x20, 0x00, 0x0f, 0x06, 0x80, 0x01, 0x19, 0x60, 0xff,
+    0xf2, 0x04, 0x80, 0x02, 0x19, 0x60, 0xff, 0xeb, 0x18, 0x6c,
+};
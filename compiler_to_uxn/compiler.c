@@ -1,4 +1,4 @@
-#include "compiler_utils.h"
+#include "compiler.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,267 +12,1189 @@ typedef struct {
 } VariableInfo;
 
 typedef struct {
-	uint8_t cap;
-	uint8_t len;
+	uint32_t cap;
+	uint32_t len;
 	ProgramType *types;
-	char **names;
+	Symbol *names;
+	uint8_t *addrs;	     // address of every variable
+	uint8_t next_addr;   // address of the next variable appended
+	uint16_t *by_symbol; // for every symbol 1 + index of its variable or 0
 } VariableLayout;
 
-typedef struct {
-	FILE *error;
+VariableLayout var_layout_empty(uint16_t *by_symbol) {
 	VariableLayout vars;
-} CompilerState;
+	vars.names = NULL;
+	vars.types = NULL;
+	vars.addrs = NULL;
+	vars.len = 0;
+	vars.cap = 0;
+	vars.next_addr = 0;
+	vars.by_symbol = by_symbol;
+	return vars;
+}
 
+// `by_symbol` is shared by all the functions: it is left full of 0 after
+// deleting the layout
 void var_layout_delete(VariableLayout vars) {
+	for (uint32_t i = 0; i < vars.len; i++) {
+		vars.by_symbol[vars.names[i]] = 0;
+	}
 	free(vars.types);
 	free(vars.names);
+	free(vars.addrs);
 }
 
 void var_layout_resize(VariableLayout *vars) {
 	if (vars->cap < vars->len) {
-		vars->cap = (vars->cap == 0) ? 1 : vars->cap * 2;
+		vars->cap = vector_grow_cap(vars->cap, vars->len);
 		vars->names =
 		    realloc(vars->names, vars->cap * sizeof(*vars->names));
 		vars->types =
 		    realloc(vars->types, vars->cap * sizeof(*vars->types));
+		vars->addrs =
+		    realloc(vars->addrs, vars->cap * sizeof(*vars->addrs));
 	}
 }
 
-void var_layout_append(VariableLayout *vars, ProgramType type, char *name) {
+void var_layout_append(VariableLayout *vars, ProgramType type, Symbol name) {
 	vars->len++;
 	var_layout_resize(vars);
 	vars->names[vars->len - 1] = name;
 	vars->types[vars->len - 1] = type;
+	vars->addrs[vars->len - 1] = vars->next_addr;
+	// The parser avoided to have variable with `void` type
+	if (type == U8_T) {
+		vars->next_addr += 1;
+	} else if (type == U16_T) {
+		vars->next_addr += 2;
+	}
+	if (vars->by_symbol[name] == 0) {
+		vars->by_symbol[name] = vars->len;
+	}
 }
 
-// This gets the position of the last inserted variable with the name `name`
-VariableInfo var_layout_get_addr(VariableLayout *vars, char *name) {
-	uint8_t addr = 0;
-	for (int i = 0; i < vars->len; i++) {
-		VariableInfo var_info;
-		if (vars->types[i] == U8_T) {
-			var_info.size = 1;
-		} else if (vars->types[i] == U16_T) {
-			var_info.size = 2;
-		}
-		// The parser avoided to have variable with `void` type
-		if (strcmp(name, vars->names[i]) == 0) {
-			var_info.defined = true;
-			var_info.addr = addr;
-			return var_info;
-		}
-		addr += var_info.size;
-	}
+// This gets the position of the first inserted variable with the name `name`
+VariableInfo var_layout_get_addr(VariableLayout *vars, Symbol name) {
 	VariableInfo info;
-	info.defined = false;
+	uint16_t index = vars->by_symbol[name];
+	if (index == 0) {
+		info.defined = false;
+		return info;
+	}
+	info.defined = true;
+	info.addr = vars->addrs[index - 1];
+	info.size = (vars->types[index - 1] == U16_T) ? 2 : 1;
 	return info;
 }
 
-///// ----- PARTIAL PROGRAM ----- /////
+///// ----- EMITTER ----- /////
+
+// Index of a range of the emitter (NO_RANGE after the last range of a code)
+#define NO_RANGE UINT32_MAX
 
+// Slots [start, start + len[ of the buffer of the emitter
 typedef struct {
-	uint16_t cap;
-	uint16_t len;
-	uint16_t *pos; // positions inside of the PartProgram
-	char **names;
-} FunAddr;
-
-/// The partial Uxn Program is used when compiling the AST piece by piece.
-/// At the end of the traversal of the AST, we should assemble all those partial
-/// uxn program to form the final complete uxn program
+	uint32_t start;
+	uint32_t len;
+	uint32_t next; // next range of the same code
+} CodeRange;
+
+/// The code of an expression is a list of ranges of the buffer of the emitter.
+/// Putting two codes one after the other links their lists : the slots are
+/// never copied before the function is written in the complete program.
 typedef struct {
-	uint16_t cap;
-	uint16_t len;
+	uint32_t first; // NO_RANGE if the code is empty
+	uint32_t last;
+	uint32_t len; // number of slots of the code
+} Code;
+
+/// The code of a function is appended in one growable buffer, in the order it
+/// is compiled (it can be in another order in the function).
+typedef struct {
+	uint32_t cap;
+	uint32_t len;
 	char **comments;
 	bool *is_inst;
 	Instruction *inst;
-	FunAddr fun_addr;
-} PartProgram;
 
-PartProgram *part_program_empty(void) {
-	PartProgram *program = malloc(sizeof(*program));
-	program->cap = 0;
-	program->len = 0;
-	program->comments = NULL;
-	program->is_inst = NULL;
-	program->inst = NULL;
+	uint32_t ranges_cap;
+	uint32_t ranges_len;
+	CodeRange *ranges;
+} Emitter;
 
-	FunAddr fun_addr;
-	fun_addr.len = 0;
-	fun_addr.cap = 0;
-	fun_addr.pos = NULL;
-	fun_addr.names = NULL;
+Emitter emitter_empty(void) {
+	Emitter emitter;
+	emitter.cap = 0;
+	emitter.len = 0;
+	emitter.comments = NULL;
+	emitter.is_inst = NULL;
+	emitter.inst = NULL;
+	emitter.ranges_cap = 0;
+	emitter.ranges_len = 0;
+	emitter.ranges = NULL;
+	return emitter;
+}
 
-	program->fun_addr = fun_addr;
-	return program;
+/// This does not delete comments strings because they are string literal
+void emitter_delete(Emitter emitter) {
+	free(emitter.comments);
+	free(emitter.is_inst);
+	free(emitter.inst);
+	free(emitter.ranges);
 }
 
-void part_program_free(PartProgram p) {
-	// if (p.fun_addr.pos != NULL) {
-	// 	free(p.fun_addr.pos);
-	// 	free(p.fun_addr.names);
-	// }
-	free(p.comments);
-	free(p.is_inst);
-	free(p.inst);
+Code code_empty(void) {
+	Code code;
+	code.first = NO_RANGE;
+	code.last = NO_RANGE;
+	code.len = 0;
+	return code;
 }
 
-/// Delete of a partial program
-/// This does not delete comments strings because they are string literal
-/// This suppose that partial_program is allocated on the heap
-void part_program_delete(PartProgram *p) {
-	part_program_free(*p);
-	free(p);
-}
-
-// Returns a partial uxn program that is a combination of p1 and p2
-// Free p1 and p2 in the process
-PartProgram *concat_program(PartProgram *p1, PartProgram *p2) {
-	PartProgram *res = malloc(sizeof(*res));
-
-	res->len = p1->len + p2->len;
-	res->cap = res->len;
-
-	res->comments = malloc(sizeof(*res->comments) * res->cap);
-	res->is_inst = malloc(sizeof(*res->is_inst) * res->cap);
-	res->inst = malloc(sizeof(*res->inst) * res->cap);
-
-	// Concat Memory
-	// res : p1 ++ p2
-	memcpy(res->comments, p1->comments, p1->len * sizeof(*res->comments));
-	memcpy(res->is_inst, p1->is_inst, p1->len * sizeof(*res->is_inst));
-	memcpy(res->inst, p1->inst, p1->len * sizeof(*res->inst));
-	memcpy(res->comments + p1->len, p2->comments,
-	       p2->len * sizeof(*res->comments));
-	memcpy(res->is_inst + p1->len, p2->is_inst,
-	       p2->len * sizeof(*res->is_inst));
-	memcpy(res->inst + p1->len, p2->inst, p2->len * sizeof(*res->inst));
-
-	// concat fun_wait
-	res->fun_addr.len = p1->fun_addr.len + p2->fun_addr.len;
-	res->fun_addr.cap = res->fun_addr.len;
-	res->fun_addr.pos =
-	    malloc(sizeof(*res->fun_addr.pos) * res->fun_addr.cap);
-	res->fun_addr.pos =
-	    malloc(sizeof(*res->fun_addr.pos) * res->fun_addr.cap);
-	
-	int i = 0;
-	for (int j = 0; j < p1->fun_addr.len - 1; j++) {
-		res->fun_addr.pos[i] = p1->fun_addr.pos[j];
-		res->fun_addr.names[i] = p1->fun_addr.names[j];
-		i++;
-	}
-	for (int j = 0; j < p2->fun_addr.len - 1; j++) {
-		// offset of p1->len because fun_addr are positional
-		res->fun_addr.pos[i] = p2->fun_addr.pos[j] + p1->len;
-		res->fun_addr.names[i] = p2->fun_addr.names[j];
-		i++;
-	}
-
-	part_program_delete(p1);
-	part_program_delete(p2);
-	return res;
-}
-
-void part_program_resize(PartProgram *p) {
-	if (p->cap < p->len) {
-		p->cap = (p->cap == 0) ? 1 : p->cap * 2;
-		p->comments =
-		    realloc(p->comments, sizeof(*p->comments) * p->cap);
-		p->is_inst = realloc(p->is_inst, sizeof(*p->inst) * p->cap);
-		p->inst = realloc(p->inst, sizeof(*p->inst) * p->cap);
-	}
-}
-
-void fun_wait_addr_resize(FunAddr *fun_wait) {
-	if (fun_wait->cap < fun_wait->len) {
-		fun_wait->cap = (fun_wait == 0) ? 1 : fun_wait->cap * 2;
-		fun_wait->names =
-		    realloc(fun_wait->names, sizeof(char *) * fun_wait->cap);
-		fun_wait->pos =
-		    realloc(fun_wait->pos, sizeof(uint16_t) * fun_wait->cap);
-	}
-}
-
-void append_function_addr(PartProgram *p, char *name) {
-	p->fun_addr.len++;
-	fun_wait_addr_resize(&p->fun_addr);
-	p->fun_addr.names[p->fun_addr.len - 1] = name;
-	p->fun_addr.pos[p->fun_addr.len - 1] = p->fun_addr.len;
-}
-
-// add to the program 'p' (in place) one instruction which has
-// instruction, is_intruction, comment to describe it
-void append_number(PartProgram *p, char *comment, uint16_t n) {
-	if (n < 0x1000) {
-		p->len++;
-		part_program_resize(p);
-
-		p->comments[p->len - 1] = comment;
-		p->is_inst[p->len - 1] = false;
-
-		p->inst[p->len - 1] = n;
+// Returns the code of `c1` followed by the code of `c2`
+// The last range of `c1` and the first range of `c2` are merged when they
+// follow each other in the buffer
+Code code_concat(Emitter *emitter, Code c1, Code c2) {
+	if (c1.first == NO_RANGE) {
+		return c2;
+	}
+	if (c2.first == NO_RANGE) {
+		return c1;
+	}
+	CodeRange *last = &emitter->ranges[c1.last];
+	CodeRange *first = &emitter->ranges[c2.first];
+	if (last->start + last->len == first->start) {
+		last->len += first->len;
+		last->next = first->next;
+		if (c2.last != c2.first) {
+			c1.last = c2.last;
+		}
 	} else {
-		// TODO the right calculus
-		p->len += 2;
-		part_program_resize(p);
-		p->comments[p->len - 2] = comment;
-		p->is_inst[p->len - 2] = false;
-		p->is_inst[p->len - 1] = false;
+		last->next = c2.first;
+		c1.last = c2.last;
+	}
+	c1.len += c2.len;
+	return c1;
+}
 
-		p->inst[p->len - 2] = n % 0x1000;
-		p->inst[p->len - 1] = n;
+// Add a slot at the end of the buffer and at the end of `code`
+// Returns the index of the slot in the buffer
+uint32_t emit_slot(Emitter *emitter, Code *code, char *comment, bool is_inst,
+		   Instruction inst) {
+	uint32_t slot = emitter->len;
+	if (emitter->len == emitter->cap) {
+		emitter->cap = vector_grow_cap(emitter->cap, emitter->len + 1);
+		uint32_t cap = emitter->cap;
+		emitter->comments = realloc(
+		    emitter->comments, cap * sizeof(*emitter->comments));
+		emitter->is_inst =
+		    realloc(emitter->is_inst, cap * sizeof(*emitter->is_inst));
+		emitter->inst =
+		    realloc(emitter->inst, cap * sizeof(*emitter->inst));
 	}
+	emitter->comments[slot] = comment;
+	emitter->is_inst[slot] = is_inst;
+	emitter->inst[slot] = inst;
+	emitter->len++;
+
+	// The last range of the code is extended if it ends at this slot
+	code->len++;
+	if (code->last != NO_RANGE) {
+		CodeRange *last = &emitter->ranges[code->last];
+		if (last->start + last->len == slot) {
+			last->len++;
+			return slot;
+		}
+	}
+	emitter->ranges =
+	    vector_reserve(emitter->ranges, &emitter->ranges_cap,
+			   emitter->ranges_len + 1, sizeof(*emitter->ranges));
+	uint32_t index = emitter->ranges_len++;
+	emitter->ranges[index].start = slot;
+	emitter->ranges[index].len = 1;
+	emitter->ranges[index].next = NO_RANGE;
+	if (code->last == NO_RANGE) {
+		code->first = index;
+	} else {
+		emitter->ranges[code->last].next = index;
+	}
+	code->last = index;
+	return slot;
 }
 
-// add to the program 'p' (in place) one instruction which has
-// instruction, is_intruction, comment to describe it
-void append_instruction(PartProgram *p, char *comment, Instruction inst) {
-	p->len++;
-	part_program_resize(p);
+// add to the code 'code' the number `n` with a comment to describe it:
+// LIT and its byte for a u8, LIT2 and its two bytes (big endian) for a u16
+void emit_number(Emitter *emitter, Code *code, char *comment,
+		 ProgramType type, uint16_t n) {
+	if (type == U16_T) {
+		emit_slot(emitter, code, comment, true, LIT2);
+		emit_slot(emitter, code, NULL, false, n >> 8);
+	} else {
+		emit_slot(emitter, code, comment, true, LIT);
+	}
+	emit_slot(emitter, code, NULL, false, n & 0xff);
+}
 
-	p->comments[p->len - 1] = comment;
-	p->is_inst[p->len - 1] = true;
-	p->inst[p->len - 1] = inst;
+// add to the code 'code' one instruction with a comment to describe it
+void emit_instruction(Emitter *emitter, Code *code, char *comment,
+		      Instruction inst) {
+	emit_slot(emitter, code, comment, true, inst);
 }
 
-/// Write a partial function to an UxnProgram a a certain 'pos'
-/// This functions delete PartialUxnProgram
-void write_part_program(PartProgram part_program, Program *p, uint16_t pos) {
-	for (uint16_t i = 0; i < part_program.len; i++) {
-		p->comments[pos + i] = part_program.comments[i];
-		p->is_written[pos + i] = true;
-		p->is_instruction[pos + i] = part_program.is_inst[i];
-		p->memory[pos + i] = part_program.inst[i];
+// Add to `code` a byte whose value is not known yet (a jump distance)
+// Returns its slot, given to `emitter_fixup` once the value is known
+uint32_t emit_fixup(Emitter *emitter, Code *code) {
+	return emit_slot(emitter, code, NULL, false, 0);
+}
+
+void emitter_fixup(Emitter *emitter, uint32_t slot, uint8_t value) {
+	emitter->inst[slot] = value;
+}
+
+/// Write `code` to an UxnProgram at a certain 'pos'
+void emitter_write(Emitter *emitter, Code code, Program *p, uint16_t pos) {
+	for (uint32_t r = code.first; r != NO_RANGE;
+	     r = emitter->ranges[r].next) {
+		CodeRange range = emitter->ranges[r];
+		for (uint32_t i = range.start; i < range.start + range.len;
+		     i++) {
+			uxn_program_write(p, pos, emitter->inst[i],
+					  emitter->is_inst[i],
+					  emitter->comments[i]);
+			pos++;
+		}
 	}
-	part_program_free(part_program);
 }
 
 ///// ----- Uxn Program ----- /////
 
+Program *uxn_program_empty(void) {
+	Program *program = malloc(sizeof(*program));
+	program->len = 0;
+	program->cap = 0;
+	program->segments = NULL;
+	program->labels_len = 0;
+	program->labels_cap = 0;
+	program->labels = NULL;
+	memset(&program->peephole, 0, sizeof(program->peephole));
+	return program;
+}
+
 /// Completely free the program that is totally heap allocated
+/// This does not delete comments strings because they are string literal
 void uxn_program_delete(Program *program) {
-	for (int i = 0; i < 0x10000; i++) {
-		if (program->is_written[i]) {
-			// if (program->comments[i] != NULL) {
-			// 	free(program->comments[i]);
-			// }
-		}
+	for (uint32_t i = 0; i < program->len; i++) {
+		free(program->segments[i].memory);
+		free(program->segments[i].is_instruction);
+		free(program->segments[i].comments);
 	}
+	free(program->segments);
+	free(program->labels);
 	free(program);
 	return;
 }
 
+// The byte is added at the end of the last segment when it follows it,
+// otherwise it starts a new segment
+void uxn_program_write(Program *program, uint16_t addr, Instruction inst,
+		       bool is_instruction, char *comment) {
+	Segment *segment = NULL;
+	if (program->len > 0) {
+		segment = &program->segments[program->len - 1];
+		if (segment->start + segment->len != addr) {
+			segment = NULL;
+		}
+	}
+	if (segment == NULL) {
+		uint32_t len = program->len + 1;
+		program->segments =
+		    vector_reserve(program->segments, &program->cap, len,
+				   sizeof(*program->segments));
+		segment = &program->segments[program->len++];
+		segment->start = addr;
+		segment->len = 0;
+		segment->cap = 0;
+		segment->memory = NULL;
+		segment->is_instruction = NULL;
+		segment->comments = NULL;
+	}
+
+	uint32_t i = segment->len++;
+	if (segment->len > segment->cap) {
+		segment->cap = vector_grow_cap(segment->cap, segment->len);
+		segment->memory =
+		    realloc(segment->memory,
+			    segment->cap * sizeof(*segment->memory));
+		segment->is_instruction =
+		    realloc(segment->is_instruction,
+			    segment->cap * sizeof(*segment->is_instruction));
+		if (segment->comments != NULL) {
+			segment->comments =
+			    realloc(segment->comments,
+				    segment->cap * sizeof(*segment->comments));
+		}
+	}
+	if (comment != NULL && segment->comments == NULL) {
+		segment->comments =
+		    calloc(segment->cap, sizeof(*segment->comments));
+	}
+	segment->memory[i] = inst;
+	segment->is_instruction[i] = is_instruction;
+	if (segment->comments != NULL) {
+		segment->comments[i] = comment;
+	}
+}
+
+void uxn_program_label(Program *program, uint16_t addr, Symbol name) {
+	program->labels =
+	    vector_reserve(program->labels, &program->labels_cap,
+			   program->labels_len + 1, sizeof(*program->labels));
+	program->labels[program->labels_len].addr = addr;
+	program->labels[program->labels_len].name = name;
+	program->labels_len++;
+}
+
+///// ----- PEEPHOLE ----- /////
+
+// The code of a function is decoded in ops (an instruction and its bytes),
+// the rules of `peephole_rules` replace sequences of ops by shorter or faster
+// ones until none matches, then the ops are written again in the emitter.
+// The relative jumps of the compiler (LIT off JCN, LIT off JMP) know the op
+// they jump to: the offsets are computed again when the ops are written.
+// A rule never matches across the target of a jump.
+
+// Index of the op jumped to of an op that is not a jump
+#define NO_TARGET UINT32_MAX
+
+typedef struct {
+	Instruction inst;
+	uint16_t value;	 // pushed by LIT, LIT2
+	uint32_t target; // op jumped to by JCI, JMI, the LIT of JCN, JMP
+	char *comment;
+} PeepholeOp;
+
+// Values of a pattern that match several values: a variable is bound by its
+// first match and has the same value in the rest of the rule
+#define P_ANY 0x10000  // any value
+#define P_A 0x10001    // a variable
+#define P_A1 0x10002   // P_A + 1
+#define P_V 0x10003    // a second variable
+#define P_T 0x10004    // the op jumped to (a variable)
+#define P_NEXT 0x10005 // the op jumped to is the next one
+// Instruction of a pattern that matches any binary instruction on bytes
+// (ADD, EQU...), the same one in the replacement
+#define P_BINARY 0x100
+
+typedef struct {
+	uint16_t inst;	// an Instruction or P_BINARY
+	uint32_t value; // of LIT, LIT2, JCI, JMI: a number or one of the P_
+} PeepholePattern;
+
+// The replacement is never longer than the match
+typedef struct {
+	const char *name;
+	uint8_t len;
+	PeepholePattern match[6];
+	uint8_t replacement_len;
+	PeepholePattern replacement[6];
+} PeepholeRule;
+
+// clang-format off
+PeepholeRule peephole_rules[] = {
+{"LIT off JCN -> JCI", 2, {{LIT, P_T}, {JCN, 0}}, 1, {{JCI, P_T}}},
+{"LIT off JMP -> JMI", 2, {{LIT, P_T}, {JMP, 0}}, 1, {{JMI, P_T}}},
+{"JMI to the next op", 1, {{JMI, P_NEXT}}, 0, {{0}}},
+{"JCI to the next op -> POP", 1, {{JCI, P_NEXT}}, 1, {{POP, 0}}},
+{"LIT 00 NEQ JCI -> JCI", 3, {{LIT, 0}, {NEQ, 0}, {JCI, P_T}},
+	1, {{JCI, P_T}}},
+{"LIT 00 ADD", 2, {{LIT, 0}, {ADD, 0}}, 0, {{0}}},
+{"LIT 00 SUB", 2, {{LIT, 0}, {SUB, 0}}, 0, {{0}}},
+{"LIT 01 MUL", 2, {{LIT, 1}, {MUL, 0}}, 0, {{0}}},
+{"LIT 01 DIV", 2, {{LIT, 1}, {DIV, 0}}, 0, {{0}}},
+{"LIT 01 ADD -> INC", 2, {{LIT, 1}, {ADD, 0}}, 1, {{INC, 0}}},
+{"LIT2 0001 ADD2 -> INC2", 2, {{LIT2, 1}, {ADD2, 0}}, 1, {{INC2, 0}}},
+{"LIT POP", 2, {{LIT, P_ANY}, {POP, 0}}, 0, {{0}}},
+{"LIT2 POP2", 2, {{LIT2, P_ANY}, {POP2, 0}}, 0, {{0}}},
+{"DUP POP", 2, {{DUP, 0}, {POP, 0}}, 0, {{0}}},
+{"LIT a LDZ POP", 3, {{LIT, P_A}, {LDZ, 0}, {POP, 0}}, 0, {{0}}},
+{"LIT a STZ LIT a LDZ -> DUP", 4,
+	{{LIT, P_A}, {STZ, 0}, {LIT, P_A}, {LDZ, 0}},
+	3, {{DUP, 0}, {LIT, P_A}, {STZ, 0}}},
+{"LIT a LDZ LIT a LDZ -> DUP", 4,
+	{{LIT, P_A}, {LDZ, 0}, {LIT, P_A}, {LDZ, 0}},
+	3, {{LIT, P_A}, {LDZ, 0}, {DUP, 0}}},
+{"LIT a LDZ LIT v op LIT a STZ -> LDZk", 6,
+	{{LIT, P_A}, {LDZ, 0}, {LIT, P_V}, {P_BINARY, 0}, {LIT, P_A},
+	 {STZ, 0}},
+	6, {{LIT, P_A}, {LDZk, 0}, {LIT, P_V}, {P_BINARY, 0}, {SWP, 0},
+	    {STZ, 0}}},
+{"LIT a LDZ INC LIT a STZ -> LDZk", 5,
+	{{LIT, P_A}, {LDZ, 0}, {INC, 0}, {LIT, P_A}, {STZ, 0}},
+	5, {{LIT, P_A}, {LDZk, 0}, {INC, 0}, {SWP, 0}, {STZ, 0}}},
+{"v in a and a + 1 -> STZk", 6,
+	{{LIT, P_V}, {LIT, P_A}, {STZ, 0}, {LIT, P_V}, {LIT, P_A1},
+	 {STZ, 0}},
+	5, {{LIT, P_V}, {LIT, P_A}, {STZk, 0}, {INC, 0}, {STZ, 0}}},
+};
+// clang-format on
+
+_Static_assert(sizeof(peephole_rules) / sizeof(*peephole_rules) ==
+		   NB_PEEPHOLE_RULES,
+	       "NB_PEEPHOLE_RULES is the number of peephole rules");
+
+// Number of bytes after the instruction `inst`
+uint8_t immediate_len(Instruction inst) {
+	switch (inst) {
+	case LIT:
+	case LITr:
+		return 1;
+	case LIT2:
+	case LIT2r:
+	case JCI:
+	case JMI:
+	case JSI:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+// Number of bytes of `op` in the rom
+uint8_t peephole_op_len(PeepholeOp *op) {
+	return 1 + immediate_len(op->inst);
+}
+
+bool is_byte_binary(Instruction inst) {
+	uint8_t opcode = inst >> 3;
+	return (inst & 7) == 0 && ((opcode >= EQU >> 3 && opcode <= LTH >> 3) ||
+				   (opcode >= ADD >> 3 && opcode <= SFT >> 3));
+}
+
+// Decodes the slots of `code` in `ops` (allocated)
+// Returns false if the code is not understood: it is not optimised
+bool peephole_decode(Emitter *emitter, Code code, PeepholeOp **ops,
+		     uint32_t *len) {
+	// The slots of the code, then the op of every address (or NO_TARGET)
+	uint32_t *slots = malloc((code.len + 1) * sizeof(*slots));
+	uint32_t *op_at = malloc((code.len + 1) * sizeof(*op_at));
+	uint32_t *addrs = malloc((code.len + 1) * sizeof(*addrs));
+	*ops = malloc((code.len + 1) * sizeof(**ops));
+	*len = 0;
+	uint32_t n = 0;
+	for (uint32_t r = code.first; r != NO_RANGE;
+	     r = emitter->ranges[r].next) {
+		CodeRange range = emitter->ranges[r];
+		for (uint32_t i = 0; i < range.len; i++) {
+			slots[n++] = range.start + i;
+		}
+	}
+	bool ok = true;
+	for (uint32_t addr = 0; addr <= n; addr++) {
+		op_at[addr] = NO_TARGET;
+	}
+	for (uint32_t addr = 0; addr < n && ok;) {
+		if (!emitter->is_inst[slots[addr]]) {
+			ok = false;
+			break;
+		}
+		PeepholeOp op;
+		op.inst = emitter->inst[slots[addr]];
+		op.value = 0;
+		op.target = NO_TARGET;
+		op.comment = emitter->comments[slots[addr]];
+		uint8_t bytes = immediate_len(op.inst);
+		for (uint8_t i = 1; i <= bytes; i++) {
+			if (addr + i >= n) {
+				ok = false;
+				break;
+			}
+			uint32_t slot = slots[addr + i];
+			if (emitter->is_inst[slot]) {
+				ok = false;
+				break;
+			}
+			op.value = op.value << 8 | emitter->inst[slot];
+		}
+		// Only the jumps of the compiler are understood
+		switch (uxn_opcode(op.inst) & 0x1f) {
+		case 0x0c: // JMP
+		case 0x0d: // JCN
+		case 0x0e: // JSR
+			ok = ok && (op.inst == JMP || op.inst == JCN) &&
+			     *len > 0 && (*ops)[*len - 1].inst == LIT;
+			break;
+		case 0x00:
+			ok = ok && op.inst != JCI && op.inst != JMI &&
+			     op.inst != JSI;
+			break;
+		case 0x12: // LDR
+		case 0x13: // STR
+			ok = false;
+			break;
+		}
+		op_at[addr] = *len;
+		addrs[*len] = addr;
+		(*ops)[(*len)++] = op;
+		addr += 1 + bytes;
+	}
+	op_at[n] = *len;
+	addrs[*len] = n;
+
+	// The LIT of a jump knows the op at its target
+	for (uint32_t i = 1; i < *len && ok; i++) {
+		PeepholeOp *op = &(*ops)[i];
+		if (op->inst != JMP && op->inst != JCN) {
+			continue;
+		}
+		PeepholeOp *lit = &(*ops)[i - 1];
+		int32_t target = addrs[i] + 1 + (int8_t)lit->value;
+		if (target < 0 || target > (int32_t)n ||
+		    op_at[target] == NO_TARGET) {
+			ok = false;
+			break;
+		}
+		lit->target = op_at[target];
+	}
+	free(slots);
+	free(op_at);
+	free(addrs);
+	if (!ok) {
+		free(*ops);
+	}
+	return ok;
+}
+
+typedef struct {
+	uint32_t a;
+	uint32_t v;
+	uint32_t t;
+	bool a_bound;
+	bool v_bound;
+	bool t_bound;
+	Instruction binary;
+} PeepholeBindings;
+
+// true if `value` matches the value `pattern` of the op `i`, the variables
+// are bound in `b`
+bool peephole_match_value(uint32_t pattern, uint32_t value, uint32_t i,
+			  PeepholeBindings *b) {
+	switch (pattern) {
+	case P_ANY:
+		return true;
+	case P_A:
+		if (!b->a_bound) {
+			b->a_bound = true;
+			b->a = value;
+		}
+		return b->a == value;
+	case P_A1:
+		return b->a_bound && ((b->a + 1) & 0xff) == value;
+	case P_V:
+		if (!b->v_bound) {
+			b->v_bound = true;
+			b->v = value;
+		}
+		return b->v == value;
+	case P_T:
+		if (!b->t_bound) {
+			b->t_bound = true;
+			b->t = value;
+		}
+		return b->t == value;
+	case P_NEXT:
+		return value == i + 1;
+	default:
+		return pattern == value;
+	}
+}
+
+// true if `rule` matches the ops from `start`, with the variables in `b`
+bool peephole_match(PeepholeRule *rule, PeepholeOp *ops, uint32_t len,
+		    bool *is_target, uint32_t start, PeepholeBindings *b) {
+	if (start + rule->len > len) {
+		return false;
+	}
+	*b = (PeepholeBindings){0};
+	for (uint32_t k = 0; k < rule->len; k++) {
+		PeepholePattern pattern = rule->match[k];
+		PeepholeOp *op = &ops[start + k];
+		if (k > 0 && is_target[start + k]) {
+			return false;
+		}
+		if (pattern.inst == P_BINARY) {
+			if (!is_byte_binary(op->inst)) {
+				return false;
+			}
+			b->binary = op->inst;
+			continue;
+		}
+		if (op->inst != pattern.inst) {
+			return false;
+		}
+		bool jump = op->inst == JCI || op->inst == JMI;
+		bool jump_lit = pattern.value == P_T || pattern.value == P_NEXT;
+		if (op->inst == LIT || op->inst == LIT2) {
+			// a LIT is a value or the offset of a jump
+			if (jump_lit != (op->target != NO_TARGET)) {
+				return false;
+			}
+		}
+		uint32_t value = (jump || jump_lit) ? op->target : op->value;
+		if ((jump || immediate_len(op->inst) > 0) &&
+		    !peephole_match_value(pattern.value, value, start + k, b)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Applies the rules once on `ops` from the first op to the last one
+// Returns true if a rule was applied
+bool peephole_pass(PeepholeOp **ops, uint32_t *len, PeepholeStats *stats) {
+	uint32_t n = *len;
+	bool *is_target = calloc(n + 1, sizeof(*is_target));
+	for (uint32_t i = 0; i < n; i++) {
+		if ((*ops)[i].target != NO_TARGET) {
+			is_target[(*ops)[i].target] = true;
+		}
+	}
+	PeepholeOp *out = malloc((n + 1) * sizeof(*out));
+	uint32_t *new_index = malloc((n + 1) * sizeof(*new_index));
+	uint32_t out_len = 0;
+	bool changed = false;
+	for (uint32_t i = 0; i < n;) {
+		new_index[i] = out_len;
+		PeepholeBindings b;
+		uint32_t r = 0;
+		while (r < NB_PEEPHOLE_RULES &&
+		       !peephole_match(&peephole_rules[r], *ops, n, is_target,
+				       i, &b)) {
+			r++;
+		}
+		if (r == NB_PEEPHOLE_RULES) {
+			out[out_len++] = (*ops)[i++];
+			continue;
+		}
+		// The last comment of the match is kept on the last new op
+		PeepholeRule *rule = &peephole_rules[r];
+		char *comment = NULL;
+		uint32_t saved = 0;
+		for (uint32_t k = 0; k < rule->len; k++) {
+			PeepholeOp *op = &(*ops)[i + k];
+			new_index[i + k] = out_len;
+			comment = op->comment != NULL ? op->comment : comment;
+			saved += peephole_op_len(op);
+		}
+		for (uint32_t k = 0; k < rule->replacement_len; k++) {
+			PeepholePattern pattern = rule->replacement[k];
+			PeepholeOp op;
+			op.inst = pattern.inst == P_BINARY ? b.binary
+							   : pattern.inst;
+			op.value = pattern.value == P_A	   ? b.a
+				   : pattern.value == P_A1 ? (b.a + 1) & 0xff
+				   : pattern.value == P_V  ? b.v
+							   : pattern.value;
+			op.target = pattern.value == P_T ? b.t : NO_TARGET;
+			op.comment =
+			    k + 1 == rule->replacement_len ? comment : NULL;
+			saved -= peephole_op_len(&op);
+			out[out_len++] = op;
+		}
+		stats->uses[r]++;
+		stats->saved[r] += saved;
+		i += rule->len;
+		changed = true;
+	}
+	new_index[n] = out_len;
+	for (uint32_t i = 0; i < out_len; i++) {
+		if (out[i].target != NO_TARGET) {
+			out[i].target = new_index[out[i].target];
+		}
+	}
+	free(is_target);
+	free(new_index);
+	free(*ops);
+	*ops = out;
+	*len = out_len;
+	return changed;
+}
+
+// Writes `ops` at the end of the buffer of `emitter` and returns their code
+Code peephole_encode(Emitter *emitter, PeepholeOp *ops, uint32_t len) {
+	uint32_t *addrs = malloc((len + 1) * sizeof(*addrs));
+	addrs[0] = 0;
+	for (uint32_t i = 0; i < len; i++) {
+		addrs[i + 1] = addrs[i] + peephole_op_len(&ops[i]);
+	}
+	Code code = code_empty();
+	for (uint32_t i = 0; i < len; i++) {
+		PeepholeOp *op = &ops[i];
+		emit_instruction(emitter, &code, op->comment, op->inst);
+		uint16_t value = op->value;
+		if (op->target != NO_TARGET) {
+			// from the end of the JCI, JMI or of the JCN after LIT
+			value = addrs[op->target] - (addrs[i] + 3);
+		}
+		if (immediate_len(op->inst) == 2) {
+			emit_slot(emitter, &code, NULL, false, value >> 8);
+		}
+		if (immediate_len(op->inst) > 0) {
+			emit_slot(emitter, &code, NULL, false, value & 0xff);
+		}
+	}
+	free(addrs);
+	return code;
+}
+
+// Applies the rules of `peephole_rules` on `code` until none matches
+// Returns the new code of the function, the uses of the rules and the bytes
+// they saved are added to `stats`
+Code peephole_optimise(Emitter *emitter, Code code, PeepholeStats *stats) {
+	PeepholeOp *ops;
+	uint32_t len;
+	if (!peephole_decode(emitter, code, &ops, &len)) {
+		return code;
+	}
+	while (peephole_pass(&ops, &len, stats)) {
+	}
+	Code optimised = peephole_encode(emitter, ops, len);
+	free(ops);
+	return optimised;
+}
+
+void fprintf_peephole_stats(FILE *file, Program *program) {
+	for (uint32_t r = 0; r < NB_PEEPHOLE_RULES; r++) {
+		if (program->peephole.uses[r] == 0) {
+			continue;
+		}
+		fprintf(file, "%-38s %6u uses %7u bytes saved\n",
+			peephole_rules[r].name, program->peephole.uses[r],
+			program->peephole.saved[r]);
+	}
+}
+
+///// ----- TYPES ----- /////
+
+// Before the folding, every expression is annotated with the width of its
+// value (`expr->type`): U8_T or U16_T, VOID_T for the statements. An
+// operation is computed on 16 bits if one of its operands is a u16, or if its
+// result is put in a u16: the numbers without suffix and the operations below
+// it are then widened. A comparison gives a byte, whatever its operands.
+// The compilation converts a value when its width is not the one expected
+// (`compile_converted`).
+
+typedef struct {
+	VariableLayout vars; // the variables defined before the typed node
+	Ast *ast;
+} TypeState;
+
+bool is_comparison(ExpressionType tag) {
+	switch (tag) {
+	case EQUAL_EQUAL_E:
+	case NOT_EQUAL_E:
+	case GREATER_THAN_E:
+	case GREATER_THAN_EQUAL_E:
+	case LESS_THAN_E:
+	case LESS_THAN_EQUAL_E:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool is_arithmetic(ExpressionType tag) {
+	return tag == ADD_E || tag == SUB_E || tag == MULT_E || tag == DIV_E;
+}
+
+// Width of the operands of the binary operation `expr`
+ProgramType operand_type(Ast *ast, Expression *expr) {
+	if (!is_comparison(expr->tag)) {
+		return expr->type;
+	}
+	return ast_node(ast, expr->binary.lhs)->type == U16_T ||
+			   ast_node(ast, expr->binary.rhs)->type == U16_T
+		   ? U16_T
+		   : U8_T;
+}
+
+// `inst` (ADD, LDZ, ...) in short mode for a u16
+Instruction instruction_of_type(Instruction inst, ProgramType type) {
+	return type == U16_T ? inst + 1 : inst;
+}
+
+ProgramType var_type(VariableLayout *vars, Symbol name) {
+	VariableInfo info = var_layout_get_addr(vars, name);
+	return info.defined && info.size == 2 ? U16_T : U8_T;
+}
+
+// The value of `id` is put in a u16: the numbers and the operations that give
+// a byte are computed on 16 bits
+void type_widen(Ast *ast, ExprId id) {
+	Expression *expr = ast_node(ast, id);
+	if (expr->type != U8_T) {
+		return;
+	}
+	if ((expr->tag == NUMBER_E && expr->number.type == NONE) ||
+	    expr->tag == CHAR_LITERAL_E) {
+		expr->type = U16_T;
+	} else if (is_arithmetic(expr->tag)) {
+		expr->type = U16_T;
+		type_widen(ast, expr->binary.lhs);
+		type_widen(ast, expr->binary.rhs);
+	}
+}
+
+// Sets the width of `id` and of its children, in the order of the compilation
+void type_expr(TypeState *state, ExprId id) {
+	Ast *ast = state->ast;
+	Expression *expr = ast_node(ast, id);
+	expr->type = VOID_T;
+	switch ((ExpressionType)expr->tag) {
+	case LET_E:
+		type_expr(state, expr->let.e);
+		if (expr->let.type == U16_T) {
+			type_widen(ast, expr->let.e);
+		}
+		var_layout_append(&state->vars, expr->let.type, expr->let.var);
+		return;
+	case SEQUENCE_E:
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			type_expr(state, ast->items[expr->sequence.first + i]);
+		}
+		return;
+	case ASSIGN_E:
+		type_expr(state, expr->assign.e);
+		if (var_type(&state->vars, expr->assign.var) == U16_T) {
+			type_widen(ast, expr->assign.e);
+		}
+		return;
+	case DEREF_ASSIGN_E:
+		type_expr(state, expr->deref_assign.e1);
+		type_expr(state, expr->deref_assign.e2);
+		return;
+	case DEREF_E:
+		type_expr(state, expr->deref.e);
+		expr->type = U8_T;
+		return;
+	case VARIABLE_E:
+		expr->type = var_type(&state->vars, expr->variable.name);
+		return;
+	case NUMBER_E:
+		expr->type = expr->number.type == U16_T ||
+				     (expr->number.type == NONE &&
+				      expr->number.value > 0xff)
+				 ? U16_T
+				 : U8_T;
+		return;
+	case CHAR_LITERAL_E:
+		expr->type = U8_T;
+		return;
+	case IF_ELSE_E:
+		type_expr(state, expr->if_else.cond);
+		type_expr(state, expr->if_else.if_body);
+		if (expr->if_else.else_body != NO_EXPR) {
+			type_expr(state, expr->if_else.else_body);
+		}
+		return;
+	default:
+		if (is_arithmetic(expr->tag) || is_comparison(expr->tag)) {
+			ExprId lhs = expr->binary.lhs;
+			ExprId rhs = expr->binary.rhs;
+			type_expr(state, lhs);
+			type_expr(state, rhs);
+			bool wide = ast_node(ast, lhs)->type == U16_T ||
+				    ast_node(ast, rhs)->type == U16_T;
+			if (wide) {
+				type_widen(ast, lhs);
+				type_widen(ast, rhs);
+			}
+			expr->type = is_comparison(expr->tag) || !wide ? U8_T
+								       : U16_T;
+		}
+		return;
+	}
+}
+
+// `by_symbol` is shared by all the functions (full of 0)
+void type_function(Ast *ast, Function *function, uint16_t *by_symbol) {
+	TypeState state;
+	state.vars = var_layout_empty(by_symbol);
+	state.ast = ast;
+	type_expr(&state, function->expr);
+	var_layout_delete(state.vars);
+}
+
+///// ----- CONSTANT FOLDING ----- /////
+
+// Before its compilation, the operations of a function on numbers are
+// replaced by their result, computed like the instruction they compile to
+// (with the wraparound of their width), and the `if` with a known condition
+// by the branch that runs. The variables follow the compilation: a code is
+// only removed if it could be compiled (its variables are defined).
+
+typedef struct {
+	VariableLayout vars; // the variables defined before the folded node
+	Ast *ast;
+} FoldState;
+
+// true if the code of `id` is one LIT or LIT2, of the value put in `value`
+bool fold_constant(Ast *ast, ExprId id, uint16_t *value) {
+	Expression *expr = ast_node(ast, id);
+	if (expr->tag == NUMBER_E) {
+		*value = expr->type == U16_T ? expr->number.value
+					     : expr->number.value & 0xff;
+		return true;
+	}
+	if (expr->tag == CHAR_LITERAL_E && expr->char_literal.c >= 0) {
+		*value = expr->char_literal.c;
+		return true;
+	}
+	return false;
+}
+
+bool fold_is_binary(ExpressionType tag) {
+	return binary_tag_to_instruction(tag) != BRK;
+}
+
+// true if the code of `id` compiles and only reads: it can be removed
+bool fold_pure(FoldState *state, ExprId id) {
+	Expression *expr = ast_node(state->ast, id);
+	switch ((ExpressionType)expr->tag) {
+	case NUMBER_E:
+	case CHAR_LITERAL_E:
+		return true;
+	case VARIABLE_E:
+		return var_layout_get_addr(&state->vars, expr->variable.name)
+		    .defined;
+	case DEREF_E:
+		return fold_pure(state, expr->deref.e);
+	default:
+		return fold_is_binary(expr->tag) &&
+		       fold_pure(state, expr->binary.lhs) &&
+		       fold_pure(state, expr->binary.rhs);
+	}
+}
+
+// true if the code of `id` compiles and defines no variable: the branch of
+// an `if` that never runs can be removed
+bool fold_removable(FoldState *state, ExprId id) {
+	Ast *ast = state->ast;
+	Expression *expr = ast_node(ast, id);
+	switch ((ExpressionType)expr->tag) {
+	case SEQUENCE_E:
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			ExprId item = ast->items[expr->sequence.first + i];
+			if (!fold_removable(state, item)) {
+				return false;
+			}
+		}
+		return true;
+	case ASSIGN_E:
+		return var_layout_get_addr(&state->vars, expr->assign.var)
+			   .defined &&
+		       fold_removable(state, expr->assign.e);
+	case DEREF_ASSIGN_E:
+		return fold_removable(state, expr->deref_assign.e1) &&
+		       fold_removable(state, expr->deref_assign.e2);
+	case IF_ELSE_E:
+		return fold_removable(state, expr->if_else.cond) &&
+		       fold_removable(state, expr->if_else.if_body) &&
+		       (expr->if_else.else_body == NO_EXPR ||
+			fold_removable(state, expr->if_else.else_body));
+	default:
+		return fold_pure(state, id);
+	}
+}
+
+// `expr` becomes the number `value` of width `type`
+void fold_number(Expression *expr, ProgramType type, uint16_t value) {
+	*expr = expression_new(NUMBER_E);
+	expr->number.value = type == U16_T ? value : value & 0xff;
+	expr->number.base = 10;
+	expr->number.type = NONE;
+	expr->type = type;
+}
+
+// The binary operation `id` whose operands are folded
+void fold_binary(FoldState *state, ExprId id) {
+	Ast *ast = state->ast;
+	Expression *expr = ast_node(ast, id);
+	ExprId lhs_id = expr->binary.lhs;
+	ExprId rhs_id = expr->binary.rhs;
+	uint16_t lhs, rhs;
+	bool lhs_known = fold_constant(ast, lhs_id, &lhs);
+	bool rhs_known = fold_constant(ast, rhs_id, &rhs);
+	if (lhs_known && rhs_known) {
+		Instruction inst =
+		    instruction_of_type(binary_tag_to_instruction(expr->tag),
+					operand_type(ast, expr));
+		fold_number(expr, expr->type, uxn_binary(inst, lhs, rhs));
+		return;
+	}
+
+	// (x + c1) + c2, (c1 + x) - c2, (x - c1) + c2... are x + c (with the
+	// wraparound of their width)
+	Expression *inner = ast_node(ast, lhs_id);
+	if ((expr->tag == ADD_E || expr->tag == SUB_E) && rhs_known &&
+	    (inner->tag == ADD_E || inner->tag == SUB_E) &&
+	    inner->type == expr->type) {
+		uint16_t c1;
+		ExprId x = NO_EXPR;
+		if (fold_constant(ast, inner->binary.rhs, &c1)) {
+			x = inner->binary.lhs;
+			c1 = inner->tag == ADD_E ? c1 : -c1;
+		} else if (inner->tag == ADD_E &&
+			   fold_constant(ast, inner->binary.lhs, &c1)) {
+			x = inner->binary.rhs;
+		}
+		if (x != NO_EXPR) {
+			uint16_t c = expr->tag == ADD_E ? c1 + rhs : c1 - rhs;
+			Expression *number = ast_node(ast, rhs_id);
+			fold_number(number, expr->type, c);
+			expr->tag = ADD_E;
+			expr->binary.lhs = x;
+			lhs_id = x;
+			rhs = number->number.value;
+		}
+	}
+
+	// x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 are x
+	ExprId same = NO_EXPR;
+	switch ((ExpressionType)expr->tag) {
+	case ADD_E:
+		same = (rhs_known && rhs == 0)	 ? lhs_id
+		       : (lhs_known && lhs == 0) ? rhs_id
+						 : NO_EXPR;
+		break;
+	case SUB_E:
+		same = (rhs_known && rhs == 0) ? lhs_id : NO_EXPR;
+		break;
+	case MULT_E:
+		same = (rhs_known && rhs == 1)	 ? lhs_id
+		       : (lhs_known && lhs == 1) ? rhs_id
+						 : NO_EXPR;
+		// x * 0 and 0 * x are 0
+		if ((rhs_known && rhs == 0 && fold_pure(state, lhs_id)) ||
+		    (lhs_known && lhs == 0 && fold_pure(state, rhs_id))) {
+			fold_number(expr, expr->type, 0);
+			return;
+		}
+		break;
+	case DIV_E:
+		same = (rhs_known && rhs == 1) ? lhs_id : NO_EXPR;
+		break;
+	default:
+		break;
+	}
+	if (same != NO_EXPR) {
+		*expr = *ast_node(ast, same);
+	}
+}
+
+// Folds the expression `id` in place, in the order of its compilation
+void fold_expr(FoldState *state, ExprId id) {
+	Ast *ast = state->ast;
+	Expression *expr = ast_node(ast, id);
+	switch ((ExpressionType)expr->tag) {
+	case LET_E:
+		fold_expr(state, expr->let.e);
+		var_layout_append(&state->vars, expr->let.type, expr->let.var);
+		return;
+	case SEQUENCE_E:
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			fold_expr(state, ast->items[expr->sequence.first + i]);
+		}
+		return;
+	case ASSIGN_E:
+		fold_expr(state, expr->assign.e);
+		return;
+	case DEREF_ASSIGN_E:
+		fold_expr(state, expr->deref_assign.e1);
+		fold_expr(state, expr->deref_assign.e2);
+		return;
+	case DEREF_E:
+		fold_expr(state, expr->deref.e);
+		return;
+	case IF_ELSE_E: {
+		fold_expr(state, expr->if_else.cond);
+		uint16_t cond;
+		if (fold_constant(ast, expr->if_else.cond, &cond)) {
+			// The JCN of the `if` tests the whole value
+			ExprId taken = cond != 0 ? expr->if_else.if_body
+						 : expr->if_else.else_body;
+			ExprId other = cond != 0 ? expr->if_else.else_body
+						 : expr->if_else.if_body;
+			if (other == NO_EXPR || fold_removable(state, other)) {
+				if (taken == NO_EXPR) {
+					*expr = expression_new(SEQUENCE_E);
+					expr->type = VOID_T;
+					return;
+				}
+				*expr = *ast_node(ast, taken);
+				fold_expr(state, id);
+				return;
+			}
+		}
+		fold_expr(state, expr->if_else.if_body);
+		if (expr->if_else.else_body != NO_EXPR) {
+			fold_expr(state, expr->if_else.else_body);
+		}
+		return;
+	}
+	default:
+		if (fold_is_binary(expr->tag)) {
+			fold_expr(state, expr->binary.lhs);
+			fold_expr(state, expr->binary.rhs);
+			fold_binary(state, id);
+		}
+		return;
+	}
+}
+
+// `by_symbol` is shared by all the functions (full of 0)
+void fold_function(Ast *ast, Function *function, uint16_t *by_symbol) {
+	FoldState state;
+	state.vars = var_layout_empty(by_symbol);
+	state.ast = ast;
+	fold_expr(&state, function->expr);
+	var_layout_delete(state.vars);
+}
+
 ///// ----- COMPILE ----- /////
-PartProgram *compile_expr(CompilerState *state, Expression *expr) {
-	switch (expr->tag) {
+
+typedef struct {
+	FILE *error;
+	VariableLayout vars;
+	Ast *ast;	  // nodes of the compiled function
+	Emitter *emitter; // buffer of the compiled function
+} CompilerState;
+
+// Converts the value of `id`, at the end of `code`, to the width `type`
+void emit_conversion(CompilerState *state, ExprId id, ProgramType type,
+		     Code *code) {
+	ProgramType from = ast_node(state->ast, id)->type;
+	if (from == U8_T && type == U16_T) {
+		emit_number(state->emitter, code, NULL, U8_T, 0);
+		emit_instruction(state->emitter, code, "u8 to u16", SWP);
+	} else if (from == U16_T && type == U8_T) {
+		emit_instruction(state->emitter, code, "u16 to u8", NIP);
+	}
+}
+
+// Compile the expression `id` at the end of `code`
+// Returns false on error: what was emitted in `code` should not be used
+bool compile_expr(CompilerState *state, ExprId id, Code *code) {
+	Emitter *emitter = state->emitter;
+	Expression *expr = ast_node(state->ast, id);
+	switch ((ExpressionType)expr->tag) {
 	case LET_E: {
 		// Compile the expression
-		PartProgram *let = compile_expr(state, expr->let.e);
-		if (let == NULL) {
+		ProgramType type = expr->let.type == U16_T ? U16_T : U8_T;
+		if (!compile_expr(state, expr->let.e, code)) {
 			fprintf(state->error, "compiling expr\n");
-			return NULL;
+			return false;
 		}
+		emit_conversion(state, expr->let.e, type, code);
 
 		// Add the variable to the variable list
 		var_layout_append(&state->vars, expr->let.type, expr->let.var);
@@ -280,11 +1202,10 @@ PartProgram *compile_expr(CompilerState *state, Expression *expr) {
 		VariableInfo var_info =
 		    var_layout_get_addr(&state->vars, expr->let.var);
 
-		// Right now we assume that the value is of size 8 bits
-		append_instruction(let, NULL, LIT);
-		append_number(let, NULL, var_info.addr);
-		append_instruction(let, "let def", STZ);
-		return let;
+		emit_number(emitter, code, NULL, U8_T, var_info.addr);
+		emit_instruction(emitter, code, "let def",
+				 instruction_of_type(STZ, type));
+		return true;
 	}
 	case ADD_E:
 	case SUB_E:
@@ -296,194 +1217,183 @@ PartProgram *compile_expr(CompilerState *state, Expression *expr) {
 	case GREATER_THAN_EQUAL_E:
 	case LESS_THAN_E:
 	case LESS_THAN_EQUAL_E: {
-		PartProgram *lhs = compile_expr(state, expr->binary.lhs);
-		if (lhs == NULL) {
+		ProgramType type = operand_type(state->ast, expr);
+		if (!compile_expr(state, expr->binary.lhs, code)) {
 			break;
 		}
-		PartProgram *rhs = compile_expr(state, expr->binary.rhs);
-		if (rhs == NULL) {
-			part_program_delete(lhs);
+		emit_conversion(state, expr->binary.lhs, type, code);
+		if (!compile_expr(state, expr->binary.rhs, code)) {
 			break;
 		}
-		PartProgram *add = part_program_empty();
-		append_instruction(add, "binary op",
-				   binary_tag_to_instruction(expr->tag));
-		return concat_program(concat_program(lhs, rhs), add);
+		emit_conversion(state, expr->binary.rhs, type, code);
+		emit_instruction(
+		    emitter, code, "binary op",
+		    instruction_of_type(binary_tag_to_instruction(expr->tag),
+					type));
+		return true;
 	}
 	case SEQUENCE_E: {
-		PartProgram *sequence = part_program_empty();
-		for (int i = 0; i < expr->sequence.len; i++) {
-			PartProgram *e =
-			    compile_expr(state, &expr->sequence.list[i]);
-			if (e == NULL) {
-				part_program_delete(sequence);
-				return NULL;
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			ExprId item =
+			    state->ast->items[expr->sequence.first + i];
+			if (!compile_expr(state, item, code)) {
+				return false;
 			}
-			sequence = concat_program(sequence, e);
 		}
-		return sequence;
+		return true;
 	}
 	case ASSIGN_E: {
-		char *name = expr->assign.var;
+		Symbol name = expr->assign.var;
 
 		// Compile the expression
-		PartProgram *assign = compile_expr(state, expr->assign.e);
-		if (assign == NULL) {
+		ProgramType type = var_type(&state->vars, name);
+		if (!compile_expr(state, expr->assign.e, code)) {
 			fprintf(state->error, "compiling expr\n");
-			return NULL;
+			return false;
 		}
+		emit_conversion(state, expr->assign.e, type, code);
 
 		// Get the address of this new variable
 		VariableInfo var_info = var_layout_get_addr(&state->vars, name);
 
-		// Right now we assume that the value is of size 8 bits
-		append_instruction(assign, NULL, LIT);
-		append_number(assign, NULL, var_info.addr);
-		append_instruction(assign, "assign def", STZ);
-		return assign;
+		emit_number(emitter, code, NULL, U8_T, var_info.addr);
+		emit_instruction(emitter, code, "assign def",
+				 instruction_of_type(STZ, type));
+		return true;
 	}
 	case DEREF_ASSIGN_E: { // *e1 = e2
-		PartProgram *e1 = compile_expr(state, expr->deref_assign.e1);
-		if (e1 == NULL) {
+		// e1 is compiled first but its code goes after the code of e2
+		// The address of a device and the value written are bytes
+		Code e1 = code_empty();
+		if (!compile_expr(state, expr->deref_assign.e1, &e1)) {
 			break;
 		}
-		PartProgram *e2 = compile_expr(state, expr->deref_assign.e2);
-		if (e2 == NULL) {
+		emit_conversion(state, expr->deref_assign.e1, U8_T, &e1);
+		Code e2 = code_empty();
+		if (!compile_expr(state, expr->deref_assign.e2, &e2)) {
 			break;
 		}
-		append_instruction(e1, "Deref Assign", DEO);
-		return concat_program(e2, e1);
+		emit_conversion(state, expr->deref_assign.e2, U8_T, &e2);
+		emit_instruction(emitter, &e1, "Deref Assign", DEO);
+		*code = code_concat(emitter, *code,
+				    code_concat(emitter, e2, e1));
+		return true;
 	}
 	case DEREF_E: { // *e
-		PartProgram *e = compile_expr(state, expr->deref.e);
-		if (e == NULL) {
+		if (!compile_expr(state, expr->deref.e, code)) {
 			break;
 		}
-		append_instruction(e, "Deref", LDZ);
-		return e;
+		emit_conversion(state, expr->deref.e, U8_T, code);
+		emit_instruction(emitter, code, "Deref", LDZ);
+		return true;
 	}
 	case VARIABLE_E: {
-		char *name = expr->variable.name;
-		PartProgram *var = part_program_empty();
+		Symbol name = expr->variable.name;
 
 		// Get the variable address
 		VariableInfo var_info = var_layout_get_addr(&state->vars, name);
 		if (!var_info.defined) {
-			fprintf(state->error, "var '%s' not defined\n", name);
+			fprintf(state->error, "var '%s' not defined\n",
+				symbol_name(name));
 			break;
 		}
 		// Put the address on the stack
-		append_instruction(var, NULL, LIT);
-		append_number(var, NULL, var_info.addr);
-		append_instruction(var, "Var", LDZ);
-		return var;
+		emit_number(emitter, code, NULL, U8_T, var_info.addr);
+		emit_instruction(emitter, code, "Var",
+				 instruction_of_type(LDZ, expr->type));
+		return true;
 	}
 	case NUMBER_E: {
-		PartProgram *number = part_program_empty();
-		if (expr->number.value < 0x1000) {
-			append_instruction(number, NULL, LIT);
-		} else {
-			append_instruction(number, NULL, LIT2);
-		}
-		append_number(number, NULL, expr->number.value);
-		return number;
+		emit_number(emitter, code, NULL, expr->type,
+			    expr->number.value);
+		return true;
 	}
 	case RETURN_E: {
 		fprintf(state->error, "return todo\n");
 		break;
 	}
 	case FUNCTION_CALL_E: {
-		PartProgram *p = part_program_empty();
 		// Ajout de l'adresse actuelle( + 1) sur la return stack
 		// JMP
 		// Addresse de la function expr->fun_call.name
 		// Ajout
 		fprintf(state->error, "function call todo\n");
-		return p;
+		break;
 	}
 	case CHAR_LITERAL_E: {
-		PartProgram *number = part_program_empty();
-		append_instruction(number, NULL, LIT);
-		append_number(number, NULL, expr->char_literal.c);
-		return number;
+		emit_number(emitter, code, NULL, expr->type,
+			    (uint8_t)expr->char_literal.c);
+		return true;
 	}
 	case STRING_LITERAL_E: {
 		fprintf(state->error, "string literal todo\n");
 		break;
 	}
 	case IF_ELSE_E: {
-		PartProgram *cond = compile_expr(state, expr->if_else.cond);
-		if (cond == NULL) {
+		if (!compile_expr(state, expr->if_else.cond, code)) {
 			break;
 		}
-		PartProgram *if_body =
-		    compile_expr(state, expr->if_else.if_body);
-		if (if_body == NULL) {
-			part_program_delete(cond);
-			break;
+		// JCN tests a byte: the two bytes of a u16 are merged
+		if (ast_node(state->ast, expr->if_else.cond)->type == U16_T) {
+			emit_instruction(emitter, code, "u16 condition", ORA);
 		}
-		PartProgram *else_body = NULL;
-		if (expr->if_else.else_body != NULL) {
-			else_body =
-			    compile_expr(state, expr->if_else.else_body);
-			if (else_body == NULL) {
-				part_program_delete(cond);
-				part_program_delete(if_body);
-				break;
-			}
+		// from cond jump over else or go to else body
+		emit_instruction(emitter, code, NULL, LIT);
+		uint32_t jump_else = emit_fixup(emitter, code);
+		emit_instruction(emitter, code, "if jump", JCN);
+
+		Code if_body = code_empty();
+		if (!compile_expr(state, expr->if_else.if_body, &if_body)) {
+			break;
 		}
-		if (else_body == NULL) {
-			else_body = part_program_empty();
+		Code else_body = code_empty();
+		if (expr->if_else.else_body != NO_EXPR &&
+		    !compile_expr(state, expr->if_else.else_body,
+				  &else_body)) {
+			break;
 		}
-		// from cond jump over else or go to else body
-		append_instruction(cond, NULL, LIT);
-		if (else_body->len > 255) {
+		if (else_body.len > 255) {
 			fprintf(state->error, "body else too large (> 255)");
 			break;
 		}
-		append_number(cond, NULL, else_body->len + 3);
-		append_instruction(cond, "if jump", JCN);
+		emitter_fixup(emitter, jump_else, else_body.len + 3);
 
-		if (if_body->len > 255) {
+		if (if_body.len > 255) {
 			fprintf(state->error, "body if too large (> 255)");
 			break;
 		}
 		// end of else_body jump after if_body
-		append_instruction(else_body, NULL, LIT);
-		append_number(else_body, NULL, if_body->len);
-		append_instruction(else_body, "else body and jump", JMP);
-		return concat_program(cond, concat_program(else_body, if_body));
+		emit_instruction(emitter, &else_body, NULL, LIT);
+		uint32_t jump_if = emit_fixup(emitter, &else_body);
+		emit_instruction(emitter, &else_body, "else body and jump",
+				 JMP);
+		emitter_fixup(emitter, jump_if, if_body.len);
+
+		*code = code_concat(emitter, *code,
+				    code_concat(emitter, else_body, if_body));
+		return true;
 	}
 	}
 	fprintf(state->error, "compiling: ");
-	fprintf_expression(state->error, expr);
+	fprintf_expression(state->error, state->ast, id);
 	fprintf(state->error, "\n");
-	return NULL;
+	return false;
 }
 
-PartProgram compile_function(FILE *error, Function *function) {
-
-	VariableLayout vars;
-	vars.names = NULL;
-	vars.types = NULL;
-	vars.len = 0;
-	vars.cap = 0;
-
+// Compile `function` with its own emitter in `code`
+// Returns false on error (the folding can leave a function without code)
+bool compile_function(FILE *error, Ast *ast, Function *function,
+		      uint16_t *by_symbol, Emitter *emitter, Code *code) {
 	CompilerState state;
 	state.error = error;
-	state.vars = vars;
-
-	PartProgram result;
+	state.vars = var_layout_empty(by_symbol);
+	state.ast = ast;
+	state.emitter = emitter;
 
-	PartProgram *expr = compile_expr(&state, function->expr);
-	if (expr == NULL) {
-		result.len = 0;
-	} else {
-		result = *expr;
-		free(expr);
-	}
-	var_layout_delete(vars);
-	return result;
+	*code = code_empty();
+	bool ok = compile_expr(&state, function->expr, code);
+	var_layout_delete(state.vars);
+	return ok;
 }
 
 Program *compile_to_uxn(FILE *error, Ast *ast) {
@@ -493,71 +1403,95 @@ Program *compile_to_uxn(FILE *error, Ast *ast) {
 		return NULL;
 	}
 
-	// Get the 'main' if there is one else stop the compilation
-	bool found_main = false;
-	int index_main = 0;
-	for (int i = 0; i < ast->len; i++) {
-		if (strcmp(ast->functions[i].name, "main") == 0) {
-			found_main = true;
-			index_main = i;
-			break;
-		}
+	// Index (+ 1) of the function named by every symbol (0 if none)
+	Symbol main_name = symbol_intern("main", 4);
+	uint16_t *fun_by_symbol = calloc(symbols_len(), sizeof(uint16_t));
+	for (int i = ast->len - 1; i >= 0; i--) {
+		fun_by_symbol[ast->functions[i].name] = i + 1;
 	}
-	if (!found_main) {
+
+	// Get the 'main' if there is one else stop the compilation
+	int index_main = fun_by_symbol[main_name] - 1;
+	free(fun_by_symbol);
+	if (index_main < 0) {
 		fprintf(error, "No main function in the file");
 		ast_delete(ast);
 		return NULL;
 	}
 
-	PartProgram *func_binary = malloc(sizeof(*func_binary) * ast->len);
+	// Index of the variable of every symbol, shared by all the functions
+	uint16_t *var_by_symbol = calloc(symbols_len(), sizeof(uint16_t));
+
+	Emitter *func_emitter = malloc(sizeof(*func_emitter) * ast->len);
+	Code *func_code = malloc(sizeof(*func_code) * ast->len);
 	uint16_t *func_pos = malloc(sizeof(*func_pos) * ast->len);
 	func_pos[index_main] = 0x100;
 
-	// 1. Compile the different function
-	for (int i = 0; i < ast->len; i++) {
-		PartProgram func = compile_function(error, &ast->functions[i]);
-		if (func.len == 0) {
+	// 0. Type the expressions, then fold the constants of every function
+	for (uint32_t i = 0; i < ast->len; i++) {
+		type_function(ast, &ast->functions[i], var_by_symbol);
+		fold_function(ast, &ast->functions[i], var_by_symbol);
+	}
+
+	// 1. Compile the different function, then optimise their code
+	PeepholeStats stats = {0};
+	for (uint32_t i = 0; i < ast->len; i++) {
+		func_emitter[i] = emitter_empty();
+		if (!compile_function(error, ast, &ast->functions[i],
+				      var_by_symbol, &func_emitter[i],
+				      &func_code[i])) {
 			fprintf(error, "Error compiling function '%s'",
-				ast->functions[i].name);
+				symbol_name(ast->functions[i].name));
+			for (uint32_t j = 0; j <= i; j++) {
+				emitter_delete(func_emitter[j]);
+			}
+			free(func_emitter);
+			free(func_code);
+			free(func_pos);
+			free(var_by_symbol);
 			ast_delete(ast);
 			return NULL;
 		}
-		func_binary[i] = func;
+		func_code[i] =
+		    peephole_optimise(&func_emitter[i], func_code[i], &stats);
 	}
+	free(var_by_symbol);
 
 	// 2. Compute the positions of every functions
 	uint16_t pos = 0x100;
-	pos += func_binary[index_main].len;
-	for (int i = 0; i < ast->len; i++) {
-		if (i == index_main) {
-			break;
+	pos += func_code[index_main].len;
+	for (uint32_t i = 0; i < ast->len; i++) {
+		if (i == (uint32_t)index_main) {
+			continue;
 		}
-		pos += func_binary[i].len;
 		func_pos[i] = pos;
+		pos += func_code[i].len;
 	}
 
-	// 3. Complete Address of functions in the partials programs
-	// Partial programs that calls other functions contains some waiting
-	// address. They are filled thanks to information from phase 1. and 2.
-	if (func_binary == NULL) {
-		ast_delete(ast);
-		return NULL;
-	}
+	// 3. Complete Address of functions in the emitters
+	// Functions that call other functions will record the slots of the
+	// waiting addresses as fixups, filled thanks to the positions of 2.
 
 	// 4. Write all functions in the complete program
-	// Initialize Program
-	Program *program = malloc(sizeof(*program));
-	for (int i = 0; i < 0x10000; i++) {
-		program->is_written[i] = false;
-		program->comments[i] = NULL;
-		program->is_instruction[i] = false; // not useful
-		program->memory[i] = BRK;	    // not useful
-	}
-	for (int i = 0; i < ast->len; i++) {
-		write_part_program(func_binary[i], program, func_pos[i]);
+	// in the order of their positions: the program is one segment
+	Program *program = uxn_program_empty();
+	program->peephole = stats;
+	Code main_code = func_code[index_main];
+	uxn_program_label(program, 0x100, main_name);
+	emitter_write(&func_emitter[index_main], main_code, program, 0x100);
+	emitter_delete(func_emitter[index_main]);
+	for (uint32_t i = 0; i < ast->len; i++) {
+		if (i == (uint32_t)index_main) {
+			continue;
+		}
+		uxn_program_label(program, func_pos[i], ast->functions[i].name);
+		emitter_write(&func_emitter[i], func_code[i], program,
+			      func_pos[i]);
+		emitter_delete(func_emitter[i]);
 	}
 
-	free(func_binary);
+	free(func_emitter);
+	free(func_code);
 	free(func_pos);
 	ast_delete(ast);
 	return program;
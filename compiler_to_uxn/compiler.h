@@ -1,8 +1,21 @@
 #include "compiler_utils.h"
 
+Program *uxn_program_empty(void);
+
 void uxn_program_delete(Program *uxn_program);
 
+// Write one byte at `addr`, after the bytes written before it
+void uxn_program_write(Program *uxn_program, uint16_t addr, Instruction inst,
+		       bool is_instruction, char *comment);
+
+// Name the address `addr` (written in the .sym file of the rom)
+void uxn_program_label(Program *uxn_program, uint16_t addr, Symbol name);
+
 // If an error occured compiling the 'ast' parameter this function :
 // - returns a NULL pointer
 // - write as much error information in the stream 'error'
 Program *compile_to_uxn(FILE* error, Ast *ast);
+
+// Write the uses and the bytes saved of the rules of the peephole optimiser
+// that changed the code of `uxn_program`
+void fprintf_peephole_stats(FILE *file, Program *uxn_program);
@@ -1,4 +1,6 @@
 #include "compiler_utils.h"
+#include <stdlib.h>
+#include <string.h>
 
 Instruction binary_tag_to_instruction(ExpressionType type) {
 	switch (type) {
@@ -27,6 +29,39 @@ Instruction binary_tag_to_instruction(ExpressionType type) {
 	}
 }
 
+uint16_t uxn_binary(Instruction inst, uint16_t a, uint16_t b) {
+	uint16_t mask = (inst & 1) ? 0xffff : 0xff; // 2: operates on shorts
+	a &= mask;
+	b &= mask;
+	switch (uxn_opcode(inst) & 0x1f) {
+	case 0x08: // EQU
+		return a == b;
+	case 0x09: // NEQ
+		return a != b;
+	case 0x0a: // GTH
+		return a > b;
+	case 0x0b: // LTH
+		return a < b;
+	case 0x18: // ADD
+		return (a + b) & mask;
+	case 0x19: // SUB
+		return (a - b) & mask;
+	case 0x1a: // MUL
+		return (a * b) & mask;
+	case 0x1b: // DIV
+		return b == 0 ? 0 : a / b;
+	case 0x1c: // AND
+		return a & b;
+	case 0x1d: // ORA
+		return a | b;
+	case 0x1e: // EOR
+		return a ^ b;
+	case 0x1f: // SFT
+		return (a >> (b & 0x0f) << (b >> 4 & 0x0f)) & mask;
+	}
+	return 0;
+}
+
 // clang-format off
 void fprintf_uxn_instruction(FILE *file, Instruction *inst) {
 	switch (*inst) {
@@ -291,21 +326,87 @@ void fprintf_uxn_instruction(FILE *file, Instruction *inst) {
 // clang-format on
 
 void fprintf_uxn_program(FILE *file, Program *uxn_program) {
-	for (int i = 0; i < 0x10000; i++) {
-		if (i == 0x100) {
-			fprintf(file, "|0100");
+	bool main_written = false;
+	for (uint32_t s = 0; s < uxn_program->len; s++) {
+		Segment *segment = &uxn_program->segments[s];
+		for (uint32_t i = 0; i < segment->len; i++) {
+			if (!main_written && segment->start + i >= 0x100) {
+				fprintf(file, "|0100");
+				main_written = true;
+			}
+			fprintf(file, " ");
+			if (segment->is_instruction[i]) {
+				fprintf_uxn_instruction(file,
+							&segment->memory[i]);
+			} else {
+				fprintf(file, "%02x",
+					(uint8_t)segment->memory[i]);
+			}
+			if (segment->comments != NULL &&
+			    segment->comments[i] != NULL) {
+				fprintf(file, " ( %s )\n",
+					segment->comments[i]);
+			}
 		}
-		if (!uxn_program->is_written[i]) {
-			continue;
+	}
+	if (!main_written) {
+		fprintf(file, "|0100");
+	}
+}
+
+uint8_t uxn_opcode(Instruction inst) {
+	// The first line of the enum (opcode 0) does not follow the modes
+	uint8_t first_line[8] = {0x00, 0xa0, 0xc0, 0xe0,
+				 0x80, 0x20, 0x40, 0x60};
+	uint8_t opcode = inst >> 3;
+	uint8_t modes = inst & 7; // 2, r and k are the bits 0, 1 and 2
+	if (opcode == 0) {
+		return first_line[modes];
+	}
+	return opcode | modes << 5;
+}
+
+bool write_uxn_rom(FILE *file, Program *uxn_program) {
+	uint32_t addr = 0x100; // next address to write in the file
+	for (uint32_t s = 0; s < uxn_program->len; s++) {
+		Segment *segment = &uxn_program->segments[s];
+		uint32_t start = segment->start;
+		uint32_t end = start + segment->len;
+		if (end <= addr) {
+			continue; // in the zero page
+		}
+		if (start < addr) {
+			start = addr;
+		}
+		for (; addr < start; addr++) {
+			fputc(0, file);
 		}
-		fprintf(file, " ");
-		if (uxn_program->is_instruction[i]) {
-			fprintf_uxn_instruction(file, &uxn_program->memory[i]);
-		} else {
-			fprintf(file, "%02x", (uint8_t)uxn_program->memory[i]);
+		uint8_t *bytes = malloc(end - start);
+		for (uint32_t i = start; i < end; i++) {
+			Instruction inst = segment->memory[i - segment->start];
+			if (segment->is_instruction[i - segment->start]) {
+				bytes[i - start] = uxn_opcode(inst);
+			} else {
+				bytes[i - start] = (uint8_t)inst;
+			}
 		}
-		if (uxn_program->comments[i] != NULL) {
-			fprintf(file, " ( %s )\n", uxn_program->comments[i]);
+		size_t written = fwrite(bytes, 1, end - start, file);
+		free(bytes);
+		if (written != end - start) {
+			return false;
 		}
+		addr = end;
+	}
+	return !ferror(file);
+}
+
+bool write_uxn_sym(FILE *file, Program *uxn_program) {
+	for (uint32_t i = 0; i < uxn_program->labels_len; i++) {
+		Label label = uxn_program->labels[i];
+		fputc(label.addr >> 8, file);
+		fputc(label.addr & 0xff, file);
+		const char *name = symbol_name(label.name);
+		fwrite(name, 1, strlen(name) + 1, file);
 	}
+	return !ferror(file);
 }
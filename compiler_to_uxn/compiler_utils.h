@@ -79,17 +79,72 @@ SFT, SFT2, SFTr, SFT2r, SFTk, SFT2k, SFTkr, SFT2kr,
 } Instruction;
 // clang-format on
 
-typedef struct { // 0x10000 bytes = 64ko of memory
-	char *comments[0x10000];
-	Instruction memory[0x10000];
-	bool is_instruction[0x10000];
-	bool is_written[0x10000];
+// Bytes written one after the other from the address `start`
+typedef struct {
+	uint16_t start;
+	uint32_t len;
+	uint32_t cap;
+	Instruction *memory;
+	bool *is_instruction;
+	char **comments; // NULL until a byte of the segment has a comment
+} Segment;
+
+// Name of the code at the address `addr` (a function)
+typedef struct {
+	uint16_t addr;
+	Symbol name;
+} Label;
+
+// Number of rules of the peephole optimiser (`peephole_rules` of compiler.c)
+#define NB_PEEPHOLE_RULES 20
+
+// Number of uses and bytes saved of every rule of the peephole optimiser
+typedef struct {
+	uint32_t uses[NB_PEEPHOLE_RULES];
+	uint32_t saved[NB_PEEPHOLE_RULES];
+} PeepholeStats;
+
+// Only the written bytes of the 0x10000 bytes (64ko) of memory are kept
+typedef struct {
+	uint32_t len;
+	uint32_t cap;
+	Segment *segments; // sorted by address, they do not overlap
+
+	uint32_t labels_len;
+	uint32_t labels_cap;
+	Label *labels;
+
+	PeepholeStats peephole; // what the peephole optimiser did to the code
 } Program;
 
 Instruction binary_tag_to_instruction(ExpressionType type);
 
+// Value pushed by the binary instruction `inst` (ADD, EQU, DIV2, ...) for the
+// operands `a` and `b`, with the wraparound of its size
+uint16_t uxn_binary(Instruction inst, uint16_t a, uint16_t b);
+
 // clang-format off
 void fprintf_uxn_instruction(FILE *file, Instruction *inst);
 // clang-format off
 
 void fprintf_uxn_program(FILE *file, Program *uxn_program);
+
+// Returns the byte of `inst` in a rom (the opcode with its mode bits)
+uint8_t uxn_opcode(Instruction inst);
+
+// Write the rom of `uxn_program`: its bytes from 0x100 to the last written
+// byte, the bytes that are not written are 0
+// Returns false if the file could not be written
+bool write_uxn_rom(FILE *file, Program *uxn_program);
+
+// Write the labels of `uxn_program` in the .sym format of uxnasm: for every
+// label its address (2 bytes, big endian) then its name ended by '\0'
+// Returns false if the file could not be written
+bool write_uxn_sym(FILE *file, Program *uxn_program);
+
+// Write a C program that executes the rom of `uxn_program` like uxncli (with
+// the console and system devices): the reachable code is translated ahead of
+// time, every basic block is a label of `main`. Writing into the translated
+// code stops the program with an error.
+// Returns false if the file could not be written
+bool write_uxn_c(FILE *file, Program *uxn_program);
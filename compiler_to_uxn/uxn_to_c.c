@@ -0,0 +1,570 @@
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Translation of the rom of a program in C. The code reachable from 0x100 is
+// cut in units: one instruction, or a literal and the jump that uses it
+// (LIT off JMP, LIT2 addr JSR2, ...) whose target is then known. The units
+// are translated in the order of their addresses, every start of a basic
+// block is a label of `main`. The jumps to an address only known at run
+// time (JMP2r) go through a switch on all the labels.
+
+///// ----- ANALYSIS ----- /////
+
+typedef struct {
+	uint8_t memory[0x10000];
+	bool reachable[0x10000]; // a unit starts at this address
+	bool label[0x10000];	 // a basic block starts at this address
+	bool dynamic;		 // a jump has a target known at run time
+} Translation;
+
+typedef struct {
+	uint16_t len;
+	bool falls;	 // the next unit can be executed after it
+	bool jumps;	 // it can jump to `target`
+	bool calls;	 // the code at `next` is executed when the call returns
+	bool fused;	 // a literal and its jump
+	bool dynamic;	 // it jumps to an address popped from a stack
+	uint16_t target;
+} Unit;
+
+uint16_t peek_short(Translation *t, uint16_t addr) {
+	return t->memory[addr] << 8 | t->memory[(uint16_t)(addr + 1)];
+}
+
+Unit decode_unit(Translation *t, uint16_t pc) {
+	uint8_t *m = t->memory;
+	uint8_t inst = m[pc];
+	Unit unit = {.len = 1, .falls = true};
+	uint16_t next = pc + 3;
+	switch (inst) {
+	case 0x00: // BRK
+		unit.falls = false;
+		return unit;
+	case 0x20: // JCI
+		return (Unit){.len = 3, .falls = true, .jumps = true,
+			      .target = next + peek_short(t, pc + 1)};
+	case 0x40: // JMI
+		return (Unit){.len = 3, .jumps = true,
+			      .target = next + peek_short(t, pc + 1)};
+	case 0x60: // JSI
+		return (Unit){.len = 3, .jumps = true, .calls = true,
+			      .target = next + peek_short(t, pc + 1)};
+	case 0x80: // LIT
+	case 0xc0: // LITr
+	case 0xa0: // LIT2
+	case 0xe0: { // LIT2r
+		bool s = inst & 0x20;
+		unit.len = s ? 3 : 2;
+		// the jump without k on the same stack with the same size
+		uint16_t jump_pc = pc + unit.len;
+		uint8_t jump = m[jump_pc];
+		uint8_t op = jump & 0x1f;
+		if ((op == 0x0c || op == 0x0d || op == 0x0e) &&
+		    (jump & 0xe0) == (inst & 0x60)) {
+			unit.len++;
+			unit.fused = true;
+			unit.jumps = true;
+			int8_t offset = m[(uint16_t)(pc + 1)];
+			unit.target = s ? peek_short(t, pc + 1)
+					: (uint16_t)(jump_pc + 1 + offset);
+			unit.falls = op == 0x0d;
+			unit.calls = op == 0x0e;
+		}
+		return unit;
+	}
+	}
+	uint8_t op = inst & 0x1f;
+	if (op == 0x0c || op == 0x0e) { // JMP, JSR
+		unit.falls = false;
+		unit.dynamic = true;
+		unit.calls = op == 0x0e;
+	} else if (op == 0x0d) { // JCN
+		unit.dynamic = true;
+	}
+	return unit;
+}
+
+// Returns the address of the unit written after the one at `pc`, or 0x10000
+uint32_t next_written(Translation *t, uint16_t pc) {
+	for (uint32_t next = pc + 1; next < 0x10000; next++) {
+		if (t->reachable[next]) {
+			return next;
+		}
+	}
+	return 0x10000;
+}
+
+// Marks the units reachable from 0x100 and the starts of the basic blocks
+void analyse(Translation *t) {
+	uint16_t *todo = malloc(0x10000 * sizeof(*todo));
+	uint32_t todo_len = 0;
+	todo[todo_len++] = 0x100;
+	t->label[0x100] = true;
+	while (todo_len > 0) {
+		uint16_t pc = todo[--todo_len];
+		if (t->reachable[pc]) {
+			continue;
+		}
+		t->reachable[pc] = true;
+		Unit unit = decode_unit(t, pc);
+		uint16_t next = pc + unit.len;
+		uint16_t successors[2];
+		uint8_t nb_successors = 0;
+		if (unit.falls || unit.calls) {
+			successors[nb_successors++] = next;
+		}
+		if (unit.jumps) {
+			successors[nb_successors++] = unit.target;
+			t->label[unit.target] = true;
+		}
+		// after a conditional jump or a call a new block starts
+		bool jumps = unit.jumps || unit.dynamic;
+		if (jumps && (unit.falls || unit.calls)) {
+			t->label[next] = true;
+		}
+		t->dynamic |= unit.dynamic;
+		for (uint8_t i = 0; i < nb_successors; i++) {
+			if (!t->reachable[successors[i]]) {
+				todo[todo_len++] = successors[i];
+			}
+		}
+	}
+	free(todo);
+
+	// A unit that does not fall in the one written after it jumps to it
+	uint32_t previous_next = 0x10000;
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (!t->reachable[pc]) {
+			continue;
+		}
+		if (previous_next != 0x10000 && previous_next != pc) {
+			t->label[previous_next] = true;
+		}
+		Unit unit = decode_unit(t, pc);
+		previous_next = (unit.falls || unit.calls)
+				    ? (uint16_t)(pc + unit.len)
+				    : 0x10000;
+	}
+	if (previous_next != 0x10000) {
+		t->label[previous_next] = true;
+	}
+}
+
+///// ----- C CODE ----- /////
+
+// The machine of the translated program: the console and system devices like
+// `uxncli`, the stacks wrap around (their pointers are bytes)
+const char *c_prelude =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static uint8_t m[0x10000], dev[0x100], ws[0x100], rs[0x100], wp, rp;\n"
+    "static uint8_t is_code[0x10000];\n"
+    "\n"
+    "#define POP1(s, p) (s[--p])\n"
+    "#define POP2(s, p) (p -= 2, (uint16_t)(s[p] << 8 | s[(uint8_t)(p + 1)]))\n"
+    "#define PUSH1(s, p, v) (s[p++] = (uint8_t)(v))\n"
+    "#define PUSH2(s, p, v) "
+    "(s[p++] = (uint8_t)((uint16_t)(v) >> 8), s[p++] = (uint8_t)(v))\n"
+    "#define PEEK1(a) (m[(uint16_t)(a)])\n"
+    "#define PEEK2(a) (m[(uint16_t)(a)] << 8 | m[(uint16_t)((a) + 1)])\n"
+    "#define POKE1(a, v) poke((a), (v))\n"
+    "#define POKE2(a, v) (poke((a), (v) >> 8), poke((a) + 1, (v)))\n"
+    "\n"
+    "static void poke(uint16_t addr, uint8_t value) {\n"
+    "\tm[addr] = value;\n"
+    "\tif (is_code[addr]) {\n"
+    "\t\tfprintf(stderr, \"Error: the code at %04x was modified\\n\", "
+    "addr);\n"
+    "\t\texit(1);\n"
+    "\t}\n"
+    "}\n"
+    "\n"
+    "static uint8_t dei(uint8_t port) {\n"
+    "\tswitch (port) {\n"
+    "\tcase 0x04:\n"
+    "\t\treturn wp;\n"
+    "\tcase 0x05:\n"
+    "\t\treturn rp;\n"
+    "\t}\n"
+    "\treturn dev[port];\n"
+    "}\n"
+    "\n"
+    "static void deo(uint8_t port, uint8_t value) {\n"
+    "\tdev[port] = value;\n"
+    "\tswitch (port) {\n"
+    "\tcase 0x04:\n"
+    "\t\twp = value;\n"
+    "\t\tbreak;\n"
+    "\tcase 0x05:\n"
+    "\t\trp = value;\n"
+    "\t\tbreak;\n"
+    "\tcase 0x0e:\n"
+    "\t\tif (value != 0) {\n"
+    "\t\t\tfprintf(stderr, \"WST\");\n"
+    "\t\t\tfor (uint8_t i = 0; i < wp; i++)\n"
+    "\t\t\t\tfprintf(stderr, \" %02x\", ws[i]);\n"
+    "\t\t\tfprintf(stderr, \"\\nRST\");\n"
+    "\t\t\tfor (uint8_t i = 0; i < rp; i++)\n"
+    "\t\t\t\tfprintf(stderr, \" %02x\", rs[i]);\n"
+    "\t\t\tfprintf(stderr, \"\\n\");\n"
+    "\t\t}\n"
+    "\t\tbreak;\n"
+    "\tcase 0x18:\n"
+    "\t\tputchar(value);\n"
+    "\t\tbreak;\n"
+    "\tcase 0x19:\n"
+    "\t\tfputc(value, stderr);\n"
+    "\t\tbreak;\n"
+    "\t}\n"
+    "}\n"
+    "\n";
+
+// Names used in the code of an instruction
+typedef struct {
+	char size;	   // '1' or '2'
+	const char *stack; // ws or rs
+	const char *pop;   // pointer moved by the pops (kp in keep mode)
+	const char *push;  // pointer moved by the pushes
+	const char *other;
+	const char *other_push;
+	uint16_t next; // address after the instruction
+} Operands;
+
+void write_goto(FILE *file, uint16_t target) {
+	fprintf(file, "goto L_%04x;", target);
+}
+
+// Writes the C code of the instruction `inst` (not in the first line of the
+// opcodes) that is not fused with a literal
+void write_instruction(FILE *file, uint8_t inst, Operands o) {
+	char s = o.size;
+	const char *st = o.stack;
+	const char *p = o.pop;
+	const char *q = o.push;
+	// The binary operations and comparisons: b = POP; a = POP; PUSH(...)
+	const char *binary[] = {
+	    [0x08] = "a == b", [0x09] = "a != b",	    [0x0a] = "a > b",
+	    [0x0b] = "a < b",  [0x18] = "a + b",	    [0x19] = "a - b",
+	    [0x1a] = "a * b",  [0x1b] = "b == 0 ? 0 : a / b", [0x1c] = "a & b",
+	    [0x1d] = "a | b",  [0x1e] = "a ^ b",
+	};
+	uint8_t op = inst & 0x1f;
+	if (op < sizeof(binary) / sizeof(*binary) && binary[op] != NULL) {
+		char push_size = (op >= 0x08 && op <= 0x0b) ? '1' : s;
+		fprintf(file,
+			"b = POP%c(%s, %s); a = POP%c(%s, %s); "
+			"PUSH%c(%s, %s, %s);",
+			s, st, p, s, st, p, push_size, st, q, binary[op]);
+		return;
+	}
+	switch (op) {
+	case 0x01: // INC
+		fprintf(file, "a = POP%c(%s, %s); PUSH%c(%s, %s, a + 1);", s,
+			st, p, s, st, q);
+		break;
+	case 0x02: // POP
+		fprintf(file, "(void)POP%c(%s, %s);", s, st, p);
+		break;
+	case 0x03: // NIP
+		fprintf(file,
+			"b = POP%c(%s, %s); (void)POP%c(%s, %s); "
+			"PUSH%c(%s, %s, b);",
+			s, st, p, s, st, p, s, st, q);
+		break;
+	case 0x04: // SWP
+		fprintf(file,
+			"b = POP%c(%s, %s); a = POP%c(%s, %s); "
+			"PUSH%c(%s, %s, b); PUSH%c(%s, %s, a);",
+			s, st, p, s, st, p, s, st, q, s, st, q);
+		break;
+	case 0x05: // ROT
+		fprintf(file,
+			"c = POP%c(%s, %s); b = POP%c(%s, %s); "
+			"a = POP%c(%s, %s); PUSH%c(%s, %s, b); "
+			"PUSH%c(%s, %s, c); PUSH%c(%s, %s, a);",
+			s, st, p, s, st, p, s, st, p, s, st, q, s, st, q, s,
+			st, q);
+		break;
+	case 0x06: // DUP
+		fprintf(file,
+			"a = POP%c(%s, %s); PUSH%c(%s, %s, a); "
+			"PUSH%c(%s, %s, a);",
+			s, st, p, s, st, q, s, st, q);
+		break;
+	case 0x07: // OVR
+		fprintf(file,
+			"b = POP%c(%s, %s); a = POP%c(%s, %s); "
+			"PUSH%c(%s, %s, a); PUSH%c(%s, %s, b); "
+			"PUSH%c(%s, %s, a);",
+			s, st, p, s, st, p, s, st, q, s, st, q, s, st, q);
+		break;
+	case 0x0c: // JMP
+	case 0x0d: // JCN
+	case 0x0e: { // JSR
+		char target[32];
+		if (s == '2') {
+			snprintf(target, sizeof(target), "a");
+		} else {
+			snprintf(target, sizeof(target),
+				 "(uint16_t)(0x%04x + (int8_t)a)", o.next);
+		}
+		fprintf(file, "a = POP%c(%s, %s); ", s, st, p);
+		if (op == 0x0d) {
+			fprintf(file,
+				"if (POP1(%s, %s)) { pc = %s; goto dispatch; }",
+				st, p, target);
+		} else if (op == 0x0e) {
+			fprintf(file,
+				"PUSH2(%s, %s, 0x%04x); pc = %s; "
+				"goto dispatch;",
+				o.other, o.other_push, o.next, target);
+		} else {
+			fprintf(file, "pc = %s; goto dispatch;", target);
+		}
+		break;
+	}
+	case 0x0f: // STH
+		fprintf(file, "a = POP%c(%s, %s); PUSH%c(%s, %s, a);", s, st,
+			p, s, o.other, o.other_push);
+		break;
+	case 0x10: // LDZ
+		fprintf(file, "a = POP1(%s, %s); PUSH%c(%s, %s, PEEK%c(a));",
+			st, p, s, st, q, s);
+		break;
+	case 0x11: // STZ
+		fprintf(file,
+			"a = POP1(%s, %s); b = POP%c(%s, %s); POKE%c(a, b);",
+			st, p, s, st, p, s);
+		break;
+	case 0x12: // LDR
+		fprintf(file,
+			"a = 0x%04x + (int8_t)POP1(%s, %s); "
+			"PUSH%c(%s, %s, PEEK%c(a));",
+			o.next, st, p, s, st, q, s);
+		break;
+	case 0x13: // STR
+		fprintf(file,
+			"a = 0x%04x + (int8_t)POP1(%s, %s); "
+			"b = POP%c(%s, %s); POKE%c(a, b);",
+			o.next, st, p, s, st, p, s);
+		break;
+	case 0x14: // LDA
+		fprintf(file, "a = POP2(%s, %s); PUSH%c(%s, %s, PEEK%c(a));",
+			st, p, s, st, q, s);
+		break;
+	case 0x15: // STA
+		fprintf(file,
+			"a = POP2(%s, %s); b = POP%c(%s, %s); POKE%c(a, b);",
+			st, p, s, st, p, s);
+		break;
+	case 0x16: // DEI
+		fprintf(file, "a = POP1(%s, %s); b = dei(a); ", st, p);
+		if (s == '2') {
+			fprintf(file, "b = b << 8 | dei(a + 1); ");
+		}
+		fprintf(file, "PUSH%c(%s, %s, b);", s, st, q);
+		break;
+	case 0x17: // DEO
+		fprintf(file, "a = POP1(%s, %s); b = POP%c(%s, %s); ", st, p, s,
+			st, p);
+		if (s == '2') {
+			fprintf(file, "deo(a++, b >> 8); ");
+		}
+		fprintf(file, "deo(a, b);");
+		break;
+	case 0x1f: // SFT
+		fprintf(file,
+			"b = POP1(%s, %s); a = POP%c(%s, %s); "
+			"PUSH%c(%s, %s, a >> (b & 0x0f) << (b >> 4));",
+			st, p, s, st, p, s, st, q);
+		break;
+	}
+}
+
+// Returns the instruction of the byte `opcode` (inverse of uxn_opcode)
+Instruction opcode_instruction(uint8_t opcode) {
+	uint8_t modes = (opcode >> 5 & 1) | (opcode >> 6 & 1) << 1 |
+			(opcode >> 7 & 1) << 2;
+	if ((opcode & 0x1f) != 0) {
+		return (opcode & 0x1f) << 3 | modes;
+	}
+	for (uint8_t i = 0; i < 8; i++) {
+		if (uxn_opcode(i) == opcode) {
+			return i;
+		}
+	}
+	return BRK;
+}
+
+// Writes the address and the Uxntal of the unit at `pc` in a comment
+void write_unit_comment(FILE *file, Translation *t, uint16_t pc, Unit unit) {
+	fprintf(file, "\t/* %04x", pc);
+	for (uint16_t i = 0; i < unit.len; i++) {
+		uint16_t addr = pc + i;
+		uint8_t opcode = t->memory[addr];
+		Instruction inst = opcode_instruction(opcode);
+		fprintf(file, " ");
+		fprintf_uxn_instruction(file, &inst);
+		// the bytes of the literal or of the immediate jump
+		if ((opcode & 0x1f) == 0 && opcode != 0x00) {
+			uint8_t len = opcode == 0x80 || opcode == 0xc0 ? 1 : 2;
+			fprintf(file, " ");
+			for (uint8_t j = 1; j <= len; j++) {
+				fprintf(file, "%02x",
+					t->memory[(uint16_t)(addr + j)]);
+			}
+			i += len;
+		}
+	}
+	fprintf(file, " */\n");
+}
+
+// Writes the C code of the unit at `pc`
+void write_unit(FILE *file, Translation *t, uint16_t pc, Unit unit) {
+	uint8_t *m = t->memory;
+	uint8_t inst = m[pc];
+	bool r = inst & 0x40;
+	Operands o = {
+	    .size = inst & 0x20 ? '2' : '1',
+	    .stack = r ? "rs" : "ws",
+	    .pop = r ? "rp" : "wp",
+	    .push = r ? "rp" : "wp",
+	    .other = r ? "ws" : "rs",
+	    .other_push = r ? "wp" : "rp",
+	    .next = pc + unit.len,
+	};
+	uint16_t value = inst & 0x20 ? peek_short(t, pc + 1)
+				     : m[(uint16_t)(pc + 1)];
+	switch (inst) {
+	case 0x00: // BRK
+		fprintf(file, "goto brk;");
+		return;
+	case 0x20: // JCI
+		fprintf(file, "if (POP1(ws, wp)) ");
+		write_goto(file, unit.target);
+		return;
+	case 0x40: // JMI
+		write_goto(file, unit.target);
+		return;
+	case 0x60: // JSI
+		fprintf(file, "PUSH2(rs, rp, 0x%04x); ", o.next);
+		write_goto(file, unit.target);
+		return;
+	}
+	if ((inst & 0x9f) == 0x80) { // LIT, LIT2, LITr, LIT2r
+		if (!unit.fused) {
+			fprintf(file, "PUSH%c(%s, %s, 0x%x);", o.size, o.stack,
+				o.push, value);
+			return;
+		}
+		uint8_t op = m[(uint16_t)(pc + unit.len - 1)] & 0x1f;
+		if (op == 0x0d) { // JCN
+			fprintf(file, "if (POP1(%s, %s)) ", o.stack, o.pop);
+		} else if (op == 0x0e) { // JSR
+			fprintf(file, "PUSH2(%s, %s, 0x%04x); ", o.other,
+				o.other_push, o.next);
+		}
+		write_goto(file, unit.target);
+		return;
+	}
+	if (inst & 0x80) { // k: the pops move a copy of the pointer
+		fprintf(file, "kp = %s; ", o.pop);
+		o.pop = "kp";
+	}
+	write_instruction(file, inst, o);
+}
+
+bool write_uxn_c(FILE *file, Program *uxn_program) {
+	Translation *t = calloc(1, sizeof(*t));
+	char *rom;
+	size_t rom_len;
+	FILE *rom_file = open_memstream(&rom, &rom_len);
+	bool ok = write_uxn_rom(rom_file, uxn_program);
+	fclose(rom_file);
+	// Nothing is written for a rom that does not fit in the memory
+	if (rom_len > sizeof(t->memory) - 0x100) {
+		free(rom);
+		free(t);
+		return false;
+	}
+	memcpy(t->memory + 0x100, rom, rom_len);
+	analyse(t);
+
+	fprintf(file, "// Generated by write_uxn_c from a Uxn rom\n");
+	fputs(c_prelude, file);
+	fprintf(file, "static const uint8_t rom[] = {");
+	for (size_t i = 0; i < rom_len; i++) {
+		fprintf(file, "%s0x%02x,", i % 12 == 0 ? "\n\t" : " ",
+			(uint8_t)rom[i]);
+	}
+	fprintf(file, "\n\t0};\n\n");
+	free(rom);
+
+	fprintf(file, "int main(void) {\n");
+	fprintf(file, "\tuint16_t pc, a, b, c;\n\tuint8_t kp;\n");
+	fprintf(file, "\t(void)pc, (void)a, (void)b, (void)c, (void)kp;\n");
+	fprintf(file, "\tmemcpy(m + 0x100, rom, sizeof(rom) - 1);\n");
+	// The bytes of the translated code cannot change
+	uint32_t start = 0;
+	uint32_t end = 0; // the bytes from start to end (excluded) are code
+	for (uint32_t pc = 0; pc <= 0x10000; pc++) {
+		if (pc < 0x10000 && !t->reachable[pc]) {
+			continue;
+		}
+		if (pc > end || pc == 0x10000) {
+			if (end > start) {
+				fprintf(file,
+					"\tmemset(is_code + 0x%04x, 1, %u);\n",
+					start, end - start);
+			}
+			start = pc;
+		}
+		if (pc < 0x10000) {
+			Unit unit = decode_unit(t, pc);
+			uint32_t unit_end = pc + unit.len;
+			unit_end = unit_end > 0x10000 ? 0x10000 : unit_end;
+			end = unit_end > end ? unit_end : end;
+		}
+	}
+	fprintf(file, "\n");
+	for (uint32_t pc = 0; pc < 0x10000; pc++) {
+		if (!t->reachable[pc]) {
+			continue;
+		}
+		if (t->label[pc]) {
+			fprintf(file, "L_%04x:\n", pc);
+		}
+		Unit unit = decode_unit(t, pc);
+		write_unit_comment(file, t, pc, unit);
+		fprintf(file, "\t");
+		write_unit(file, t, pc, unit);
+		// The next unit written is not the one executed after it
+		uint16_t next = pc + unit.len;
+		if ((unit.falls || unit.calls) &&
+		    next_written(t, pc) != next) {
+			fprintf(file, " ");
+			write_goto(file, next);
+		}
+		fprintf(file, "\n");
+	}
+	if (t->dynamic) {
+		fprintf(file, "dispatch:\n\tswitch (pc) {\n");
+		for (uint32_t pc = 0; pc < 0x10000; pc++) {
+			if (t->label[pc]) {
+				fprintf(file, "\tcase 0x%04x:\n\t\t", pc);
+				write_goto(file, pc);
+				fprintf(file, "\n");
+			}
+		}
+		fprintf(file,
+			"\t}\n\tfprintf(stderr, \"Error: jump to %%04x outside "
+			"of the translated code\\n\", pc);\n\treturn 1;\n");
+	}
+	fprintf(file, "brk:\n\treturn 0;\n}\n");
+	free(t);
+	return ok && !ferror(file);
+}
@@ -1,20 +1,27 @@
 #include "compiler_to_uxn/compiler.h"
 #include "utils/colors.h"
 #include "utils/files.h"
+#include "vm/vm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// This files compiles a file into a uxntal
+// This files compiles a file into a uxn rom (and its .sym file), and the
+// uxntal code of the rom if a third path is given (its translation in C if
+// the path ends with .c).
 // It dones way less error testing than `test.c`.
 
 int main(int argc, char **argv) {
-	if (argc != 3) {
-		printf("Error: usage %s [..].ha [..].uxntal\n", argv[0]);
+	if (argc != 3 && argc != 4) {
+		printf("Error: usage %s [..].ha [..].rom "
+		       "[[..].uxntal|[..].c]\n",
+		       argv[0]);
 		return -1;
 	}
 
 	char *path_code = argv[1];
-	char *path_uxntal = argv[2];
+	char *path_rom = argv[2];
+	char *path_uxntal = (argc == 4) ? argv[3] : NULL;
 
 	FILE *file;
 
@@ -26,22 +33,35 @@ int main(int argc, char **argv) {
 		reset();
 		return 0;
 	};
-	Tokens *tokens = lexify(stdout, file);
-	if (tokens == NULL) {
-		red();
-		printf("[Error Lexer]\n");
-		reset();
-		return 0;
-	}
-	fclose(file);
 
-	// Parser
-	Ast *ast = parse(stdout, tokens);
-	if (ast == NULL) {
-		red();
-		printf("[Parser Error]\n");
-		reset();
-		return 0;
+	// The Ast saved in the .hast file if the code did not change since
+	char path_cache[200];
+	ast_cache_path(path_cache, sizeof(path_cache), path_code);
+	uint64_t hash = ast_cache_hash_file(file);
+	Ast *ast = ast_cache_load(path_cache, hash);
+	if (ast != NULL) {
+		fclose(file);
+	} else {
+		Lexer *lexer = lexer_new(stdout, file);
+		fclose(file);
+
+		// Parser (it pulls the tokens from the lexer)
+		ast = parse_lexer(stdout, lexer);
+		if (lexer_failed(lexer)) {
+			red();
+			printf("[Error Lexer]\n");
+			reset();
+			lexer_delete(lexer);
+			return 0;
+		}
+		lexer_delete(lexer);
+		if (ast == NULL) {
+			red();
+			printf("[Parser Error]\n");
+			reset();
+			return 0;
+		}
+		ast_cache_write(ast, hash, path_cache);
 	}
 
 	// Compiler
@@ -52,21 +72,52 @@ int main(int argc, char **argv) {
 		reset();
 		return 0;
 	}
-	file = fopen(path_uxntal, "w");
-	fprintf_uxn_program(file, uxn_program);
+	char *rom;
+	size_t rom_len;
+	file = open_memstream(&rom, &rom_len);
+	write_uxn_rom(file, uxn_program);
+	fclose(file);
+	file = fopen(path_rom, "wb");
+	if (file == NULL || fwrite(rom, 1, rom_len, file) != rom_len) {
+		red();
+		printf("[Cannot write '%s']\n", path_rom);
+		reset();
+		return 0;
+	}
 	fclose(file);
+	char path_sym[200];
+	snprintf(path_sym, sizeof(path_sym), "%s.sym", path_rom);
+	file = fopen(path_sym, "wb");
+	if (file != NULL) {
+		write_uxn_sym(file, uxn_program);
+		fclose(file);
+	}
+	if (path_uxntal != NULL) {
+		file = fopen(path_uxntal, "w");
+		size_t len = strlen(path_uxntal);
+		if (len >= 2 && strcmp(path_uxntal + len - 2, ".c") == 0) {
+			write_uxn_c(file, uxn_program);
+		} else {
+			fprintf_uxn_program(file, uxn_program);
+		}
+		fclose(file);
+	}
 
 	green();
 	printf("[Compilation Done]\n");
 	reset();
+	// On stderr : the output of the program is the only thing after it
+	fprintf_peephole_stats(stderr, uxn_program);
 	fflush(stdout);
 
-	char command[200];
-	sprintf(command, "uxnasm %s %s.rom", path_uxntal, path_uxntal);
-	system(command);
-	sprintf(command, "uxncli %s.rom", path_code);
-	system(command);
+	// Execution
+	Uxn *uxn = uxn_new(stdout, stderr);
+	uxn_load_rom(uxn, (uint8_t *)rom, rom_len);
+	free(rom);
+	uxn_run(uxn, UINT64_MAX);
+	uxn_delete(uxn);
 
 	uxn_program_delete(uxn_program);
+	symbols_delete();
 	return 0;
 }
@@ -1,52 +1,65 @@
 #include "lexer.h"
+#include "scan.h"
 #include "../utils/colors.h"
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 typedef struct {
 	FILE *error;	  // where error message should be written
-	FILE *file;	  // file that is being lexed
-	int size_buff;	  // size off buffer contain
-	int pos;	  // position inside the buffer
-	char buff[100];	  // buff that contains the line of `error`
-	uint16_t line;	  // current line in `file`
-	uint16_t column;  // current column in `file`
+	const char *src;  // complete content of the file being lexed
+	size_t len;	  // size of `src`
+	size_t pos;	  // position of the next character inside `src`
+	uint16_t line;	  // current line in `src`
+	uint16_t column;  // current column in `src`
 	bool failed;	  // true if lexinng failed
 	bool empty_token; // true if empty token is parse (mostly white space)
+	bool intern;	  // false if identifiers are interned after lexing
 } LexerState;
 
+LexerState lexer_state(FILE *error, const char *src, size_t len) {
+	LexerState state;
+	state.error = error;
+	state.src = src;
+	state.len = len;
+	state.pos = 0;
+	state.line = 1;
+	state.column = 0;
+	state.failed = false;
+	state.empty_token = false;
+	state.intern = true;
+	return state;
+}
+
 ///// ----- TOKEN ----- /////
 
-/// Returns a `Token` with only one character given
-Token token_one_char(LexerState *state, TokenType token_type, char c) {
+/// Returns a `Token` that starts at the last character read.
+/// Its text is the slice of the source between this character and `state->pos`
+Token token_slice(LexerState *state, TokenType token_type) {
 	Token token;
 	token.line = state->line;
 	token.column = state->column;
 	token.type = token_type;
-	token.text = (char *)malloc(2 * sizeof(char));
-	token.text[0] = c;
-	token.text[1] = 0;
+	token.text = state->src + state->pos - 1;
+	token.len = 1;
 	return token;
 }
 
+/// Returns a `Token` without text at the last character read
 Token token_only_type(LexerState *state, TokenType token_type) {
 	Token token;
 	token.line = state->line;
 	token.column = state->column;
 	token.type = token_type;
-	token.text = NULL;
-	return token;
-}
-
-Token token_append(Token token, char c) {
-	uint8_t token_len = strlen(token.text);
-	token.text = realloc(token.text, (token_len + 2) * sizeof(char));
-	token.text[token_len] = c;
-	token.text[token_len + 1] = 0;
+	token.text = state->src + state->pos - 1;
+	token.len = 0;
 	return token;
 }
 
@@ -151,26 +164,29 @@ void fprintf_token_type(FILE *file, TokenType *token_type) {
 	case GREATER_THAN_EQUAL:
 		fprintf(file, ">=");
 		break;
+	case END_OF_FILE:
+		fprintf(file, "end of file");
+		break;
 	}
 }
 
 void fprintf_token(FILE *file, Token *token) {
 	switch (token->type) {
 	case IDENTIFIER:
-		fprintf(file, "%s", token->text);
+		fprintf(file, "%.*s", (int)token->len, token->text);
 		break;
 	case NUMBER:
-		fprintf(file, "%s", token->text);
+		fprintf(file, "%.*s", (int)token->len, token->text);
 		break;
 	case CHAR_LITERAL:
-		if (token->text[0] == '\n') {
+		if (token->number.value == '\n') {
 			fprintf(file, "'\\n'");
 		} else {
-			fprintf(file, "'%s'", token->text);
+			fprintf(file, "'%.*s'", (int)token->len, token->text);
 		}
 		break;
 	case STRING_LITERAL:
-		fprintf(file, "\"%s\"", token->text);
+		fprintf(file, "\"%.*s\"", (int)token->len, token->text);
 		break;
 	default:
 		fprintf_token_type(file, &token->type);
@@ -182,61 +198,178 @@ void fprintf_token(FILE *file, Token *token) {
 	// fprintf_token_type(file, &token->type);
 }
 
+///// ----- SOURCE ----- /////
+
+// Memory-maps the whole `file` as `source`.
+// Streams that cannot be mapped (pipes, terminals, ...) are read instead.
+void source_load(Source *source, FILE *file) {
+	source->text = NULL;
+	source->len = 0;
+	source->mapped = false;
+
+	struct stat file_stat;
+	int fd = fileno(file);
+	if (fd >= 0 && fstat(fd, &file_stat) == 0 &&
+	    S_ISREG(file_stat.st_mode) && file_stat.st_size > 0) {
+		void *map = mmap(NULL, file_stat.st_size, PROT_READ,
+				 MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			source->text = map;
+			source->len = file_stat.st_size;
+			source->mapped = true;
+			return;
+		}
+	}
+
+	size_t cap = 0;
+	while (true) {
+		if (source->len == cap) {
+			cap = (cap == 0) ? 4096 : cap * 2;
+			source->text = realloc(source->text, cap);
+		}
+		size_t read = fread(source->text + source->len, 1,
+				    cap - source->len, file);
+		if (read == 0) {
+			break;
+		}
+		source->len += read;
+	}
+}
+
+void source_release(Source *source) {
+	if (source->mapped) {
+		munmap(source->text, source->len);
+	} else {
+		free(source->text);
+	}
+	source->text = NULL;
+	source->len = 0;
+	source->mapped = false;
+}
+
 ///// ----- TOKENS ----- /////
 
 Tokens *tokens_empty(void) {
 	Tokens *result = malloc(sizeof(*result));
 	result->cap = 0;
 	result->len = 0;
-	result->tokens = NULL;
+	result->types = NULL;
+	result->offsets = NULL;
+	result->lens = NULL;
+	result->payloads = NULL;
+	result->lines = NULL;
+	result->columns = NULL;
+	result->source.text = NULL;
+	result->source.len = 0;
+	result->source.mapped = false;
 	return result;
 }
 
+// Symbol of an identifier, value base and suffix of a number in 32 bits
+uint32_t token_payload(Token *token) {
+	switch (token->type) {
+	case IDENTIFIER:
+		return token->symbol;
+	case NUMBER:
+	case CHAR_LITERAL:
+		return token->number.value | token->number.base << 16 |
+		       (uint32_t)token->number.suffix << 24;
+	default:
+		return 0;
+	}
+}
+
+// Give the six arrays of `tokens` room for `cap` tokens
+void tokens_reserve(Tokens *tokens, uint32_t cap) {
+	if (cap <= tokens->cap) {
+		return;
+	}
+	tokens->cap = cap;
+	tokens->types = realloc(tokens->types, cap * sizeof(uint8_t));
+	tokens->offsets = realloc(tokens->offsets, cap * sizeof(uint32_t));
+	tokens->lens = realloc(tokens->lens, cap * sizeof(uint32_t));
+	tokens->payloads = realloc(tokens->payloads, cap * sizeof(uint32_t));
+	tokens->lines = realloc(tokens->lines, cap * sizeof(uint16_t));
+	tokens->columns = realloc(tokens->columns, cap * sizeof(uint16_t));
+}
+
 // Add one token to the struct tokens
 void tokens_append(Tokens *tokens, Token token) {
 	tokens->len++;
-	if (tokens->len >= tokens->cap) {
-		tokens->cap = (tokens->cap == 0) ? 1 : tokens->cap * 2;
-		tokens->tokens = realloc(tokens->tokens,
-					 tokens->cap * sizeof(*tokens->tokens));
+	if (tokens->len > tokens->cap) {
+		uint32_t cap = (tokens->cap == 0) ? 64 : tokens->cap * 2;
+		tokens_reserve(tokens, cap);
 	}
-	tokens->tokens[tokens->len - 1] = token;
+	uint32_t i = tokens->len - 1;
+	tokens->types[i] = token.type;
+	tokens->offsets[i] = token.text - tokens->source.text;
+	tokens->lens[i] = token.len;
+	tokens->payloads[i] = token_payload(&token);
+	tokens->lines[i] = token.line;
+	tokens->columns[i] = token.column;
 }
 
-void tokens_delete(Tokens *tokens) {
-	for (uint32_t i = 0; i < tokens->len; i++) {
-		if (tokens->tokens[i].text != NULL) {
-			free(tokens->tokens[i].text);
-		}
+TokenType tokens_type(Tokens *tokens, uint32_t index) {
+	if (index >= tokens->len) {
+		return END_OF_FILE;
 	}
-	free(tokens->tokens);
+	return tokens->types[index];
+}
+
+Token tokens_get(Tokens *tokens, uint32_t index) {
+	Token token;
+	token.type = tokens_type(tokens, index);
+	if (token.type == END_OF_FILE) {
+		token.text = NULL;
+		token.len = 0;
+		token.line = (index == 0) ? 1 : tokens->lines[index - 1];
+		token.column = (index == 0) ? 0 : tokens->columns[index - 1];
+		return token;
+	}
+	token.text = tokens->source.text + tokens->offsets[index];
+	token.len = tokens->lens[index];
+	token.line = tokens->lines[index];
+	token.column = tokens->columns[index];
+	uint32_t payload = tokens->payloads[index];
+	if (token.type == IDENTIFIER) {
+		token.symbol = payload;
+	} else {
+		token.number.value = payload & 0xffff;
+		token.number.base = (payload >> 16) & 0xff;
+		token.number.suffix = payload >> 24;
+	}
+	return token;
+}
+
+void tokens_delete(Tokens *tokens) {
+	source_release(&tokens->source);
+	free(tokens->types);
+	free(tokens->offsets);
+	free(tokens->lens);
+	free(tokens->payloads);
+	free(tokens->lines);
+	free(tokens->columns);
 	free(tokens);
 }
 
 void fprintf_tokens(FILE *file, Tokens *tokens) {
 	for (uint32_t i = 0; i < tokens->len; i++) {
-		Token *token = &tokens->tokens[i];
-		fprintf_token(file, token);
+		Token token = tokens_get(tokens, i);
+		fprintf_token(file, &token);
 		fprintf(file, "\n");
 	}
 }
 
 ///// ---- LEXING NEXT FUNCTIONS ----- /////
 
-// return the next character of the state file
-// return '\0' if it is the end of the file
+// return the next character of the source
+// return '\0' if it is the end of the source
 char next_char(LexerState *state) {
-	char c;
-	if (state->buff[state->pos] == '\0') {
-		if (fgets(state->buff, state->size_buff, state->file) == NULL) {
-			return '\0';
-		} else {
-			state->pos = 1;
-		}
-	} else {
-		state->pos += 1;
+	if (state->pos >= state->len) {
+		return '\0';
 	}
-	c = state->buff[state->pos - 1];
+	char c = state->src[state->pos];
+	state->pos += 1;
 	if (c == '\n') {
 		state->line += 1;
 		state->column = 0;
@@ -246,29 +379,49 @@ char next_char(LexerState *state) {
 	return c;
 }
 
+// Move the state forward to `end`, the lines and columns of the characters
+// skipped are counted
+void skip_to(LexerState *state, size_t end) {
+	uint32_t newlines = scan_count_newlines(state->src, state->pos, end);
+	if (newlines == 0) {
+		state->column += end - state->pos;
+	} else {
+		size_t last = end - 1;
+		while (state->src[last] != '\n') {
+			last--;
+		}
+		state->line += newlines;
+		state->column = end - last - 1;
+	}
+	state->pos = end;
+}
+
 Token next_char_literal(LexerState *state, char *c) {
 	Token token;
 	*c = next_char(state);
-	if (*c == '\'') {
+	if (*c == '\'' || *c == '\0') {
 		state->failed = true;
 		token.type = CHAR_LITERAL;
 		return token;
 	}
+	token = token_slice(state, CHAR_LITERAL);
+	token.number.value = (uint8_t)*c;
 	if (*c == '\\') {
 		*c = next_char(state);
 		if (*c == 'n') {
-			token = token_one_char(state, CHAR_LITERAL, '\n');
+			token.len++;
+			token.number.value = '\n';
 		} else {
 			state->failed = true;
-			token.type = CHAR_LITERAL;
 			return token;
 		}
-	} else {
-		token = token_one_char(state, CHAR_LITERAL, *c);
 	}
 	*c = next_char(state);
 	if (*c != '\'') {
-		printf("TODO make this a recoverable error\n");
+		fprintf(state->error,
+			"At line %d: missing ' at the end of a char literal\n",
+			state->line);
+		state->failed = true;
 	}
 	return token;
 }
@@ -276,9 +429,9 @@ Token next_char_literal(LexerState *state, char *c) {
 Token next_string_literal(LexerState *state, char *c) {
 	*c = next_char(state);
 	if (*c == '\"') {
-		printf("don't accept empty string_literal");
+		fprintf(state->error, "don't accept empty string_literal");
 	}
-	Token token = token_one_char(state, STRING_LITERAL, *c);
+	Token token = token_slice(state, STRING_LITERAL);
 	while (true) {
 		*c = next_char(state);
 		if (*c == '\0') {
@@ -288,7 +441,7 @@ Token next_string_literal(LexerState *state, char *c) {
 			return token;
 		}
 		if (*c != '\"') {
-			token = token_append(token, *c);
+			token.len++;
 			continue;
 		}
 		*c = next_char(state);
@@ -297,79 +450,198 @@ Token next_string_literal(LexerState *state, char *c) {
 	return token;
 }
 
-// Apply next_char until arriving on the end of the line
+// Move forward until arriving on the end of the line
 void next_comment(LexerState *state, char *c) {
-	if (*c == '\n') {
-		return;
-	}
-	while (true) {
+	if (*c != '\n' && *c != '\0') {
+		// there is no new line to count before the end of the line
+		size_t end = scan_line_end(state->src, state->pos, state->len);
+		state->column += end - state->pos;
+		state->pos = end;
 		*c = next_char(state);
-		if (*c != '\n') {
-			continue;
-		}
-		return;
 	}
 }
 
+// return the character after the current one without moving forward
+// return '\0' if it is the end of the source
+char peek_char(LexerState *state) {
+	if (state->pos >= state->len) {
+		return '\0';
+	}
+	return state->src[state->pos];
+}
+
+// Returns the value of the digit `c` or 36 if `c` is not a digit
+int digit_value(char c) {
+	if (isdigit(c)) {
+		return c - '0';
+	}
+	if (isalpha(c)) {
+		return tolower(c) - 'a' + 10;
+	}
+	return 36;
+}
+
+// Number literals : 42 - 0x2a - 0o52 - 0b101010 - 42u8 - 0x2au16 - ...
+// The value is decoded in the token, the text is only kept for printing
 Token next_number(LexerState *state, char *c) {
-	Token token = token_one_char(state, NUMBER, *c);
-	while (true) {
+	Token token = token_slice(state, NUMBER);
+	token.len = 0;
+	token.number.base = 10;
+	token.number.suffix = VOID;
+	if (*c == '0') {
+		char prefix = peek_char(state);
+		if (prefix == 'x') {
+			token.number.base = 16;
+		} else if (prefix == 'o') {
+			token.number.base = 8;
+		} else if (prefix == 'b') {
+			token.number.base = 2;
+		}
+		if (token.number.base != 10) {
+			next_char(state);
+			*c = next_char(state);
+			token.len = 2;
+		}
+	}
+
+	// The digits and the suffix are read at once, `*c` is the first of them
+	const char *digits = token.text + token.len;
+	size_t start = digits - state->src;
+	uint32_t run = scan_ident(state->src, start, state->len) - start;
+	if (run > 0) {
+		state->column += run - 1;
+		state->pos += run - 1;
 		*c = next_char(state);
-		if (isdigit(*c)) {
-			token = token_append(token, *c);
-			continue;
+	}
+
+	uint32_t value = 0;
+	uint32_t nb_digits = 0;
+	while (nb_digits < run &&
+	       digit_value(digits[nb_digits]) < token.number.base) {
+		value = value * token.number.base +
+			digit_value(digits[nb_digits]);
+		if (value > 0xffff) {
+			fprintf(state->error,
+				"At line %d: number does not fit in 16 bits\n",
+				state->line);
+			state->failed = true;
+			return token;
 		}
+		nb_digits++;
+	}
+	token.len += nb_digits;
+
+	// Optional suffix giving the size of the number
+	const char *suffix = digits + nb_digits;
+	uint32_t suffix_len = run - nb_digits;
+	if (suffix_len == 2 && memcmp(suffix, "u8", 2) == 0) {
+		token.number.suffix = U8;
+	} else if (suffix_len == 3 && memcmp(suffix, "u16", 3) == 0) {
+		token.number.suffix = U16;
+	}
+	if (nb_digits == 0 ||
+	    (suffix_len != 0 && token.number.suffix == VOID) ||
+	    (token.number.suffix == U8 && value > 0xff)) {
+		fprintf(state->error, "At line %d: invalid number '%.*s'\n",
+			state->line, (int)(token.len + suffix_len),
+			token.text);
+		state->failed = true;
 		return token;
 	}
+	token.len += suffix_len;
+	token.number.value = value;
 	return token;
 }
 
+// Returns `type` if `text` starts with `keyword` else IDENTIFIER
+TokenType keyword_match(const char *text, const char *keyword,
+			TokenType type) {
+	return (memcmp(text, keyword, strlen(keyword)) == 0) ? type
+							     : IDENTIFIER;
+}
+
+// Returns the type of the keyword of the `len` first characters of `text`
+// Returns IDENTIFIER if it is not a keyword.
+// The length and the first character select at most one keyword to compare
+// with, so adding keywords does not slow down the lexing of identifiers.
+TokenType keyword_type(const char *text, uint32_t len) {
+	switch (len) {
+	case 2:
+		switch (text[0]) {
+		case 'f':
+			return keyword_match(text, "fn", FN);
+		case 'i':
+			return keyword_match(text, "if", IF);
+		case 'u':
+			return keyword_match(text, "u8", U8);
+		}
+		break;
+	case 3:
+		switch (text[0]) {
+		case 'f':
+			return keyword_match(text, "for", FOR);
+		case 'l':
+			return keyword_match(text, "let", LET);
+		case 'u':
+			return keyword_match(text, "u16", U16);
+		}
+		break;
+	case 4:
+		switch (text[0]) {
+		case 'e':
+			return keyword_match(text, "else", ELSE);
+		case 'v':
+			return keyword_match(text, "void", VOID);
+		}
+		break;
+	case 6:
+		switch (text[0]) {
+		case 'r':
+			return keyword_match(text, "return", RETURN);
+		}
+		break;
+	}
+	return IDENTIFIER;
+}
+
 Token next_ident(LexerState *state, char *c) {
-	Token token = token_one_char(state, IDENTIFIER, *c);
+	Token token = token_slice(state, IDENTIFIER);
+	size_t end = scan_ident(state->src, state->pos, state->len);
+	token.len += end - state->pos;
+	state->column += end - state->pos;
+	state->pos = end;
+	*c = next_char(state);
+
+	// Keywords are recognized before the identifier is interned
+	token.type = keyword_type(token.text, token.len);
+	token.symbol = NO_SYMBOL;
+	if (token.type == IDENTIFIER && state->intern) {
+		token.symbol = symbol_intern(token.text, token.len);
+	}
+	return token;
+}
+
+// Skip the white spaces and comments before the next token at once
+void next_blank(LexerState *state, char *c) {
 	while (true) {
-		*c = next_char(state);
-		if (isalpha(*c) || isdigit(*c) || *c == '_') {
-			token = token_append(token, *c);
-			continue;
-		}
-		if (strcmp("fn", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, FN);
-		} else if (strcmp("let", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, LET);
-		} else if (strcmp("return", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, RETURN);
-		} else if (strcmp("void", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, VOID);
-		} else if (strcmp("if", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, IF);
-		} else if (strcmp("else", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, ELSE);
-		} else if (strcmp("for", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, FOR);
-		} else if (strcmp("u8", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, U8);
-		} else if (strcmp("u16", token.text) == 0) {
-			free(token.text);
-			return token_only_type(state, U16);
+		if (isspace(*c)) {
+			skip_to(state, scan_whitespace(state->src, state->pos,
+						       state->len));
+			*c = next_char(state);
+		} else if (*c == '/' && peek_char(state) == '/') {
+			*c = next_char(state);
+			next_comment(state, c);
+		} else {
+			return;
 		}
-		return token;
 	}
 }
 
 // This function returns the next token of the state and advance in the state
 Token next_token(LexerState *state, char *c) {
-	Token token;
-	token.type = VOID;
-	if (isspace(*c)) {
-		*c = next_char(state);
+	next_blank(state, c);
+	Token token = token_only_type(state, VOID);
+	if (*c == '\0') {
 		state->empty_token = true;
 		return token;
 	}
@@ -379,15 +651,9 @@ Token next_token(LexerState *state, char *c) {
 		return next_ident(state, c);
 	}
 	switch (*c) {
-	case '/': {
+	case '/':
 		*c = next_char(state);
-		if (*c == '/') {
-			next_comment(state, c);
-			state->empty_token = true;
-			return token;
-		}
 		return token_only_type(state, DIVIDE);
-	}
 	case ':':
 		token = token_only_type(state, COLON);
 		break;
@@ -468,24 +734,116 @@ Token next_token(LexerState *state, char *c) {
 	return token;
 }
 
-// Input : file name to lexify
-// Ouput : Result (list tokens) : this can be an error
-Tokens *lexify(FILE *error, FILE *file) {
-	Tokens *tokens = tokens_empty();
+///// ----- LEXER ----- /////
 
+struct Lexer {
 	LexerState state;
-	state.error = error;
-	state.line = 1;
-	state.column = 0;
-	state.pos = 0;
-	state.file = file;
-	state.size_buff = 100;
-	state.buff[0] = '\0';
-	state.failed = false;
-	state.empty_token = false;
+	Source source;
+	char c;			// current character of the lexer
+	Token ring[LEXER_RING]; // last tokens lexed
+	uint32_t lexed;		// number of tokens lexed
+	uint32_t pos;		// position of the current token
+};
+
+// The lexer takes the ownership of `source`
+Lexer *lexer_from_source(FILE *error, Source source) {
+	Lexer *lexer = malloc(sizeof(*lexer));
+	lexer->source = source;
+	lexer->state = lexer_state(error, source.text, source.len);
+	lexer->c = next_char(&lexer->state);
+	lexer->lexed = 0;
+	lexer->pos = 0;
+	return lexer;
+}
+
+Lexer *lexer_new(FILE *error, FILE *file) {
+	Source source;
+	source_load(&source, file);
+	return lexer_from_source(error, source);
+}
+
+// Lex the next token of the file in the ring of the lexer
+void lexer_lex(Lexer *lexer) {
+	Token token;
+	while (true) {
+		if (lexer->c == '\0' || lexer->state.failed) {
+			// same position as the end of `tokens_get`
+			token.type = END_OF_FILE;
+			token.text = NULL;
+			token.len = 0;
+			token.line = 1;
+			token.column = 0;
+			if (lexer->lexed > 0) {
+				uint32_t last = (lexer->lexed - 1) % LEXER_RING;
+				token.line = lexer->ring[last].line;
+				token.column = lexer->ring[last].column;
+			}
+			break;
+		}
+		token = next_token(&lexer->state, &lexer->c);
+		if (lexer->state.failed) {
+			continue;
+		}
+		if (lexer->state.empty_token) {
+			lexer->state.empty_token = false;
+			continue;
+		}
+		break;
+	}
+	lexer->ring[lexer->lexed % LEXER_RING] = token;
+	lexer->lexed++;
+}
+
+Token lexer_peek(Lexer *lexer) {
+	if (lexer->pos == lexer->lexed) {
+		Token *last = &lexer->ring[(lexer->lexed - 1) % LEXER_RING];
+		if (lexer->lexed > 0 && last->type == END_OF_FILE) {
+			return *last;
+		}
+		lexer_lex(lexer);
+	}
+	return lexer->ring[lexer->pos % LEXER_RING];
+}
+
+Token lexer_next(Lexer *lexer) {
+	Token token = lexer_peek(lexer);
+	if (token.type != END_OF_FILE) {
+		lexer->pos++;
+	}
+	return token;
+}
+
+uint32_t lexer_mark(Lexer *lexer) { return lexer->pos; }
 
+void lexer_rewind(Lexer *lexer, uint32_t mark) {
+	// The parser never goes back further than the ring : this is a bug
+	if (mark > lexer->lexed || lexer->lexed - mark > LEXER_RING) {
+		fprintf(stderr, "lexer_rewind: %u outside of the ring\n", mark);
+		abort();
+	}
+	lexer->pos = mark;
+}
+
+bool lexer_failed(Lexer *lexer) { return lexer->state.failed; }
+
+void lexer_delete(Lexer *lexer) {
+	source_release(&lexer->source);
+	free(lexer);
+}
+
+// Lex all the tokens of `source` one after the other, straight in the
+// arrays of the tokens (the ring of `Lexer` is only for `parse_lexer`)
+Tokens *lexify_sequential(FILE *error, Source source) {
+	Tokens *tokens = tokens_empty();
+	// every token has at least one character
+	tokens_reserve(tokens, source.len);
+	// The tokens takes the source
+	tokens->source = source;
+
+	LexerState state = lexer_state(error, source.text, source.len);
 	char c = next_char(&state);
 	while (true) {
+		next_blank(&state, &c);
 		if (c == '\0') {
 			break;
 		}
@@ -494,12 +852,187 @@ Tokens *lexify(FILE *error, FILE *file) {
 			tokens_delete(tokens);
 			return NULL;
 		}
+		tokens_append(tokens, token);
+	}
+	return tokens;
+}
+
+///// ----- PARALLEL LEXING ----- /////
 
-		if (state.empty_token) {
-			state.empty_token = false;
+// A chunk of the source lexed by its own thread.
+// Chunks begin at the beginning of a line, but a line can begin inside of a
+// string literal : the tokens of a chunk are kept only if its first token is
+// where the previous chunk stopped, else the chunk is lexed again after the
+// previous one.
+typedef struct {
+	LexerState state;
+	char c;		   // current character of the chunk
+	size_t end;	   // tokens of the chunk start before `end`
+	size_t first;	   // position of the first token of the chunk
+	size_t stop;	   // position of the first token after the chunk
+	bool ended;	   // true if the source ended in the chunk
+	Tokens *tokens;	   // identifiers are not interned yet
+	FILE *errors;	   // errors of the chunk, written only if it is kept
+	char *errors_text; // content of `errors`
+	size_t errors_len;
+} LexChunk;
+
+// Lex the tokens of the chunk that start before `chunk->end`
+void lex_chunk(LexChunk *chunk) {
+	LexerState *state = &chunk->state;
+	chunk->first = SIZE_MAX;
+	chunk->ended = false;
+	while (true) {
+		next_blank(state, &chunk->c);
+		size_t start = state->pos - 1;
+		if (chunk->c == '\0') {
+			chunk->ended = true;
+			start = state->pos;
+		}
+		if (chunk->first == SIZE_MAX) {
+			chunk->first = start;
+		}
+		if (chunk->ended || start >= chunk->end) {
+			chunk->stop = start;
+			return;
+		}
+		Token token = next_token(state, &chunk->c);
+		if (state->failed) {
+			return;
+		}
+		tokens_append(chunk->tokens, token);
+	}
+}
+
+void *lex_chunk_thread(void *chunk) {
+	lex_chunk(chunk);
+	return NULL;
+}
+
+// Lex `chunk` again from where `previous` stopped
+void lex_chunk_again(FILE *error, LexChunk *chunk, LexChunk *previous) {
+	chunk->tokens->len = 0;
+	chunk->state = previous->state;
+	chunk->state.error = error;
+	chunk->c = previous->c;
+	free(chunk->errors_text);
+	chunk->errors_text = NULL;
+	chunk->errors_len = 0;
+	lex_chunk(chunk);
+}
+
+// Lex `source` cut in `nb_chunks` chunks lexed in parallel.
+// The tokens are the same as the ones of `lexify_sequential`.
+Tokens *lexify_parallel(FILE *error, Source source, uint32_t nb_chunks) {
+	LexChunk *chunks = malloc(nb_chunks * sizeof(*chunks));
+	pthread_t *threads = malloc(nb_chunks * sizeof(*threads));
+	size_t start = 0;
+	uint16_t line = 1;
+	for (uint32_t i = 0; i < nb_chunks; i++) {
+		LexChunk *chunk = &chunks[i];
+		// the chunk ends after the end of a line
+		size_t end = source.len;
+		if (i + 1 < nb_chunks) {
+			size_t middle = source.len / nb_chunks * (i + 1);
+			middle = (middle > start) ? middle : start;
+			const char *newline = memchr(source.text + middle, '\n',
+						     source.len - middle);
+			if (newline != NULL) {
+				end = newline - source.text + 1;
+			}
+		}
+
+		chunk->errors = open_memstream(&chunk->errors_text,
+					       &chunk->errors_len);
+		chunk->state =
+		    lexer_state(chunk->errors, source.text, source.len);
+		chunk->state.pos = start;
+		chunk->state.line = line;
+		chunk->state.intern = false;
+		chunk->end = end;
+		chunk->tokens = tokens_empty();
+		chunk->tokens->source.text = source.text;
+		// every token has at least one character
+		tokens_reserve(chunk->tokens, end - start);
+		chunk->c = next_char(&chunk->state);
+		pthread_create(&threads[i], NULL, lex_chunk_thread, chunk);
+
+		line += scan_count_newlines(source.text, start, end);
+		start = end;
+	}
+
+	Tokens *tokens = tokens_empty();
+	tokens->source = source;
+	tokens_reserve(tokens, source.len);
+	bool failed = false;
+	bool ended = false;
+	for (uint32_t i = 0; i < nb_chunks; i++) {
+		LexChunk *chunk = &chunks[i];
+		pthread_join(threads[i], NULL);
+		fclose(chunk->errors);
+		if (failed || ended) {
 			continue;
 		}
-		tokens_append(tokens, token);
+		if (i > 0 && chunk->first != chunks[i - 1].stop) {
+			lex_chunk_again(error, chunk, &chunks[i - 1]);
+		}
+		if (chunk->errors_len > 0) {
+			fwrite(chunk->errors_text, 1, chunk->errors_len, error);
+		}
+		if (chunk->state.failed) {
+			failed = true;
+			continue;
+		}
+		ended = chunk->ended;
+
+		// The identifiers are interned in the order of the source
+		for (uint32_t j = 0; j < chunk->tokens->len; j++) {
+			Token token = tokens_get(chunk->tokens, j);
+			if (token.type == IDENTIFIER) {
+				token.symbol =
+				    symbol_intern(token.text, token.len);
+			}
+			tokens_append(tokens, token);
+		}
+	}
+
+	for (uint32_t i = 0; i < nb_chunks; i++) {
+		free(chunks[i].errors_text);
+		// the source belongs to `tokens`
+		chunks[i].tokens->source.text = NULL;
+		tokens_delete(chunks[i].tokens);
+	}
+	free(chunks);
+	free(threads);
+	if (failed) {
+		tokens_delete(tokens);
+		return NULL;
 	}
 	return tokens;
 }
+
+Tokens *lexify_chunks(FILE *error, FILE *file, uint32_t nb_chunks) {
+	Source source;
+	source_load(&source, file);
+	if (nb_chunks <= 1) {
+		return lexify_sequential(error, source);
+	}
+	return lexify_parallel(error, source, nb_chunks);
+}
+
+// Input : file to lexify
+// Ouput : Result (list tokens) : this can be an error
+Tokens *lexify(FILE *error, FILE *file) {
+	Source source;
+	source_load(&source, file);
+	// one chunk by core, and chunks of at least LEXER_CHUNK_MIN bytes
+	long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nb_chunks = source.len / LEXER_CHUNK_MIN;
+	if (nb_cores > 0 && nb_chunks > (size_t)nb_cores) {
+		nb_chunks = nb_cores;
+	}
+	if (nb_chunks <= 1) {
+		return lexify_sequential(error, source);
+	}
+	return lexify_parallel(error, source, nb_chunks);
+}
@@ -1,10 +1,11 @@
+#include "symbols.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 
 typedef enum {
 	IDENTIFIER, // a2 - ab_cd - x - ...
-	NUMBER,	    // 234 - 1 - 0172 - ...
+	NUMBER,	    // 234 - 1 - 0x2a - 0o52 - 0b101 - 12u8 - ...
 	CHAR_LITERAL,
 	STRING_LITERAL,
 
@@ -41,29 +42,104 @@ typedef enum {
 	LESS_THAN_EQUAL,    // <=
 	GREATER_THAN,	    // >
 	GREATER_THAN_EQUAL, // >=
+
+	END_OF_FILE, // after the last token (never stored in `Tokens`)
 } TokenType;
 
 typedef struct {
-	char *text;
+	const char *text; // slice of the source (not NUL terminated)
+	uint32_t len;	  // number of characters of `text`
+	union {
+		Symbol symbol; // interned `text` of an IDENTIFIER
+		struct {
+			uint16_t value;	  // decoded NUMBER or CHAR_LITERAL
+			uint8_t base;	  // 2, 8, 10 or 16 for a NUMBER
+			TokenType suffix; // U8, U16 or VOID if there is none
+		} number;
+	};
 	uint16_t line;
 	uint16_t column;
 	TokenType type;
 } Token;
 
+// Content of a lexed file, the `text` of tokens points inside of it
+typedef struct {
+	char *text;
+	size_t len;
+	bool mapped; // true if `text` is memory-mapped
+} Source;
+
+// Loads the whole content of `file` (memory-mapped, or read if it is a pipe)
+void source_load(Source *source, FILE *file);
+
+// Unmaps or frees the content of `source`
+void source_release(Source *source);
+
+// Tokens are stored as a struct of arrays: the parser mostly looks at the type
+// of the tokens, that are contiguous bytes.
 typedef struct {
-	Token *tokens;
+	uint8_t *types;	    // TokenType of every token
+	uint32_t *offsets;  // position of the `text` of every token in `source`
+	uint32_t *lens;	    // length of the `text` of every token
+	uint32_t *payloads; // symbol or number of every token (see `Token`)
+	uint16_t *lines;
+	uint16_t *columns;
 	uint32_t cap;
 	uint32_t len;
+
+	Source source;
 } Tokens;
 
-// Input : file name
-// Ouput : list of tokens of the file name
+// Returns the type of the token `index` (END_OF_FILE after the last one)
+TokenType tokens_type(Tokens *tokens, uint32_t index);
+
+// Returns a copy of the token `index`
+Token tokens_get(Tokens *tokens, uint32_t index);
+
+// A `Lexer` gives the tokens of a file one by one, while the file is lexed.
+// Only the last LEXER_RING tokens are kept in memory.
+#define LEXER_RING 16
+typedef struct Lexer Lexer;
+
+// Input : file to lex (memory-mapped, or read if it is a pipe)
+// Output : lexer positioned on the first token of the file
+Lexer *lexer_new(FILE *error, FILE *file);
+
+// Returns the current token of the lexer, without moving forward
+// Returns an END_OF_FILE token at the end of the file or if lexing failed
+Token lexer_peek(Lexer *lexer);
+
+// Returns the current token of the lexer and moves forward
+Token lexer_next(Lexer *lexer);
+
+// Position of the current token, to come back to it with `lexer_rewind`
+uint32_t lexer_mark(Lexer *lexer);
+
+// Come back to a position given by `lexer_mark`
+// The position should be one of the LEXER_RING last tokens
+void lexer_rewind(Lexer *lexer, uint32_t mark);
+
+// true if the lexer stopped because of an error (written in `error`)
+bool lexer_failed(Lexer *lexer);
+
+// Free the lexer and release its source
+void lexer_delete(Lexer *lexer);
+
+// Sources bigger than 2 chunks are lexed by several threads in parallel
+#define LEXER_CHUNK_MIN (1 << 20)
+
+// Input : file to lex
+// Ouput : list of tokens of the file
 // Note : This functions deletes all the comments
+// Note : The file is memory-mapped (or read if it is a pipe), tokens do not
+// own any text, they are slices of `Tokens.source`
 Tokens *lexify(FILE *error, FILE *file);
 
-// Free the struct tokens but not any string allocated on the heap
-// void tokens_free(Tokens *tokens);
-void tokens_free_numbers(Tokens *tokens);
+// Same as `lexify` but the file is cut in `nb_chunks` chunks lexed in parallel
+// (whatever the size of the file)
+Tokens *lexify_chunks(FILE *error, FILE *file, uint32_t nb_chunks);
+
+// Free the struct tokens and release its source
 void tokens_delete(Tokens *tokens);
 
 void fprintf_token_type(FILE *file, TokenType *token_type);
@@ -0,0 +1,122 @@
+#include "scan.h"
+#include <ctype.h>
+
+///// ----- CHUNKS ----- /////
+
+// A chunk is the biggest vector of bytes available, the scalar loops at the end
+// of every function handle what is left (or everything without SIMD).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+#define SCAN_FULL 0xffffffffu
+typedef __m256i Chunk;
+
+Chunk chunk_load(const char *src) { return _mm256_loadu_si256((void *)src); }
+Chunk chunk_set(char c) { return _mm256_set1_epi8(c); }
+Chunk chunk_eq(Chunk a, Chunk b) { return _mm256_cmpeq_epi8(a, b); }
+Chunk chunk_or(Chunk a, Chunk b) { return _mm256_or_si256(a, b); }
+Chunk chunk_sub(Chunk a, Chunk b) { return _mm256_sub_epi8(a, b); }
+Chunk chunk_min(Chunk a, Chunk b) { return _mm256_min_epu8(a, b); }
+uint32_t chunk_mask(Chunk a) { return (uint32_t)_mm256_movemask_epi8(a); }
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+#define SCAN_FULL 0xffffu
+typedef __m128i Chunk;
+
+Chunk chunk_load(const char *src) { return _mm_loadu_si128((void *)src); }
+Chunk chunk_set(char c) { return _mm_set1_epi8(c); }
+Chunk chunk_eq(Chunk a, Chunk b) { return _mm_cmpeq_epi8(a, b); }
+Chunk chunk_or(Chunk a, Chunk b) { return _mm_or_si128(a, b); }
+Chunk chunk_sub(Chunk a, Chunk b) { return _mm_sub_epi8(a, b); }
+Chunk chunk_min(Chunk a, Chunk b) { return _mm_min_epu8(a, b); }
+uint32_t chunk_mask(Chunk a) { return (uint32_t)_mm_movemask_epi8(a); }
+#endif
+
+#ifdef SCAN_WIDTH
+// Bytes of `c` that are in [low, low + range] (unsigned comparison)
+Chunk chunk_in_range(Chunk c, char low, char range) {
+	Chunk shifted = chunk_sub(c, chunk_set(low));
+	return chunk_eq(chunk_min(shifted, chunk_set(range)), shifted);
+}
+#endif
+
+///// ----- SCAN FUNCTIONS ----- /////
+
+size_t scan_whitespace(const char *src, size_t pos, size_t len) {
+#ifdef SCAN_WIDTH
+	Chunk space = chunk_set(' ');
+	for (; pos + SCAN_WIDTH <= len; pos += SCAN_WIDTH) {
+		Chunk c = chunk_load(src + pos);
+		// '\t', '\n', '\v', '\f' and '\r' follow each other
+		Chunk white = chunk_or(chunk_eq(c, space),
+				       chunk_in_range(c, '\t', 4));
+		uint32_t mask = chunk_mask(white);
+		if (mask != SCAN_FULL) {
+			return pos + __builtin_ctz(~mask);
+		}
+	}
+#endif
+	while (pos < len && isspace((unsigned char)src[pos])) {
+		pos++;
+	}
+	return pos;
+}
+
+size_t scan_line_end(const char *src, size_t pos, size_t len) {
+#ifdef SCAN_WIDTH
+	Chunk newline = chunk_set('\n');
+	Chunk nul = chunk_set('\0');
+	for (; pos + SCAN_WIDTH <= len; pos += SCAN_WIDTH) {
+		Chunk c = chunk_load(src + pos);
+		Chunk end = chunk_or(chunk_eq(c, newline), chunk_eq(c, nul));
+		uint32_t mask = chunk_mask(end);
+		if (mask != 0) {
+			return pos + __builtin_ctz(mask);
+		}
+	}
+#endif
+	while (pos < len && src[pos] != '\n' && src[pos] != '\0') {
+		pos++;
+	}
+	return pos;
+}
+
+size_t scan_ident(const char *src, size_t pos, size_t len) {
+#ifdef SCAN_WIDTH
+	Chunk lower = chunk_set(0x20);
+	Chunk underscore = chunk_set('_');
+	for (; pos + SCAN_WIDTH <= len; pos += SCAN_WIDTH) {
+		Chunk c = chunk_load(src + pos);
+		// setting the bit 0x20 puts upper case letters in lower case
+		Chunk letter = chunk_in_range(chunk_or(c, lower), 'a', 25);
+		Chunk digit = chunk_in_range(c, '0', 9);
+		Chunk ident = chunk_or(chunk_or(letter, digit),
+				       chunk_eq(c, underscore));
+		uint32_t mask = chunk_mask(ident);
+		if (mask != SCAN_FULL) {
+			return pos + __builtin_ctz(~mask);
+		}
+	}
+#endif
+	while (pos < len &&
+	       (isalnum((unsigned char)src[pos]) || src[pos] == '_')) {
+		pos++;
+	}
+	return pos;
+}
+
+uint32_t scan_count_newlines(const char *src, size_t pos, size_t end) {
+	uint32_t count = 0;
+#ifdef SCAN_WIDTH
+	Chunk newline = chunk_set('\n');
+	for (; pos + SCAN_WIDTH <= end; pos += SCAN_WIDTH) {
+		Chunk c = chunk_load(src + pos);
+		count += __builtin_popcount(chunk_mask(chunk_eq(c, newline)));
+	}
+#endif
+	for (; pos < end; pos++) {
+		count += (src[pos] == '\n');
+	}
+	return count;
+}
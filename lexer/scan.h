@@ -0,0 +1,20 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Scanning functions of the lexer over the raw source.
+// They read 32 (AVX2) or 16 (SSE2) bytes at a time when it is available and
+// never read after `src[len - 1]`.
+
+// Returns the position of the first character of `src` after `pos` that is not
+// a white space (' ', '\t', '\n', '\v', '\f', '\r') or `len`
+size_t scan_whitespace(const char *src, size_t pos, size_t len);
+
+// Returns the position of the first '\n' or '\0' of `src` after `pos` or `len`
+size_t scan_line_end(const char *src, size_t pos, size_t len);
+
+// Returns the position of the first character of `src` after `pos` that cannot
+// be in an identifier (letters, digits and '_') or `len`
+size_t scan_ident(const char *src, size_t pos, size_t len);
+
+// Returns the number of '\n' of `src` between `pos` and `end`
+uint32_t scan_count_newlines(const char *src, size_t pos, size_t end);
@@ -0,0 +1,104 @@
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	char **names;	 // name of every symbol
+	uint32_t *lens;	 // length of every name
+	uint32_t len;	 // number of symbols
+	uint32_t cap;	 // capacity of `names` and `lens`
+	Symbol *buckets; // open addressing hash table of symbols
+	uint32_t nb_buckets;
+} SymbolTable;
+
+SymbolTable symbol_table = {NULL, NULL, 0, 0, NULL, 0};
+
+// FNV-1a hash of the `len` first characters of `text`
+uint32_t symbol_hash(const char *text, uint32_t len) {
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)text[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// Returns the bucket where `text` is or should be inserted
+uint32_t symbol_bucket(SymbolTable *table, const char *text, uint32_t len,
+		       uint32_t hash) {
+	uint32_t mask = table->nb_buckets - 1;
+	uint32_t bucket = hash & mask;
+	while (true) {
+		Symbol symbol = table->buckets[bucket];
+		if (symbol == NO_SYMBOL ||
+		    (table->lens[symbol] == len &&
+		     memcmp(table->names[symbol], text, len) == 0)) {
+			return bucket;
+		}
+		bucket = (bucket + 1) & mask;
+	}
+}
+
+// Doubles the number of buckets (the table is kept at most half full)
+void symbols_rehash(SymbolTable *table) {
+	free(table->buckets);
+	table->nb_buckets =
+	    (table->nb_buckets == 0) ? 64 : table->nb_buckets * 2;
+	table->buckets = malloc(table->nb_buckets * sizeof(*table->buckets));
+	for (uint32_t i = 0; i < table->nb_buckets; i++) {
+		table->buckets[i] = NO_SYMBOL;
+	}
+	for (Symbol symbol = 0; symbol < table->len; symbol++) {
+		char *name = table->names[symbol];
+		uint32_t len = table->lens[symbol];
+		uint32_t hash = symbol_hash(name, len);
+		table->buckets[symbol_bucket(table, name, len, hash)] = symbol;
+	}
+}
+
+Symbol symbol_intern(const char *text, uint32_t len) {
+	SymbolTable *table = &symbol_table;
+	if (2 * (table->len + 1) > table->nb_buckets) {
+		symbols_rehash(table);
+	}
+	uint32_t hash = symbol_hash(text, len);
+	uint32_t bucket = symbol_bucket(table, text, len, hash);
+	if (table->buckets[bucket] != NO_SYMBOL) {
+		return table->buckets[bucket];
+	}
+
+	if (table->len == table->cap) {
+		table->cap = (table->cap == 0) ? 64 : table->cap * 2;
+		table->names =
+		    realloc(table->names, table->cap * sizeof(*table->names));
+		table->lens =
+		    realloc(table->lens, table->cap * sizeof(*table->lens));
+	}
+	Symbol symbol = table->len;
+	table->len++;
+	table->names[symbol] = strndup(text, len);
+	table->lens[symbol] = len;
+	table->buckets[bucket] = symbol;
+	return symbol;
+}
+
+const char *symbol_name(Symbol symbol) { return symbol_table.names[symbol]; }
+
+uint32_t symbols_len(void) { return symbol_table.len; }
+
+void symbols_delete(void) {
+	SymbolTable *table = &symbol_table;
+	for (Symbol symbol = 0; symbol < table->len; symbol++) {
+		free(table->names[symbol]);
+	}
+	free(table->names);
+	free(table->lens);
+	free(table->buckets);
+	table->names = NULL;
+	table->lens = NULL;
+	table->buckets = NULL;
+	table->len = 0;
+	table->cap = 0;
+	table->nb_buckets = 0;
+}
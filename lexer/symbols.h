@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+// Identifiers are interned in a global table : every identifier is represented
+// by a dense integer (its symbol) from the lexer to the compiler.
+// Two identifiers are the same if and only if their symbols are equal.
+typedef uint32_t Symbol;
+
+// Symbol returned when there is no identifier
+#define NO_SYMBOL UINT32_MAX
+
+// Returns the symbol of the `len` first characters of `text`
+// The identifier is added to the table if it is not already in it
+Symbol symbol_intern(const char *text, uint32_t len);
+
+// Returns the NUL terminated name of `symbol`
+const char *symbol_name(Symbol symbol);
+
+// Number of symbols interned, every symbol is in [0, symbols_len()[
+uint32_t symbols_len(void);
+
+// Free the table, every symbol given before is not valid anymore
+void symbols_delete(void);
@@ -0,0 +1,383 @@
+#include "parser.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+///// ----- FORMAT ----- /////
+
+// Beginning of a .hast file, followed by the sections (each one is padded to
+// 8 bytes) :
+// - functions : `functions_len` Function, `args.args` is the index of their
+//   first argument in the arguments
+// - nodes : `nodes_len` Expression
+// - items : `items_len` ExprId
+// - arguments : `args_len` Arg
+// - names : `symbols_len + 1` offsets of the name of every symbol in the
+//   `names_len` bytes that follow them
+// Every Symbol of the file is the one of the compiler that wrote it : they are
+// replaced by the symbols of the names when the file is loaded.
+typedef struct {
+	char magic[4];	  // "HAST"
+	uint32_t version; // AST_CACHE_VERSION
+	uint64_t hash;	  // hash of the source of the Ast
+	uint32_t sizes;	  // sizes of Expression, Function and Arg
+	uint32_t functions_len;
+	uint32_t nodes_len;
+	uint32_t items_len;
+	uint32_t args_len;
+	uint32_t symbols_len;
+	uint64_t names_len;
+} AstCacheHeader;
+
+uint32_t ast_cache_sizes(void) {
+	return sizeof(Expression) | sizeof(Function) << 8 | sizeof(Arg) << 16;
+}
+
+size_t ast_cache_align(size_t size) { return (size + 7) & ~(size_t)7; }
+
+// Returns the size of the file described by `header`
+size_t ast_cache_size(AstCacheHeader *header) {
+	size_t size = ast_cache_align(sizeof(*header));
+	size += ast_cache_align(header->functions_len * sizeof(Function));
+	size += ast_cache_align(header->nodes_len * sizeof(Expression));
+	size += ast_cache_align(header->items_len * sizeof(ExprId));
+	size += ast_cache_align(header->args_len * sizeof(Arg));
+	size += ast_cache_align((header->symbols_len + (size_t)1) *
+				sizeof(uint32_t));
+	size += ast_cache_align(header->names_len);
+	return size;
+}
+
+///// ----- HASH ----- /////
+
+uint64_t ast_cache_hash(const char *text, size_t len) {
+	uint64_t hash = 14695981039346656037u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)text[i];
+		hash *= 1099511628211u;
+	}
+	return hash;
+}
+
+uint64_t ast_cache_hash_file(FILE *file) {
+	Source source;
+	source_load(&source, file);
+	uint64_t hash = ast_cache_hash(source.text, source.len);
+	source_release(&source);
+	rewind(file);
+	return hash;
+}
+
+void ast_cache_path(char *cache_path, size_t size, const char *path) {
+	size_t len = strlen(path);
+	if (len >= 3 && strcmp(path + len - 3, ".ha") == 0) {
+		snprintf(cache_path, size, "%sst", path);
+	} else {
+		snprintf(cache_path, size, "%s.hast", path);
+	}
+}
+
+///// ----- WRITE ----- /////
+
+// Writes zeros after a section of `size` bytes until a multiple of 8 bytes
+void ast_cache_pad(FILE *file, size_t size) {
+	static const char zeros[8] = {0};
+	fwrite(zeros, 1, ast_cache_align(size) - size, file);
+}
+
+// Writes the `size` bytes of `data` as a section
+void ast_cache_write_section(FILE *file, const void *data, size_t size) {
+	if (size > 0) {
+		fwrite(data, 1, size, file);
+	}
+	ast_cache_pad(file, size);
+}
+
+// The file is written next to `path` then renamed : a compiler that loads
+// `path` at the same time never sees a file half written
+bool ast_cache_write(Ast *ast, uint64_t hash, const char *path) {
+	size_t tmp_size = strlen(path) + 32;
+	char *tmp_path = malloc(tmp_size);
+	snprintf(tmp_path, tmp_size, "%s.%ld.tmp", path, (long)getpid());
+	FILE *file = fopen(tmp_path, "wb");
+	if (file == NULL) {
+		free(tmp_path);
+		return false;
+	}
+
+	AstCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "HAST", 4);
+	header.version = AST_CACHE_VERSION;
+	header.hash = hash;
+	header.sizes = ast_cache_sizes();
+	header.functions_len = ast->len;
+	header.nodes_len = ast->nodes_len;
+	header.items_len = ast->items_len;
+	for (uint32_t i = 0; i < ast->len; i++) {
+		header.args_len += ast->functions[i].args.len;
+	}
+	header.symbols_len = symbols_len();
+	for (Symbol symbol = 0; symbol < header.symbols_len; symbol++) {
+		header.names_len += strlen(symbol_name(symbol));
+	}
+	ast_cache_write_section(file, &header, sizeof(header));
+
+	// The functions are copied one by one to replace their pointers
+	uint32_t first_arg = 0;
+	for (uint32_t i = 0; i < ast->len; i++) {
+		Function function;
+		memset(&function, 0, sizeof(function));
+		function.expr = ast->functions[i].expr;
+		function.name = ast->functions[i].name;
+		function.type = ast->functions[i].type;
+		function.args.len = ast->functions[i].args.len;
+		function.args.args = (Arg *)(uintptr_t)first_arg;
+		first_arg += function.args.len;
+		fwrite(&function, sizeof(function), 1, file);
+	}
+	ast_cache_pad(file, ast->len * sizeof(Function));
+
+	ast_cache_write_section(file, ast->nodes,
+				ast->nodes_len * sizeof(*ast->nodes));
+	ast_cache_write_section(file, ast->items,
+				ast->items_len * sizeof(*ast->items));
+
+	for (uint32_t i = 0; i < ast->len; i++) {
+		Args args = ast->functions[i].args;
+		for (uint32_t j = 0; j < args.len; j++) {
+			Arg arg;
+			memset(&arg, 0, sizeof(arg));
+			arg.name = args.args[j].name;
+			arg.type = args.args[j].type;
+			fwrite(&arg, sizeof(arg), 1, file);
+		}
+	}
+	ast_cache_pad(file, header.args_len * sizeof(Arg));
+
+	uint32_t offset = 0;
+	for (Symbol symbol = 0; symbol <= header.symbols_len; symbol++) {
+		fwrite(&offset, sizeof(offset), 1, file);
+		if (symbol < header.symbols_len) {
+			offset += strlen(symbol_name(symbol));
+		}
+	}
+	ast_cache_pad(file, (header.symbols_len + 1) * sizeof(uint32_t));
+	for (Symbol symbol = 0; symbol < header.symbols_len; symbol++) {
+		const char *name = symbol_name(symbol);
+		fwrite(name, 1, strlen(name), file);
+	}
+	ast_cache_pad(file, header.names_len);
+
+	bool written = !ferror(file);
+	if (fclose(file) != 0) {
+		written = false;
+	}
+	if (written && rename(tmp_path, path) != 0) {
+		written = false;
+	}
+	if (!written) {
+		remove(tmp_path);
+	}
+	free(tmp_path);
+	return written;
+}
+
+///// ----- LOAD ----- /////
+
+// The indices of a file are checked while they are patched : a file that
+// was cut or written by another program is not loaded. The parser pushes the
+// children of a node before it, so a child is always below its parent and the
+// Ast has no cycle.
+
+bool ast_cache_node(AstCacheHeader *header, ExprId id) {
+	return id < header->nodes_len;
+}
+
+// `child` is a child of the node `id`
+bool ast_cache_child(ExprId id, ExprId child) { return child < id; }
+
+// The range of items of the node `id` is in the file and below the node
+bool ast_cache_items(AstCacheHeader *header, ExprId *items, ExprId id,
+		     uint32_t first, uint32_t len) {
+	if ((uint64_t)first + len > header->items_len) {
+		return false;
+	}
+	for (uint32_t i = first; i < first + len; i++) {
+		if (!ast_cache_child(id, items[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Replace the symbol of the file `symbol` by the one of `symbols`
+bool ast_cache_symbol(AstCacheHeader *header, Symbol *symbols,
+		      Symbol *symbol) {
+	if (*symbol >= header->symbols_len) {
+		return false;
+	}
+	*symbol = symbols[*symbol];
+	return true;
+}
+
+// Replace the symbols of the file in the node `id` by the ones of `symbols`,
+// returns false if an index of the node is out of the file or not below it
+bool ast_cache_patch(AstCacheHeader *header, Expression *nodes,
+		     ExprId *items, ExprId id, Symbol *symbols) {
+	Expression *expr = &nodes[id];
+	switch ((ExpressionType)expr->tag) {
+	case LET_E:
+		return ast_cache_child(id, expr->let.e) &&
+		       ast_cache_symbol(header, symbols, &expr->let.var);
+	case SEQUENCE_E:
+		return ast_cache_items(header, items, id, expr->sequence.first,
+				       expr->sequence.len);
+	case ASSIGN_E:
+		return ast_cache_child(id, expr->assign.e) &&
+		       ast_cache_symbol(header, symbols, &expr->assign.var);
+	case DEREF_ASSIGN_E:
+		return ast_cache_child(id, expr->deref_assign.e1) &&
+		       ast_cache_child(id, expr->deref_assign.e2);
+	case DEREF_E:
+		return ast_cache_child(id, expr->deref.e);
+	case RETURN_E:
+		return ast_cache_child(id, expr->ret.e);
+	case VARIABLE_E:
+		return ast_cache_symbol(header, symbols, &expr->variable.name);
+	case FUNCTION_CALL_E:
+		return ast_cache_items(header, items, id,
+				       expr->function_call.first,
+				       expr->function_call.len) &&
+		       ast_cache_symbol(header, symbols,
+					&expr->function_call.name);
+	case IF_ELSE_E:
+		return ast_cache_child(id, expr->if_else.cond) &&
+		       ast_cache_child(id, expr->if_else.if_body) &&
+		       (expr->if_else.else_body == NO_EXPR ||
+			ast_cache_child(id, expr->if_else.else_body));
+	case NUMBER_E:
+	case CHAR_LITERAL_E:
+	case STRING_LITERAL_E:
+		return true;
+	case ADD_E:
+	case SUB_E:
+	case MULT_E:
+	case DIV_E:
+	case NOT_EQUAL_E:
+	case EQUAL_EQUAL_E:
+	case GREATER_THAN_EQUAL_E:
+	case GREATER_THAN_E:
+	case LESS_THAN_EQUAL_E:
+	case LESS_THAN_E:
+		return ast_cache_child(id, expr->binary.lhs) &&
+		       ast_cache_child(id, expr->binary.rhs);
+	}
+	return false;
+}
+
+// Replace the symbols of the file by the ones of this compiler and the
+// indices of the arguments by pointers, returns false on the first index out
+// of the file
+bool ast_cache_patch_all(AstCacheHeader *header, Function *functions,
+			 Expression *nodes, ExprId *items, Arg *args,
+			 uint32_t *offsets, char *names) {
+	// Symbol of this compiler of every symbol of the file
+	Symbol *symbols = malloc(header->symbols_len * sizeof(*symbols));
+	bool ok = true;
+	for (uint32_t i = 0; ok && i < header->symbols_len; i++) {
+		ok = offsets[i] <= offsets[i + 1] &&
+		     offsets[i + 1] <= header->names_len;
+		if (ok) {
+			symbols[i] = symbol_intern(names + offsets[i],
+						   offsets[i + 1] - offsets[i]);
+		}
+	}
+
+	for (uint32_t i = 0; ok && i < header->nodes_len; i++) {
+		ok = ast_cache_patch(header, nodes, items, i, symbols);
+	}
+	for (uint32_t i = 0; ok && i < header->items_len; i++) {
+		ok = ast_cache_node(header, items[i]);
+	}
+	for (uint32_t i = 0; ok && i < header->args_len; i++) {
+		ok = ast_cache_symbol(header, symbols, &args[i].name);
+	}
+	for (uint32_t i = 0; ok && i < header->functions_len; i++) {
+		Function *function = &functions[i];
+		uintptr_t first = (uintptr_t)function->args.args;
+		ok = ast_cache_node(header, function->expr) &&
+		     ast_cache_symbol(header, symbols, &function->name) &&
+		     first + function->args.len <= header->args_len;
+		function->args.args = args + (ok ? first : 0);
+	}
+	free(symbols);
+	return ok;
+}
+
+Ast *ast_cache_load(const char *path, uint64_t hash) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 ||
+	    (size_t)file_stat.st_size < sizeof(AstCacheHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	// The mapping is private : the symbols are patched in memory only
+	size_t len = file_stat.st_size;
+	char *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	AstCacheHeader *header = (AstCacheHeader *)map;
+	if (memcmp(header->magic, "HAST", 4) != 0 ||
+	    header->version != AST_CACHE_VERSION || header->hash != hash ||
+	    header->sizes != ast_cache_sizes() ||
+	    ast_cache_size(header) != len) {
+		munmap(map, len);
+		return NULL;
+	}
+
+	char *section = map + ast_cache_align(sizeof(*header));
+	Function *functions = (Function *)section;
+	section += ast_cache_align(header->functions_len * sizeof(Function));
+	Expression *nodes = (Expression *)section;
+	section += ast_cache_align(header->nodes_len * sizeof(Expression));
+	ExprId *items = (ExprId *)section;
+	section += ast_cache_align(header->items_len * sizeof(ExprId));
+	Arg *args = (Arg *)section;
+	section += ast_cache_align(header->args_len * sizeof(Arg));
+	uint32_t *offsets = (uint32_t *)section;
+	section += ast_cache_align((header->symbols_len + (size_t)1) *
+				   sizeof(uint32_t));
+	char *names = section;
+
+	if (!ast_cache_patch_all(header, functions, nodes, items, args,
+				 offsets, names)) {
+		munmap(map, len);
+		return NULL;
+	}
+
+	Ast *ast = ast_new();
+	ast->functions = functions;
+	ast->len = header->functions_len;
+	ast->cap = header->functions_len;
+	ast->nodes = nodes;
+	ast->nodes_len = header->nodes_len;
+	ast->nodes_cap = header->nodes_len;
+	ast->items = items;
+	ast->items_len = header->items_len;
+	ast->items_cap = header->items_len;
+	ast->mapping = map;
+	ast->mapping_len = len;
+	return ast;
+}
@@ -1,14 +1,16 @@
 #include "parser.h"
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 ///// ----- PARSE FUNCTIONS ----- /////
 
 bool parse_token_type(ParseState *state, TokenType token_type, bool required) {
-	if (current_token(state).type == token_type) {
-		state->index++;
+	if (current_type(state) == token_type) {
+		parse_advance(state);
 		return true;
 	}
 	if (required) {
@@ -23,14 +25,14 @@ bool parse_token_type(ParseState *state, TokenType token_type, bool required) {
 }
 
 ProgramType parse_program_type(ParseState *state, bool required) {
-	if (current_token(state).type == VOID) {
-		state->index++;
+	if (current_type(state) == VOID) {
+		parse_advance(state);
 		return VOID_T;
-	} else if (current_token(state).type == U8) {
-		state->index++;
+	} else if (current_type(state) == U8) {
+		parse_advance(state);
 		return U8_T;
-	} else if (current_token(state).type == U16) {
-		state->index++;
+	} else if (current_type(state) == U16) {
+		parse_advance(state);
 		return U16_T;
 	}
 
@@ -41,17 +43,15 @@ ProgramType parse_program_type(ParseState *state, bool required) {
 		fprintf(state->error, "\n");
 	}
 
-	ProgramType *type = malloc(sizeof(*type));
-	*type = U16_T;
 	state->abort = true;
 	return VOID_T;
 }
 
-char *parse_identifier(ParseState *state, bool required) {
-	Token token = current_token(state);
-	if (token.type == IDENTIFIER) {
-		state->index++;
-		return token.text;
+Symbol parse_identifier(ParseState *state, bool required) {
+	if (current_type(state) == IDENTIFIER) {
+		Symbol name = current_token(state).symbol;
+		parse_advance(state);
+		return name;
 	}
 	if (required) {
 		fprintf_line_column(state);
@@ -59,362 +59,334 @@ char *parse_identifier(ParseState *state, bool required) {
 		fprintf_current_token(state);
 		fprintf(state->error, "\n");
 	}
-	return NULL;
+	return NO_SYMBOL;
 }
 
-Expression *parse_number(ParseState *state) {
-	// Number in hexadecimal form "0x123" (lex as '0' 'x123')
-	if (current_token(state).type == NUMBER &&
-	    strlen(current_token(state).text) == 1 &&
-	    state->tokens->tokens[state->index].text[0] == '0') {
-		char *prev_text = current_token(state).text;
-		state->index++;
-		int i;
-		Expression *e = malloc(sizeof(*e));
-		// TODO check more things if this really a number
-
-		if (current_token(state).type == IDENTIFIER &&
-		    current_token(state).text[0] == 'x' &&
-		    sscanf(current_token(state).text + 1, "%x", &i) != EOF
-
-		) {
-			free(prev_text);
-			free(current_token(state).text);
-			state->index++;
-			e->tag = NUMBER_E;
-			e->number.value = (uint32_t)i;
-			e->number.is_written_in_hexa = true;
-			return e;
+ExprId parse_number(ParseState *state) {
+	if (current_type(state) == NUMBER) {
+		Token token = current_token(state);
+		Expression e = expression_new(NUMBER_E);
+		e.number.value = token.number.value;
+		e.number.base = token.number.base;
+		e.number.type = NONE;
+		if (token.number.suffix == U8) {
+			e.number.type = U8_T;
+		} else if (token.number.suffix == U16) {
+			e.number.type = U16_T;
 		}
-		state->index--;
-	}
-
-	// Number in decimal form
-	if (current_token(state).type == NUMBER) {
-		Expression *e = malloc(sizeof(*e));
-		e->tag = NUMBER_E;
-		e->number.value =
-		    (uint32_t)atoi(state->tokens->tokens[state->index].text);
-		free(current_token(state).text);
-		e->number.is_written_in_hexa = false;
-		state->index++;
-		return e;
+		parse_advance(state);
+		return ast_push(state->ast, e);
 	}
-	return NULL;
+	return NO_EXPR;
 }
 
-Expression *parse_char_literal(ParseState *state) {
-	if (current_token(state).type == CHAR_LITERAL) {
-		Expression *e = malloc(sizeof(*e));
-		e->tag = CHAR_LITERAL_E;
-		e->char_literal.c = current_token(state).text[0];
-		free(current_token(state).text);
-		state->index++;
-		return e;
+ExprId parse_char_literal(ParseState *state) {
+	if (current_type(state) == CHAR_LITERAL) {
+		Expression e = expression_new(CHAR_LITERAL_E);
+		e.char_literal.c = current_token(state).number.value;
+		parse_advance(state);
+		return ast_push(state->ast, e);
 	}
-	return NULL;
+	return NO_EXPR;
 }
 
-// Expression *parse_expr_add_sub(ParseState *state, bool required);
-Expression *parse_binary_expr(ParseState *state, bool required);
-Expression *parse_expr(ParseState *state);
+ExprId parse_binary_expr(ParseState *state, bool required);
+ExprId parse_expr(ParseState *state);
 
-Expression *parse_if_else(ParseState *state) {
+ExprId parse_if_else(ParseState *state) {
 	if (!parse_token_type(state, IF, false)) {
-		return NULL;
+		return NO_EXPR;
 	}
 	if (!parse_token_type(state, LPAREN, true)) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *cond = parse_binary_expr(state, true);
-	if (cond == NULL) {
+	ExprId cond = parse_binary_expr(state, true);
+	if (cond == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
 	if (!parse_token_type(state, RPAREN, true)) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *if_body = parse_expr(state);
-	if (if_body == NULL) {
+	ExprId if_body = parse_expr(state);
+	if (if_body == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
+	ExprId else_body = NO_EXPR;
 	if (parse_token_type(state, ELSE, false)) {
-		Expression *else_body = parse_expr(state);
-		if (else_body == NULL) {
+		else_body = parse_expr(state);
+		if (else_body == NO_EXPR) {
 			state->abort = true;
-			return NULL;
+			return NO_EXPR;
 		}
-		Expression *expr = malloc(sizeof(*expr));
-		expr->tag = IF_ELSE_E;
-		expr->if_else.if_body = if_body;
-		expr->if_else.cond = cond;
-		expr->if_else.else_body = else_body;
-		return expr;
-	}
-	Expression *expr = malloc(sizeof(*expr));
-	expr->tag = IF_ELSE_E;
-	expr->if_else.if_body = if_body;
-	expr->if_else.cond = cond;
-	expr->if_else.else_body = NULL;
-
-	return expr;
+	}
+	Expression expr = expression_new(IF_ELSE_E);
+	expr.if_else.if_body = if_body;
+	expr.if_else.cond = cond;
+	expr.if_else.else_body = else_body;
+	return ast_push(state->ast, expr);
 }
-Expression *parse_let(ParseState *state) {
+ExprId parse_let(ParseState *state) {
 	if (!parse_token_type(state, LET, false)) {
 		state->abort = false;
-		return NULL;
+		return NO_EXPR;
 	}
-	char *var = parse_identifier(state, true);
-	if (var == NULL) {
+	Symbol var = parse_identifier(state, true);
+	if (var == NO_SYMBOL) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
 	if (!parse_token_type(state, COLON, true)) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
 
 	ProgramType type = parse_program_type(state, true);
 	if (state->abort || !parse_token_type(state, EQUAL, true)) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *e = parse_binary_expr(state, true);
-	if (state->abort || e == NULL) {
+	ExprId e = parse_binary_expr(state, true);
+	if (state->abort || e == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *expr = malloc(sizeof(*expr));
-	expr->tag = LET_E;
-	expr->let.e = e;
-	expr->let.type = type;
-	expr->let.var = var;
-	return expr;
+	Expression expr = expression_new(LET_E);
+	expr.let.e = e;
+	expr.let.type = type;
+	expr.let.var = var;
+	return ast_push(state->ast, expr);
 }
 
-Expression *parse_deref_assign_or_deref(ParseState *state) {
+ExprId parse_deref_assign_or_deref(ParseState *state) {
 	if (!parse_token_type(state, MULT, false)) {
 		state->abort = false;
-		return NULL;
+		return NO_EXPR;
 	}
 
-	Expression *e1 = parse_binary_expr(state, true);
-	if (state->abort || e1 == NULL) {
+	ExprId e1 = parse_binary_expr(state, true);
+	if (state->abort || e1 == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
 
-	if (e1->tag == ASSIGN_E) {
-		Expression *variable = malloc(sizeof(*variable));
-		variable->tag = VARIABLE_E;
-		variable->variable.name = e1->assign.var;
-
-		Expression *save_expr = e1->assign.e;
-
-		e1->tag = DEREF_ASSIGN_E;
-		e1->deref_assign.e2 = save_expr;
-		e1->deref_assign.e1 = variable;
-		return e1;
+	if (ast_node(state->ast, e1)->tag == ASSIGN_E) {
+		// The node of `var = e` becomes the variable : the children are
+		// always pushed before their parent
+		Expression *assign = ast_node(state->ast, e1);
+		Expression expr = expression_new(DEREF_ASSIGN_E);
+		expr.deref_assign.e1 = e1;
+		expr.deref_assign.e2 = assign->assign.e;
+		Symbol var = assign->assign.var;
+		*assign = expression_new(VARIABLE_E);
+		assign->variable.name = var;
+		return ast_push(state->ast, expr);
 	}
 
 	if (!parse_token_type(state, EQUAL, false)) {
-		Expression *expr = malloc(sizeof(*expr));
-		expr->tag = DEREF_E;
-		expr->deref.e = e1;
-		return expr;
+		Expression expr = expression_new(DEREF_E);
+		expr.deref.e = e1;
+		return ast_push(state->ast, expr);
 	}
-	Expression *e2 = parse_binary_expr(state, true);
-	if (state->abort || e2 == NULL) {
+	ExprId e2 = parse_binary_expr(state, true);
+	if (state->abort || e2 == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *expr = malloc(sizeof(*expr));
-	expr->tag = DEREF_ASSIGN_E;
-	expr->deref_assign.e1 = e1;
-	expr->deref_assign.e2 = e2;
-	return expr;
+	Expression expr = expression_new(DEREF_ASSIGN_E);
+	expr.deref_assign.e1 = e1;
+	expr.deref_assign.e2 = e2;
+	return ast_push(state->ast, expr);
 }
 
-Expression *parse_return(ParseState *state) {
+ExprId parse_return(ParseState *state) {
 	if (!parse_token_type(state, RETURN, false)) {
 		state->abort = false;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *e = parse_binary_expr(state, true);
-	if (state->abort || e == NULL) {
+	ExprId e = parse_binary_expr(state, true);
+	if (state->abort || e == NO_EXPR) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
-	Expression *expr = malloc(sizeof(*expr));
-	expr->tag = RETURN_E;
-	expr->ret.e = e;
-	return expr;
+	Expression expr = expression_new(RETURN_E);
+	expr.ret.e = e;
+	return ast_push(state->ast, expr);
 }
 
-Expression *parse_func_call_or_var_assign_or_var(ParseState *state) {
-	char *identifier = parse_identifier(state, false);
-	if (identifier == NULL) {
+ExprId parse_func_call_or_var_assign_or_var(ParseState *state) {
+	Symbol identifier = parse_identifier(state, false);
+	if (identifier == NO_SYMBOL) {
 		state->abort = false;
-		return NULL;
+		return NO_EXPR;
 	}
 	if (parse_token_type(state, LPAREN, false)) {
 		if (parse_token_type(state, RPAREN, true)) {
-			Expression *expr = malloc(sizeof(*expr));
-			expr->tag = FUNCTION_CALL_E;
-			expr->function_call.name = identifier;
-			return expr;
+			Expression expr = expression_new(FUNCTION_CALL_E);
+			expr.function_call.name = identifier;
+			expr.function_call.first = state->ast->items_len;
+			expr.function_call.len = 0;
+			return ast_push(state->ast, expr);
 		} else {
 			state->abort = true;
-			return NULL;
+			return NO_EXPR;
 		}
 	}
 
 	if (parse_token_type(state, EQUAL, false)) {
-		Expression *e = parse_binary_expr(state, true);
-		if (state->abort || e == NULL) {
+		ExprId e = parse_binary_expr(state, true);
+		if (state->abort || e == NO_EXPR) {
 			state->abort = true;
-			return NULL;
+			return NO_EXPR;
 		}
-		Expression *expr = malloc(sizeof(*expr));
-		expr->tag = ASSIGN_E;
-		expr->assign.e = e;
-		expr->assign.var = identifier;
-		return expr;
+		Expression expr = expression_new(ASSIGN_E);
+		expr.assign.e = e;
+		expr.assign.var = identifier;
+		return ast_push(state->ast, expr);
 	}
 
-	Expression *expr = malloc(sizeof(*expr));
-	expr->tag = VARIABLE_E;
-	expr->variable.name = identifier;
-	return expr;
+	Expression expr = expression_new(VARIABLE_E);
+	expr.variable.name = identifier;
+	return ast_push(state->ast, expr);
 }
 
-Expression *parse_unary_expr(ParseState *state) {
-	Expression *e = NULL;
-	Expression *(*parse_unary[7])(ParseState *) = {
-	    parse_char_literal, parse_let,
-	    parse_if_else,	parse_deref_assign_or_deref,
-	    parse_return,	parse_func_call_or_var_assign_or_var,
-	    parse_number,
-	};
-	for (int i = 0; i < 7; i++) {
-		e = parse_unary[i](state);
-		if (state->abort) {
-			return NULL;
-		}
-		if (e != NULL) {
-			return e;
-		}
-	}
-	return NULL;
+///// ----- PRATT PARSER ----- /////
+
+// Parse an expression that begins with a given token type
+typedef ExprId (*PrefixParse)(ParseState *state);
+
+// Prefix parse function of every token type (NULL if it cannot begin an
+// expression)
+PrefixParse prefix_parse[END_OF_FILE + 1] = {
+    [CHAR_LITERAL] = parse_char_literal,
+    [LET] = parse_let,
+    [IF] = parse_if_else,
+    [MULT] = parse_deref_assign_or_deref,
+    [RETURN] = parse_return,
+    [IDENTIFIER] = parse_func_call_or_var_assign_or_var,
+    [NUMBER] = parse_number,
+};
+
+// Binary operator of a token type : the higher its power, the more it binds
+typedef struct {
+	ExpressionType tag;
+	uint8_t power; // 0 if the token type is not a binary operator
+} InfixOp;
+
+InfixOp infix_ops[END_OF_FILE + 1] = {
+    [MULT] = {MULT_E, 3},
+    [DIVIDE] = {DIV_E, 3},
+    [PLUS] = {ADD_E, 2},
+    [MINUS] = {SUB_E, 2},
+    [EQUAL_EQUAL] = {EQUAL_EQUAL_E, 1},
+    [NOT_EQUAL] = {NOT_EQUAL_E, 1},
+    [GREATER_THAN_EQUAL] = {GREATER_THAN_EQUAL_E, 1},
+    [GREATER_THAN] = {GREATER_THAN_E, 1},
+    [LESS_THAN_EQUAL] = {LESS_THAN_EQUAL_E, 1},
+    [LESS_THAN] = {LESS_THAN_E, 1},
+};
+
+ExprId parse_unary_expr(ParseState *state) {
+	PrefixParse parse_prefix = prefix_parse[current_type(state)];
+	if (parse_prefix == NULL) {
+		return NO_EXPR;
+	}
+	return parse_prefix(state);
 }
 
-Expression *parse_binary_expr(ParseState *state, bool required) {
-	Expression *expr = parse_unary_expr(state);
-	if (state->abort || expr == NULL) {
+// Parse an expression whose binary operators have a power above `min_power`
+// Operators of the same power are left associative
+ExprId parse_binary_expr_power(ParseState *state, bool required,
+			       uint8_t min_power) {
+	ExprId expr = parse_unary_expr(state);
+	if (state->abort || expr == NO_EXPR) {
 		if (required) {
 			fprintf_line_column(state);
 			fprintf(state->error, "Expected an Expression1 \n");
 		}
-		return NULL;
+		return NO_EXPR;
 	}
 	while (true) {
-		TokenType type = VOID;
-		TokenType bin_op[10] = {PLUS,	      MULT,
-					MINUS,	      DIVIDE,
-					EQUAL_EQUAL,  NOT_EQUAL,
-					LESS_THAN,    LESS_THAN_EQUAL,
-					GREATER_THAN, GREATER_THAN_EQUAL};
-		for (int i = 0; i < 10; i++) {
-			if (parse_token_type(state, bin_op[i], false)) {
-				type = bin_op[i];
-				break;
-			}
-		}
-		if (type == VOID) {
+		InfixOp op = infix_ops[current_type(state)];
+		if (op.power <= min_power) {
 			break;
 		}
-		ExpressionType next_tag = token_type_to_binary_tag(type);
-		Expression *rhs = parse_unary_expr(state);
-		if (state->abort || rhs == NULL) {
+		parse_advance(state);
+		ExprId rhs = parse_binary_expr_power(state, false, op.power);
+		if (state->abort || rhs == NO_EXPR) {
 			state->abort = true;
-			expression_delete(expr, true);
-			return NULL;
-		}
-		if (precedence(expr->tag) <= precedence(next_tag)) {
-			Expression *lhs = expr;
-			expr = (Expression *)malloc(sizeof(*expr));
-			expr->tag = next_tag;
-			expr->binary.lhs = lhs;
-			expr->binary.rhs = rhs;
-		} else {
-			Expression *lhs = (Expression *)malloc(sizeof(*expr));
-			lhs->tag = next_tag;
-			lhs->binary.lhs = expr->binary.rhs;
-			lhs->binary.rhs = rhs;
-			expr->binary.rhs = lhs;
+			return NO_EXPR;
 		}
+		Expression binary = expression_new(op.tag);
+		binary.binary.lhs = expr;
+		binary.binary.rhs = rhs;
+		expr = ast_push(state->ast, binary);
 	}
 	return expr;
 }
 
-Expression *parse_expr(ParseState *state) {
+ExprId parse_binary_expr(ParseState *state, bool required) {
+	return parse_binary_expr_power(state, required, 0);
+}
+
+ExprId parse_expr(ParseState *state) {
 	if (!parse_token_type(state, LBRACE, false)) {
-		return NULL;
+		return NO_EXPR;
 	}
 
-	Expression *expr = NULL;
+	// The items of the nested sequences are added to the Ast while this
+	// sequence is parsed : its items are kept aside until the end
+	ExprId *items = NULL;
+	uint32_t len = 0;
+	uint32_t cap = 0; // capacity of `items`
 
 	// Sequence : (expression ;)*
 	while (true) {
 		bool required = false;
-		if (expr == NULL) {
+		if (len == 0) {
 			required = true;
 		}
-		Expression *expr_next = parse_binary_expr(state, required);
+		ExprId expr_next = parse_binary_expr(state, required);
 		if (state->abort) {
-			return NULL;
+			free(items);
+			return NO_EXPR;
 		}
-		if (expr_next == NULL) {
+		if (expr_next == NO_EXPR) {
 			break;
 		}
 
 		if (!parse_token_type(state, SEMICOLON, true)) {
 			state->abort = true;
-			return NULL;
+			free(items);
+			return NO_EXPR;
 		}
 
-		if (expr == NULL) {
-			expr = malloc(sizeof(*expr));
-			expr->tag = SEQUENCE_E;
-			expr->sequence.len = 0;
-			expr->sequence.list = NULL;
-		}
-		expr->sequence.len++;
-		Expression *prev_list = expr->sequence.list;
-		expr->sequence.list = malloc(expr->sequence.len *
-					     sizeof(*expr->sequence.list));
-		for (int i = 0; i < expr->sequence.len - 1; i++) {
-			expr->sequence.list[i] = prev_list[i];
-		}
-		if (prev_list != NULL) {
-			free(prev_list);
-		}
-
-		expr->sequence.list[expr->sequence.len - 1] = *expr_next;
-		free(expr_next);
+		items = vector_reserve(items, &cap, len + 1, sizeof(*items));
+		items[len] = expr_next;
+		len++;
 	}
 
-	if (expr == NULL && state->abort) {
+	if (len == 0 && state->abort) {
 		fprintf(state->error, "Empty block are not allowed\n");
-		return NULL;
+		return NO_EXPR;
 	}
 
+	ExprId expr = NO_EXPR;
+	if (len != 0) {
+		Expression sequence = expression_new(SEQUENCE_E);
+		sequence.sequence.first =
+		    ast_push_items(state->ast, items, len);
+		sequence.sequence.len = len;
+		expr = ast_push(state->ast, sequence);
+	}
+	free(items);
+
 	if (!parse_token_type(state, RBRACE, true)) {
 		state->abort = true;
-		return NULL;
+		return NO_EXPR;
 	}
 
 	return expr;
@@ -424,6 +396,7 @@ Args parse_args(ParseState *state) {
 	Args args;
 	args.len = 0;
 	args.args = NULL;
+	uint32_t cap = 0; // capacity of `args.args`
 	while (true) {
 		Arg arg;
 		bool required = true;
@@ -431,130 +404,308 @@ Args parse_args(ParseState *state) {
 			required = false;
 		}
 		arg.name = parse_identifier(state, required);
-		if (arg.name == NULL) {
+		if (arg.name == NO_SYMBOL) {
 			break;
 		}
 
 		if (!parse_token_type(state, COLON, true)) {
 			state->abort = true;
+			free(args.args);
 			return args;
 		}
 
 		ProgramType arg_type = parse_program_type(state, true);
 		if (state->abort) {
+			free(args.args);
 			return args;
 		}
 
-		args.len++;
-		Arg *prev_args = args.args;
-		args.args = malloc(sizeof(*args.args) * args.len);
-		for (int i = 0; i < args.len - 1; i++) {
-			args.args[i] = prev_args[i];
-		}
-		if (prev_args != NULL) {
-			free(prev_args);
-		}
-
 		arg.type = arg_type;
-		args.args[args.len - 1] = arg;
+		args.args = vector_reserve(args.args, &cap, args.len + 1,
+					   sizeof(arg));
+		args.args[args.len] = arg;
+		args.len++;
 
 		if (!parse_token_type(state, COMMA, false)) {
-			return args;
+			break;
 		}
 	}
+
+	// The arguments are moved in the arena of the Ast
+	Arg *list = args.args;
+	args.args =
+	    arena_copy(&state->ast->arena, list, args.len * sizeof(*list));
+	free(list);
 	return args;
 }
 
 // fn indentifier () type = expression
-Function *parse_function(ParseState *state, bool required) {
+// The function is returned by value, its `expr` is NO_EXPR if there is none
+Function parse_function(ParseState *state, bool required) {
+	Function function;
+	memset(&function, 0, sizeof(function));
+	function.expr = NO_EXPR;
 	if (!parse_token_type(state, FN, false)) {
-		return NULL;
+		return function;
 	}
 
-	char *name = parse_identifier(state, required);
-	if (name == NULL) {
+	Symbol name = parse_identifier(state, required);
+	if (name == NO_SYMBOL) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
 	if (!parse_token_type(state, LPAREN, true)) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
 	Args args = parse_args(state);
 	if (state->abort) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
 	if (!parse_token_type(state, RPAREN, true)) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
 	ProgramType type = parse_program_type(state, true);
 	if (state->abort) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
 	if (!parse_token_type(state, EQUAL, true)) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
-	Expression *expr = parse_expr(state);
-	if (state->abort || expr == NULL) {
+	ExprId expr = parse_expr(state);
+	if (state->abort || expr == NO_EXPR) {
 		state->abort = required;
-		return NULL;
+		return function;
 	}
 
-	Function *function = malloc(sizeof(*function));
-	function->name = name;
-	function->expr = expr;
-	function->type = type;
-	function->args = args;
+	function.name = name;
+	function.expr = expr;
+	function.type = type;
+	function.args = args;
 	return function;
 }
 
-// Input : list of tokens
-// Ouput : result of an Ast constructed from those tokens
-Ast *parse(FILE *error, Tokens *tokens) {
+// Parse all the functions of the tokens given by the parsing state
+Ast *parse_functions(ParseState *state) {
 	Ast *ast = ast_new();
+	state->ast = ast;
+
+	// Every node uses at least one token : with the tokens to parse known
+	// the nodes never have to be moved while they are added
+	if (state->tokens != NULL) {
+		ast->nodes = vector_reserve(ast->nodes, &ast->nodes_cap,
+					    state->end - state->index,
+					    sizeof(*ast->nodes));
+	}
 
+	while (current_type(state) != END_OF_FILE) {
+		Function function = parse_function(state, true);
+		if (state->abort) {
+			ast_delete(ast);
+			return NULL;
+		}
+		if (function.expr == NO_EXPR) {
+			break;
+		}
+		if (parse_token_type(state, SEMICOLON, true)) {
+			ast_append(ast, function);
+		} else {
+			fprintf_line_column(state);
+			fprintf(state->error,
+				"Missing ';' at end of function\n");
+			ast_delete(ast);
+			return NULL;
+		}
+	}
+
+	if (current_type(state) != END_OF_FILE) {
+		ast_delete(ast);
+		return NULL;
+	}
+	ast->functions = vector_shrink(ast->functions, &ast->cap, ast->len,
+				       sizeof(*ast->functions));
+	ast->nodes = vector_shrink(ast->nodes, &ast->nodes_cap, ast->nodes_len,
+				   sizeof(*ast->nodes));
+	ast->items = vector_shrink(ast->items, &ast->items_cap, ast->items_len,
+				   sizeof(*ast->items));
+	return ast;
+}
+
+Ast *parse_sequential(FILE *error, Tokens *tokens) {
 	ParseState state;
 	state.error = error;
 	state.tokens = tokens;
 	state.index = 0;
+	state.end = tokens->len;
+	state.lexer = NULL;
 	state.abort = false;
+	return parse_functions(&state);
+}
 
-	while (state.index < state.tokens->len) {
-		Function *function = parse_function(&state, true);
-		if (state.abort) {
-			return NULL;
+///// ----- PARALLEL PARSING ----- /////
+
+// The functions of the tokens [state.index, state.end) parsed by their own
+// thread in their own Ast
+typedef struct {
+	ParseState state;
+	Ast *ast;	   // NULL if there is an error
+	FILE *errors;	   // errors of the chunk
+	char *errors_text; // content of `errors`
+	size_t errors_len;
+} ParseChunk;
+
+void *parse_chunk_thread(void *chunk) {
+	ParseChunk *parse_chunk = chunk;
+	parse_chunk->ast = parse_functions(&parse_chunk->state);
+	return NULL;
+}
+
+// Cut the tokens in at most `nb_chunks` chunks of about the same size, the
+// chunk i begins at `cuts[i]`. Returns the number of chunks.
+// A chunk begins with a 'fn' after '} ;' out of any brace : the parsing of the
+// previous function always stops right there.
+uint32_t parse_cut(Tokens *tokens, uint32_t nb_chunks, uint32_t *cuts) {
+	uint8_t *types = tokens->types;
+	uint32_t len = 1;
+	cuts[0] = 0;
+	int32_t depth = 0;
+	for (uint32_t i = 0; i < tokens->len && len < nb_chunks; i++) {
+		if (types[i] == LBRACE) {
+			depth++;
+		} else if (types[i] == RBRACE) {
+			depth--;
 		}
-		if (function == NULL) {
+		if (depth < 0) {
+			// the parsing fails, the rest is in the last chunk
 			break;
 		}
-		if (parse_token_type(&state, SEMICOLON, true)) {
-			ast_append(ast, *function);
-			free(function);
+		if (types[i] == FN && depth == 0 && i >= 2 &&
+		    types[i - 1] == SEMICOLON && types[i - 2] == RBRACE &&
+		    i >= (uint64_t)tokens->len * len / nb_chunks) {
+			cuts[len] = i;
+			len++;
+		}
+	}
+	return len;
+}
+
+// Parse the functions of `tokens` cut in `nb_chunks` chunks parsed in parallel.
+// The Ast and the errors are the same as the ones of `parse_sequential`.
+Ast *parse_parallel(FILE *error, Tokens *tokens, uint32_t nb_chunks) {
+	uint32_t *cuts = malloc(nb_chunks * sizeof(*cuts));
+	nb_chunks = parse_cut(tokens, nb_chunks, cuts);
+	if (nb_chunks <= 1) {
+		free(cuts);
+		return parse_sequential(error, tokens);
+	}
+
+	ParseChunk *chunks = malloc(nb_chunks * sizeof(*chunks));
+	pthread_t *threads = malloc(nb_chunks * sizeof(*threads));
+	for (uint32_t i = 0; i < nb_chunks; i++) {
+		ParseChunk *chunk = &chunks[i];
+		chunk->errors = open_memstream(&chunk->errors_text,
+					       &chunk->errors_len);
+		chunk->state.error = chunk->errors;
+		chunk->state.tokens = tokens;
+		chunk->state.index = cuts[i];
+		chunk->state.end =
+		    (i + 1 < nb_chunks) ? cuts[i + 1] : tokens->len;
+		chunk->state.lexer = NULL;
+		chunk->state.abort = false;
+		pthread_create(&threads[i], NULL, parse_chunk_thread, chunk);
+	}
+
+	// The functions are merged in the order of the source, only the errors
+	// until the first chunk that fails are written
+	Ast *ast = NULL;
+	bool failed = false;
+	for (uint32_t i = 0; i < nb_chunks; i++) {
+		ParseChunk *chunk = &chunks[i];
+		pthread_join(threads[i], NULL);
+		fclose(chunk->errors);
+		if (!failed && chunk->errors_len > 0) {
+			fwrite(chunk->errors_text, 1, chunk->errors_len, error);
+		}
+		free(chunk->errors_text);
+		if (chunk->ast == NULL) {
+			failed = true;
+		} else if (failed) {
+			ast_delete(chunk->ast);
+		} else if (ast == NULL) {
+			ast = chunk->ast;
 		} else {
-			fprintf_line_column(&state);
-			fprintf(error, "Missing ';' at end of function\n");
-			return false;
+			ast_merge(ast, chunk->ast);
 		}
 	}
+	free(cuts);
+	free(chunks);
+	free(threads);
+
+	if (failed) {
+		if (ast != NULL) {
+			ast_delete(ast);
+		}
+		return NULL;
+	}
+	ast->functions = vector_shrink(ast->functions, &ast->cap, ast->len,
+				       sizeof(*ast->functions));
+	ast->nodes = vector_shrink(ast->nodes, &ast->nodes_cap, ast->nodes_len,
+				   sizeof(*ast->nodes));
+	ast->items = vector_shrink(ast->items, &ast->items_cap, ast->items_len,
+				   sizeof(*ast->items));
+	return ast;
+}
+
+Ast *parse_chunks(FILE *error, Tokens *tokens, uint32_t nb_chunks) {
+	Ast *ast = NULL;
+	if (nb_chunks <= 1) {
+		ast = parse_sequential(error, tokens);
+	} else {
+		ast = parse_parallel(error, tokens, nb_chunks);
+	}
 
-	if (state.index != tokens->len) {
+	// The Ast does not point inside of the tokens
+	tokens_delete(tokens);
+	return ast;
+}
+
+// Input : list of tokens
+// Ouput : result of an Ast constructed from those tokens
+Ast *parse(FILE *error, Tokens *tokens) {
+	// one chunk by core, and chunks of at least PARSER_CHUNK_MIN tokens
+	long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t nb_chunks = tokens->len / PARSER_CHUNK_MIN;
+	if (nb_cores > 0 && nb_chunks > (uint32_t)nb_cores) {
+		nb_chunks = nb_cores;
+	}
+	return parse_chunks(error, tokens, nb_chunks);
+}
+
+// Input : lexer giving the tokens while they are parsed
+// Ouput : result of an Ast constructed from those tokens
+Ast *parse_lexer(FILE *error, Lexer *lexer) {
+	ParseState state;
+	state.error = error;
+	state.tokens = NULL;
+	state.index = 0;
+	state.end = 0;
+	state.lexer = lexer;
+	state.abort = false;
+
+	Ast *ast = parse_functions(&state);
+	if (ast != NULL && lexer_failed(lexer)) {
 		ast_delete(ast);
 		ast = NULL;
 	}
-
-	// tokens_free_numbers(tokens);
-	// tokens_free_numbers(tokens);
-	free(tokens->tokens);
-	free(tokens);
 	return ast;
 }
@@ -1,15 +1,64 @@
 #include <stdint.h>
 #include "parser_utils.h"
 
+// Token lists bigger than 2 chunks have their functions parsed by several
+// threads in parallel
+#define PARSER_CHUNK_MIN (1 << 16)
+
 // Input : list of tokens
 // Ouput : Ast constructed from those tokens or NULL if there is a parsing error
+// The functions are in the order of the source and only the errors until the
+// first one in the source are written, even when they are parsed in parallel.
 Ast *parse(FILE *error, Tokens *tokens);
 
+// Same as `parse` but the tokens are cut in at most `nb_chunks` chunks of
+// functions parsed in parallel (whatever the number of tokens)
+Ast *parse_chunks(FILE *error, Tokens *tokens, uint32_t nb_chunks);
+
+// Input : lexer of a file, the file is lexed while it is parsed
+// Ouput : Ast constructed from those tokens or NULL if there is a lexing or
+// parsing error. The Ast does not point inside of the lexer.
+Ast *parse_lexer(FILE *error, Lexer *lexer);
+
 void ast_delete(Ast *ast);
 
-void fprintf_expression(FILE *file, Expression *expr);
+void fprintf_expression(FILE *file, Ast *ast, ExprId id);
 
 // Input :
 // - file : file stream to write the tokens
 // - ast : the AST structure to write in the file steam
 void fprintf_ast(FILE *file, Ast *ast);
+
+// An Ast can be saved in a binary .hast file, to be loaded again instead of
+// lexing and parsing a source that did not change.
+// A .hast file is a header followed by the arrays of the Ast as they are in
+// memory (functions, nodes, items, arguments) and by the names of the
+// symbols. It is only valid for the source with the hash of its header, and
+// for the version of the format and the sizes of the structures of the
+// compiler that wrote it. (parser/ast_cache.c)
+
+// Version of the format of the .hast files, changed with the format (or with
+// Expression, Function and Arg)
+#define AST_CACHE_VERSION 2
+
+// Hash of a source (64 bits FNV-1a of its content)
+uint64_t ast_cache_hash(const char *text, size_t len);
+
+// Hash of the content of `file`, which is rewinded after it
+// (`file` should be a regular file, to be read again)
+uint64_t ast_cache_hash_file(FILE *file);
+
+// Path of the .hast file of a source : main.ha gives main.hast and any other
+// path gets the .hast extension
+void ast_cache_path(char *cache_path, size_t size, const char *path);
+
+// Writes `ast`, from a source of hash `hash`, in the file `path`
+// Returns false if the file cannot be written
+bool ast_cache_write(Ast *ast, uint64_t hash, const char *path);
+
+// Input : path of a .hast file and hash of the source
+// Output : the Ast saved in the file, or NULL if there is no such file or if
+// it was written for another source, another version or other structures
+// The file is memory-mapped : the nodes are not copied, only the symbols are
+// interned again and patched in place.
+Ast *ast_cache_load(const char *path, uint64_t hash);
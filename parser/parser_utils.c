@@ -1,108 +1,365 @@
 #include "parser_utils.h"
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+TokenType current_type(ParseState *state) {
+	if (state->lexer != NULL) {
+		return lexer_peek(state->lexer).type;
+	}
+	if (state->index >= state->end) {
+		return END_OF_FILE;
+	}
+	return state->tokens->types[state->index];
+}
 
 Token current_token(ParseState *state) {
-	return state->tokens->tokens[state->index];
+	if (state->lexer != NULL) {
+		return lexer_peek(state->lexer);
+	}
+	return tokens_get(state->tokens, state->index);
+}
+
+void parse_advance(ParseState *state) {
+	if (state->lexer != NULL) {
+		lexer_next(state->lexer);
+		return;
+	}
+	state->index++;
+}
+
+///// ----- AST FUNCTIONS ----- /////
+
+// The nodes are small enough for a few of them to share a cache line
+_Static_assert(sizeof(Expression) == 16, "Expression should be 16 bytes");
+
+// Free a complete AST structure
+// The nodes and the items of the Ast are two arrays : they are freed at once
+void ast_delete(Ast *ast) {
+	arena_delete(&ast->arena);
+	if (ast->mapping != NULL) {
+		// the arrays are inside of a loaded .hast file
+		munmap(ast->mapping, ast->mapping_len);
+	} else {
+		free(ast->functions);
+		free(ast->nodes);
+		free(ast->items);
+	}
+	free(ast);
+}
+
+Ast *ast_new(void) {
+	Ast *ast = malloc(sizeof(*ast));
+	ast->len = 0;
+	ast->cap = 0;
+	ast->functions = NULL;
+	ast->nodes = NULL;
+	ast->nodes_len = 0;
+	ast->nodes_cap = 0;
+	ast->items = NULL;
+	ast->items_len = 0;
+	ast->items_cap = 0;
+	ast->arena = arena_empty();
+	ast->mapping = NULL;
+	ast->mapping_len = 0;
+	return ast;
 }
 
-///// ----- EXPRESSION FUNCTIONS ----- /////
+// function should not be NULL
+void ast_append(Ast *ast, Function function) {
+	ast->functions = vector_reserve(ast->functions, &ast->cap,
+					ast->len + 1, sizeof(function));
+	ast->functions[ast->len] = function;
+	ast->len++;
+}
 
-/// Deletes completely recursively what expression points to
-/// It does not free the expression it self
-void expression_delete(Expression *expr, bool delete_itself) {
-	switch (expr->tag) {
+ExprId ast_push(Ast *ast, Expression expr) {
+	ast->nodes = vector_reserve(ast->nodes, &ast->nodes_cap,
+				    ast->nodes_len + 1, sizeof(expr));
+	ast->nodes[ast->nodes_len] = expr;
+	return ast->nodes_len++;
+}
+
+uint32_t ast_push_items(Ast *ast, ExprId *items, uint32_t len) {
+	uint32_t first = ast->items_len;
+	if (len == 0) {
+		return first;
+	}
+	ast->items = vector_reserve(ast->items, &ast->items_cap,
+				    ast->items_len + len, sizeof(*items));
+	memcpy(ast->items + first, items, len * sizeof(*items));
+	ast->items_len += len;
+	return first;
+}
+
+Expression *ast_node(Ast *ast, ExprId id) { return &ast->nodes[id]; }
+
+// Add `nodes` to the indices of nodes of `expr`, and `items` to its indices of
+// items
+void expression_shift(Expression *expr, uint32_t nodes, uint32_t items) {
+	switch ((ExpressionType)expr->tag) {
 	case LET_E:
-		free(expr->let.var);
-		expression_delete(expr->let.e, true);
-		break;
-	case ADD_E:
-	case SUB_E:
-	case MULT_E:
-	case DIV_E:
-	case EQUAL_EQUAL_E:
-	case NOT_EQUAL_E:
-	case GREATER_THAN_EQUAL_E:
-	case GREATER_THAN_E:
-	case LESS_THAN_EQUAL_E:
-	case LESS_THAN_E:
-		expression_delete(expr->binary.lhs, true);
-		expression_delete(expr->binary.rhs, true);
-		break;
-	case VARIABLE_E:
-		free(expr->variable.name);
-		break;
-	case NUMBER_E:
+		expr->let.e += nodes;
 		break;
 	case SEQUENCE_E:
-		for (int i = 0; i < expr->sequence.len; i++) {
-			expression_delete(&expr->sequence.list[i], false);
-		}
-		free(expr->sequence.list);
+		expr->sequence.first += items;
 		break;
 	case ASSIGN_E:
-		free(expr->assign.var);
-		expression_delete(expr->assign.e, true);
+		expr->assign.e += nodes;
 		break;
 	case DEREF_ASSIGN_E:
-		expression_delete(expr->deref_assign.e1, true);
-		expression_delete(expr->deref_assign.e2, true);
+		expr->deref_assign.e1 += nodes;
+		expr->deref_assign.e2 += nodes;
 		break;
 	case DEREF_E:
-		expression_delete(expr->deref.e, true);
+		expr->deref.e += nodes;
 		break;
 	case RETURN_E:
-		expression_delete(expr->ret.e, true);
+		expr->ret.e += nodes;
 		break;
 	case FUNCTION_CALL_E:
-		free(expr->function_call.name);
+		expr->function_call.first += items;
 		break;
-	case CHAR_LITERAL_E:
+	case IF_ELSE_E:
+		expr->if_else.cond += nodes;
+		expr->if_else.if_body += nodes;
+		if (expr->if_else.else_body != NO_EXPR) {
+			expr->if_else.else_body += nodes;
+		}
 		break;
+	case VARIABLE_E:
+	case NUMBER_E:
+	case CHAR_LITERAL_E:
 	case STRING_LITERAL_E:
 		break;
-	case IF_ELSE_E:
-		expression_delete(expr->if_else.if_body, true);
-		expression_delete(expr->if_else.cond, true);
-		if (expr->if_else.else_body == NULL) {
-			break;
-		}
-		expression_delete(expr->if_else.else_body, true);
+	default: // binary operators
+		expr->binary.lhs += nodes;
+		expr->binary.rhs += nodes;
+		break;
+	}
+}
+
+void ast_merge(Ast *ast, Ast *other) {
+	uint32_t nodes = ast->nodes_len;
+	uint32_t items = ast->items_len;
+
+	ast->nodes = vector_reserve(ast->nodes, &ast->nodes_cap,
+				    nodes + other->nodes_len,
+				    sizeof(*ast->nodes));
+	for (uint32_t i = 0; i < other->nodes_len; i++) {
+		Expression expr = other->nodes[i];
+		expression_shift(&expr, nodes, items);
+		ast->nodes[nodes + i] = expr;
 	}
-	if (delete_itself) {
-		free(expr);
+	ast->nodes_len += other->nodes_len;
+
+	ast->items = vector_reserve(ast->items, &ast->items_cap,
+				    items + other->items_len,
+				    sizeof(*ast->items));
+	for (uint32_t i = 0; i < other->items_len; i++) {
+		ast->items[items + i] = other->items[i] + nodes;
+	}
+	ast->items_len += other->items_len;
+
+	// The arguments are in the arena of `other`, deleted with it
+	for (uint32_t i = 0; i < other->len; i++) {
+		Function function = other->functions[i];
+		function.expr += nodes;
+		function.args.args =
+		    arena_copy(&ast->arena, function.args.args,
+			       function.args.len * sizeof(*function.args.args));
+		ast_append(ast, function);
 	}
+	ast_delete(other);
 }
 
-///// ----- AST FUNCTIONS ----- /////
+Expression expression_new(ExpressionType tag) {
+	Expression expr;
+	memset(&expr, 0, sizeof(expr));
+	expr.tag = tag;
+	return expr;
+}
 
-// Free a complete AST structure
-void ast_delete(Ast *ast) {
-	for (int i = 0; i < ast->len; i++) {
-		free(ast->functions[i].name);
-		expression_delete(ast->functions[i].expr, true);
-		// free(ast->functions[i].expr);
+///// ----- EQUALITY AND HASH ----- /////
+
+bool expression_equal(Ast *ast1, ExprId id1, Ast *ast2, ExprId id2);
+
+// Compare the `len` items of `ast1` from `first1` to the ones of `ast2` from
+// `first2`
+bool items_equal(Ast *ast1, uint32_t first1, Ast *ast2, uint32_t first2,
+		 uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		if (!expression_equal(ast1, ast1->items[first1 + i], ast2,
+				      ast2->items[first2 + i])) {
+			return false;
+		}
 	}
-	free(ast->functions);
-	free(ast);
+	return true;
 }
 
-Ast *ast_new(void) {
-	Ast *ast = malloc(sizeof(*ast));
-	ast->len = 0;
-	ast->cap = 0;
-	ast->functions = NULL;
-	return ast;
+// The nodes are compared by their content and their children, whatever their
+// indices (two Ast of the same source parsed differently are equal)
+bool expression_equal(Ast *ast1, ExprId id1, Ast *ast2, ExprId id2) {
+	if (id1 == NO_EXPR || id2 == NO_EXPR) {
+		return id1 == id2;
+	}
+	Expression *e1 = ast_node(ast1, id1);
+	Expression *e2 = ast_node(ast2, id2);
+	if (e1->tag != e2->tag) {
+		return false;
+	}
+	switch ((ExpressionType)e1->tag) {
+	case LET_E:
+		return e1->let.var == e2->let.var &&
+		       e1->let.type == e2->let.type &&
+		       expression_equal(ast1, e1->let.e, ast2, e2->let.e);
+	case SEQUENCE_E:
+		return e1->sequence.len == e2->sequence.len &&
+		       items_equal(ast1, e1->sequence.first, ast2,
+				   e2->sequence.first, e1->sequence.len);
+	case ASSIGN_E:
+		return e1->assign.var == e2->assign.var &&
+		       expression_equal(ast1, e1->assign.e, ast2, e2->assign.e);
+	case DEREF_ASSIGN_E:
+		return expression_equal(ast1, e1->deref_assign.e1, ast2,
+					e2->deref_assign.e1) &&
+		       expression_equal(ast1, e1->deref_assign.e2, ast2,
+					e2->deref_assign.e2);
+	case DEREF_E:
+		return expression_equal(ast1, e1->deref.e, ast2, e2->deref.e);
+	case VARIABLE_E:
+		return e1->variable.name == e2->variable.name;
+	case NUMBER_E:
+		return e1->number.value == e2->number.value &&
+		       e1->number.base == e2->number.base &&
+		       e1->number.type == e2->number.type;
+	case RETURN_E:
+		return expression_equal(ast1, e1->ret.e, ast2, e2->ret.e);
+	case FUNCTION_CALL_E:
+		return e1->function_call.name == e2->function_call.name &&
+		       e1->function_call.len == e2->function_call.len &&
+		       items_equal(ast1, e1->function_call.first, ast2,
+				   e2->function_call.first,
+				   e1->function_call.len);
+	case CHAR_LITERAL_E:
+	case STRING_LITERAL_E:
+		return e1->char_literal.c == e2->char_literal.c;
+	case IF_ELSE_E:
+		return expression_equal(ast1, e1->if_else.cond, ast2,
+					e2->if_else.cond) &&
+		       expression_equal(ast1, e1->if_else.if_body, ast2,
+					e2->if_else.if_body) &&
+		       expression_equal(ast1, e1->if_else.else_body, ast2,
+					e2->if_else.else_body);
+	default: // binary operators
+		return expression_equal(ast1, e1->binary.lhs, ast2,
+					e2->binary.lhs) &&
+		       expression_equal(ast1, e1->binary.rhs, ast2,
+					e2->binary.rhs);
+	}
 }
 
-// function should not be NULL
-void ast_append(Ast *ast, Function function) {
-	ast->len += 1;
-	if (ast->len > ast->cap) {
-		ast->cap = (ast->cap == 0) ? 1 : ast->cap * 2;
-		ast->functions = (Function *)realloc(
-		    ast->functions, ast->cap * sizeof(Function));
+bool ast_equal(Ast *ast1, Ast *ast2) {
+	if (ast1->len != ast2->len) {
+		return false;
+	}
+	for (uint32_t i = 0; i < ast1->len; i++) {
+		Function *f1 = &ast1->functions[i];
+		Function *f2 = &ast2->functions[i];
+		if (f1->name != f2->name || f1->type != f2->type ||
+		    f1->args.len != f2->args.len) {
+			return false;
+		}
+		for (uint32_t j = 0; j < f1->args.len; j++) {
+			if (f1->args.args[j].name != f2->args.args[j].name ||
+			    f1->args.args[j].type != f2->args.args[j].type) {
+				return false;
+			}
+		}
+		if (!expression_equal(ast1, f1->expr, ast2, f2->expr)) {
+			return false;
+		}
 	}
-	ast->functions[ast->len - 1] = function;
+	return true;
+}
+
+// Add `value` to `hash` (FNV-1a step on 64 bits values)
+uint64_t hash_mix(uint64_t hash, uint64_t value) {
+	hash ^= value;
+	hash *= 1099511628211u;
+	return hash ^ (hash >> 29);
+}
+
+uint64_t expression_hash(Ast *ast, ExprId id) {
+	if (id == NO_EXPR) {
+		return hash_mix(14695981039346656037u, NO_EXPR);
+	}
+	Expression *expr = ast_node(ast, id);
+	uint64_t hash = hash_mix(14695981039346656037u, expr->tag);
+	switch ((ExpressionType)expr->tag) {
+	case LET_E:
+		hash = hash_mix(hash, expr->let.var);
+		hash = hash_mix(hash, expr->let.type);
+		return hash_mix(hash, expression_hash(ast, expr->let.e));
+	case SEQUENCE_E:
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			ExprId item = ast->items[expr->sequence.first + i];
+			hash = hash_mix(hash, expression_hash(ast, item));
+		}
+		return hash;
+	case ASSIGN_E:
+		hash = hash_mix(hash, expr->assign.var);
+		return hash_mix(hash, expression_hash(ast, expr->assign.e));
+	case DEREF_ASSIGN_E:
+		hash = hash_mix(hash,
+				expression_hash(ast, expr->deref_assign.e1));
+		return hash_mix(hash,
+				expression_hash(ast, expr->deref_assign.e2));
+	case DEREF_E:
+		return hash_mix(hash, expression_hash(ast, expr->deref.e));
+	case VARIABLE_E:
+		return hash_mix(hash, expr->variable.name);
+	case NUMBER_E:
+		hash = hash_mix(hash, expr->number.value);
+		hash = hash_mix(hash, expr->number.base);
+		return hash_mix(hash, expr->number.type);
+	case RETURN_E:
+		return hash_mix(hash, expression_hash(ast, expr->ret.e));
+	case FUNCTION_CALL_E:
+		hash = hash_mix(hash, expr->function_call.name);
+		for (uint32_t i = 0; i < expr->function_call.len; i++) {
+			ExprId arg = ast->items[expr->function_call.first + i];
+			hash = hash_mix(hash, expression_hash(ast, arg));
+		}
+		return hash;
+	case CHAR_LITERAL_E:
+	case STRING_LITERAL_E:
+		return hash_mix(hash, (unsigned char)expr->char_literal.c);
+	case IF_ELSE_E:
+		hash = hash_mix(hash, expression_hash(ast, expr->if_else.cond));
+		hash = hash_mix(hash,
+				expression_hash(ast, expr->if_else.if_body));
+		return hash_mix(hash,
+				expression_hash(ast, expr->if_else.else_body));
+	default: // binary operators
+		hash = hash_mix(hash, expression_hash(ast, expr->binary.lhs));
+		return hash_mix(hash, expression_hash(ast, expr->binary.rhs));
+	}
+}
+
+uint64_t ast_hash(Ast *ast) {
+	uint64_t hash = hash_mix(14695981039346656037u, ast->len);
+	for (uint32_t i = 0; i < ast->len; i++) {
+		Function *function = &ast->functions[i];
+		hash = hash_mix(hash, function->name);
+		hash = hash_mix(hash, function->type);
+		for (uint32_t j = 0; j < function->args.len; j++) {
+			hash = hash_mix(hash, function->args.args[j].name);
+			hash = hash_mix(hash, function->args.args[j].type);
+		}
+		hash = hash_mix(hash, expression_hash(ast, function->expr));
+	}
+	return hash;
 }
 
 ///// ----- fprintf FUNCTIONS ----- /////
@@ -124,23 +381,27 @@ void fprintf_program_type(FILE *file, ProgramType *program_type) {
 	}
 }
 
-int precedence(ExpressionType type) {
-	switch (type) {
-	case NOT_EQUAL_E:
-	case EQUAL_EQUAL_E:
-	case GREATER_THAN_EQUAL_E:
-	case GREATER_THAN_E:
-	case LESS_THAN_EQUAL_E:
-	case LESS_THAN_E:
-		return 3;
-	case ADD_E:
-	case SUB_E:
-		return 2;
-	case MULT_E:
-	case DIV_E:
-		return 1;
+void fprintf_number(FILE *file, uint16_t value, uint8_t base) {
+	switch (base) {
+	case 16:
+		fprintf(file, "0x%x", value);
+		break;
+	case 8:
+		fprintf(file, "0o%o", value);
+		break;
+	case 2:
+		fprintf(file, "0b");
+		int bit = 15;
+		while (bit > 0 && (value >> bit) == 0) {
+			bit--;
+		}
+		for (; bit >= 0; bit--) {
+			fprintf(file, "%d", (value >> bit) & 1);
+		}
+		break;
 	default:
-		return 0;
+		fprintf(file, "%d", value);
+		break;
 	}
 }
 
@@ -170,46 +431,20 @@ TokenType binary_tag_to_token_type(ExpressionType type) {
 		return VOID;
 	}
 }
-// For
-ExpressionType token_type_to_binary_tag(TokenType type) {
-	switch (type) {
-	case PLUS:
-		return ADD_E;
-	case MINUS:
-		return SUB_E;
-	case MULT:
-		return MULT_E;
-	case DIVIDE:
-		return DIV_E;
-	case NOT_EQUAL:
-		return EQUAL_EQUAL_E;
-	case EQUAL_EQUAL:
-		return EQUAL_EQUAL_E;
-	case GREATER_THAN_EQUAL:
-		return GREATER_THAN_EQUAL_E;
-	case GREATER_THAN:
-		return GREATER_THAN_E;
-	case LESS_THAN_EQUAL:
-		return LESS_THAN_EQUAL_E;
-	case LESS_THAN:
-		return LESS_THAN_E;
-	default:
-		printf("unreachable");
-		return LET_E; // this should no happend
-	}
-}
 
-void fprintf_expression(FILE *file, Expression *expr) {
-	switch (expr->tag) {
+void fprintf_expression(FILE *file, Ast *ast, ExprId id) {
+	Expression *expr = ast_node(ast, id);
+	switch ((ExpressionType)expr->tag) {
 	case LET_E:
 		fprintf(file, "let ");
-		fprintf(file, "%s", expr->let.var);
+		fprintf(file, "%s", symbol_name(expr->let.var));
 		if (expr->let.type != NONE) {
 			fprintf(file, ": ");
-			fprintf_program_type(file, &expr->let.type);
+			ProgramType let_type = expr->let.type;
+			fprintf_program_type(file, &let_type);
 		}
 		fprintf(file, " = ");
-		fprintf_expression(file, expr->let.e);
+		fprintf_expression(file, ast, expr->let.e);
 		break;
 	case ADD_E:
 	case SUB_E:
@@ -221,52 +456,53 @@ void fprintf_expression(FILE *file, Expression *expr) {
 	case GREATER_THAN_E:
 	case LESS_THAN_EQUAL_E:
 	case LESS_THAN_E:
-		fprintf_expression(file, expr->binary.lhs);
+		fprintf_expression(file, ast, expr->binary.lhs);
 		fprintf(file, " ");
 		TokenType type = binary_tag_to_token_type(expr->tag);
 		fprintf_token_type(file, &type);
 		fprintf(file, " ");
-		fprintf_expression(file, expr->binary.rhs);
+		fprintf_expression(file, ast, expr->binary.rhs);
 		break;
 	case VARIABLE_E:
-		fprintf(file, "%s", expr->variable.name);
+		fprintf(file, "%s", symbol_name(expr->variable.name));
 		break;
 	case NUMBER_E:
-		if (expr->number.is_written_in_hexa) {
-			fprintf(file, "0x%x", expr->number.value);
-		} else {
-			fprintf(file, "%d", expr->number.value);
+		fprintf_number(file, expr->number.value, expr->number.base);
+		if (expr->number.type != NONE) {
+			ProgramType number_type = expr->number.type;
+			fprintf_program_type(file, &number_type);
 		}
 		break;
 	case SEQUENCE_E:
-		for (int i = 0; i < expr->sequence.len; i++) {
-			fprintf_expression(file, &expr->sequence.list[i]);
+		for (uint32_t i = 0; i < expr->sequence.len; i++) {
+			ExprId item = ast->items[expr->sequence.first + i];
+			fprintf_expression(file, ast, item);
 			if (i != expr->sequence.len) {
 				fprintf(file, ";\n");
 			}
 		}
 		break;
 	case ASSIGN_E:
-		fprintf(file, "%s", expr->assign.var);
+		fprintf(file, "%s", symbol_name(expr->assign.var));
 		fprintf(file, " = ");
-		fprintf_expression(file, expr->assign.e);
+		fprintf_expression(file, ast, expr->assign.e);
 		break;
 	case DEREF_ASSIGN_E:
 		fprintf(file, "*");
-		fprintf_expression(file, expr->deref_assign.e1);
+		fprintf_expression(file, ast, expr->deref_assign.e1);
 		fprintf(file, " = ");
-		fprintf_expression(file, expr->deref_assign.e2);
+		fprintf_expression(file, ast, expr->deref_assign.e2);
 		break;
 	case DEREF_E:
 		fprintf(file, "*");
-		fprintf_expression(file, expr->deref.e);
+		fprintf_expression(file, ast, expr->deref.e);
 		break;
 	case RETURN_E:
 		fprintf(file, "return ");
-		fprintf_expression(file, expr->ret.e);
+		fprintf_expression(file, ast, expr->ret.e);
 		break;
 	case FUNCTION_CALL_E:
-		fprintf(file, "%s()", expr->function_call.name);
+		fprintf(file, "%s()", symbol_name(expr->function_call.name));
 		break;
 	case CHAR_LITERAL_E:
 		if (expr->char_literal.c == '\n') {
@@ -280,23 +516,23 @@ void fprintf_expression(FILE *file, Expression *expr) {
 		break;
 	case IF_ELSE_E:
 		fprintf(file, "if (");
-		fprintf_expression(file, expr->if_else.cond);
+		fprintf_expression(file, ast, expr->if_else.cond);
 		fprintf(file, ") {\n");
-		fprintf_expression(file, expr->if_else.if_body);
+		fprintf_expression(file, ast, expr->if_else.if_body);
 		fprintf(file, "}");
-		if (expr->if_else.else_body == NULL) {
+		if (expr->if_else.else_body == NO_EXPR) {
 			break;
 		}
 		fprintf(file, " else {\n");
-		fprintf_expression(file, expr->if_else.else_body);
+		fprintf_expression(file, ast, expr->if_else.else_body);
 		fprintf(file, "\n}");
 	}
 }
 
-void fprintf_function(FILE *file, Function *function) {
-	fprintf(file, "fn %s (", function->name);
+void fprintf_function(FILE *file, Ast *ast, Function *function) {
+	fprintf(file, "fn %s (", symbol_name(function->name));
 	for (int i = 0; i < function->args.len; i++) {
-		fprintf(file, "%s :", function->args.args[i].name);
+		fprintf(file, "%s :", symbol_name(function->args.args[i].name));
 		fprintf_program_type(file, &function->args.args[i].type);
 		if (i != function->args.len - 1) {
 			fprintf(file, ",");
@@ -305,7 +541,7 @@ void fprintf_function(FILE *file, Function *function) {
 	fprintf(file, ") ");
 	fprintf_program_type(file, &function->type);
 	fprintf(file, " = {\n");
-	fprintf_expression(file, function->expr);
+	fprintf_expression(file, ast, function->expr);
 	fprintf(file, "\n};");
 }
 
@@ -313,21 +549,30 @@ void fprintf_function(FILE *file, Function *function) {
 // - file name to write the tokens
 // - Ast that is goinf to be written in the file
 void fprintf_ast(FILE *file, Ast *ast) {
-	for (int i = 0; i < ast->len; i++) {
-		fprintf_function(file, &ast->functions[i]);
+	for (uint32_t i = 0; i < ast->len; i++) {
+		fprintf_function(file, ast, &ast->functions[i]);
 		fprintf(file, "\n");
 	}
 }
 
+char *sprintf_ast(Ast *ast, size_t *len) {
+	char *text = NULL;
+	FILE *file = open_memstream(&text, len);
+	fprintf_ast(file, ast);
+	fclose(file);
+	return text;
+}
+
 void fprintf_line_column(ParseState *state) {
-	fprintf(state->error,
-		"At line %d, column %d: ", current_token(state).line,
-		current_token(state).column);
+	Token token = current_token(state);
+	fprintf(state->error, "At line %d, column %d: ", token.line,
+		token.column);
 }
 
 void fprintf_current_token(ParseState *state) {
 	fprintf(state->error, "'");
-	fprintf_token(state->error, &state->tokens->tokens[state->index]);
+	Token token = current_token(state);
+	fprintf_token(state->error, &token);
 	// fprintf(state->error, "' a");
 	// fprintf_token_type(state->error,
 	// 		   &state->tokens->tokens[state->index].type);
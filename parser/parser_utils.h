@@ -1,4 +1,6 @@
 #include "../lexer/lexer.h"
+#include "../utils/arena.h"
+#include "../utils/vector.h"
 #include <stdint.h>
 
 typedef enum {
@@ -35,66 +37,77 @@ typedef enum {
 	IF_ELSE_E,
 } ExpressionType;
 
-typedef struct Expression {
+// Index of a node in the nodes of the Ast
+typedef uint32_t ExprId;
+
+// ExprId of an absent node (the else of an if without else)
+#define NO_EXPR UINT32_MAX
+
+// Every node is 16 bytes : the children are indices in the nodes of the Ast
+// and the lists (items of a sequence, arguments of a call) are ranges of the
+// items of the Ast. The enums are stored in bytes so the size and the layout
+// of the .hast files do not depend on -fshort-enums.
+typedef struct {
 	union {
 		struct { // let var (: type) = e
-			char *var;
-			struct Expression *e;
-			ProgramType type;
+			Symbol var;
+			ExprId e;
+			uint8_t type; // ProgramType
 		} let;
 		struct { // lhs 'operator' rhs
-			struct Expression *lhs;
-			struct Expression *rhs;
+			ExprId lhs;
+			ExprId rhs;
 		} binary;
-		struct { // list[0] ; ... ; list[lenght] ;
-			struct Expression *list;
-			uint16_t len;
+		struct { // items[first] ; ... ; items[first + len - 1] ;
+			uint32_t first;
+			uint32_t len;
 		} sequence;
 		struct { // var = e
-			char *var;
-			struct Expression *e;
+			Symbol var;
+			ExprId e;
 		} assign;
 		struct { // *var = e2, *number = e2
-			struct Expression *e1;
-			struct Expression *e2;
+			ExprId e1;
+			ExprId e2;
 		} deref_assign;
 		struct { // *e
-			struct Expression *e;
+			ExprId e;
 		} deref;
 		struct { // name
-			char *name;
+			Symbol name;
 		} variable;
 		struct { // value
 			uint16_t value;
-			bool is_written_in_hexa;
+			uint8_t base; // base in which the number is written
+			uint8_t type; // ProgramType given by the suffix
 		} number;
 		struct { // return e
-			struct Expression *e;
+			ExprId e;
 		} ret;
-		struct { // name ( [arg ,]* arg )
-			char *name;
-			uint8_t len;
-			struct Expression *args;
+		struct { // name ( [arg ,]* arg ), args in items[first..]
+			Symbol name;
+			uint32_t first;
+			uint32_t len;
 		} function_call;
 		struct {
 			char c;
 		} char_literal;
 		struct {
-			struct Expression *cond;
-			struct Expression *if_body;
-			struct Expression *else_body;
+			ExprId cond;
+			ExprId if_body;
+			ExprId else_body; // NO_EXPR without else
 		} if_else;
 	};
 	// The _E means that is used for expression
 	// it is used to sisambiguates with TokenType enum
-	// uint8_t size; TODO
-	// uint16_t line;
-	// uint16_t column;
-	ExpressionType tag;
+	uint8_t tag; // ExpressionType
+	// Width of the value (U8_T, U16_T, VOID_T for no value), set by the
+	// type checking of the compiler (NONE before)
+	uint8_t type; // ProgramType
 } Expression;
 
 typedef struct {
-	char *name;
+	Symbol name;
 	ProgramType type;
 } Arg;
 
@@ -104,8 +117,8 @@ typedef struct {
 } Args;
 
 typedef struct {
-	Expression *expr;
-	char *name;
+	ExprId expr;
+	Symbol name;
 
 	Args args;
 	ProgramType type;
@@ -113,24 +126,44 @@ typedef struct {
 
 typedef struct {
 	Function *functions;
-	uint8_t len;
-	uint8_t cap;
+	uint32_t len;
+	uint32_t cap;
+
+	Expression *nodes; // every node of the functions
+	uint32_t nodes_len;
+	uint32_t nodes_cap;
+
+	ExprId *items; // children of the sequences and of the function calls
+	uint32_t items_len;
+	uint32_t items_cap;
+
+	Arena arena; // arguments of the functions
+
+	void *mapping; // loaded .hast file with the arrays (NULL if allocated)
+	size_t mapping_len;
 } Ast;
 
 typedef struct {
-	FILE *error; // stream to output errors
-	Tokens *tokens;
+	FILE *error;	// stream to output errors
+	Tokens *tokens; // NULL when the tokens come from `lexer`
 	uint32_t index; // position in the tokens
+	uint32_t end;	// the tokens after `end` are not parsed
+	Lexer *lexer;	// NULL when the tokens are all in `tokens`
+	Ast *ast;	// where the nodes are added
 
 	bool abort; // have to stop the parsing or error
 } ParseState;
 
-// Get the current_token given the parsing state
+// Get the type of the current token given the parsing state
+// This only reads the dense array of types of the tokens
+TokenType current_type(ParseState *state);
+
+// Get a copy of the current token given the parsing state
+// (for the tokens with a payload: identifiers, numbers, characters)
 Token current_token(ParseState *state);
 
-/// Deletes completely recursively what expression points to
-/// It does not free the expression it self
-void expression_delete(Expression *expr, bool delete_itself);
+// Move the parsing state to the next token
+void parse_advance(ParseState *state);
 
 // Free a complete AST structure
 void ast_delete(Ast *ast);
@@ -140,23 +173,51 @@ Ast *ast_new(void);
 // function should not be NULL
 void ast_append(Ast *ast, Function function);
 
-TokenType binary_tag_to_token_type(ExpressionType type);
+// Add `expr` at the end of the nodes of `ast` and return its index
+// The pointers to the nodes of `ast` are invalid after it
+ExprId ast_push(Ast *ast, Expression expr);
+
+// Add `len` children at the end of the items of `ast` and return the index
+// of the first one
+uint32_t ast_push_items(Ast *ast, ExprId *items, uint32_t len);
+
+// Node of `ast` at index `id`
+Expression *ast_node(Ast *ast, ExprId id);
+
+// Move the functions of `other` at the end of the ones of `ast`, and delete
+// `other`
+void ast_merge(Ast *ast, Ast *other);
+
+// Node of type `tag` with all its other bytes at zero
+Expression expression_new(ExpressionType tag);
 
-ExpressionType token_type_to_binary_tag(TokenType type);
+// true if the two Ast have the same functions with the same expressions (the
+// indices of their nodes do not matter)
+bool ast_equal(Ast *ast1, Ast *ast2);
 
-int precedence(ExpressionType type);
+// Hash of the structure of an Ast : two equal Ast have the same hash
+uint64_t ast_hash(Ast *ast);
+
+TokenType binary_tag_to_token_type(ExpressionType type);
 
 void fprintf_program_type(FILE *file, ProgramType *program_type);
 
-void fprintf_expression(FILE *file, Expression *expr);
+// Write `value` in `base` with its prefix (0x, 0o or 0b)
+void fprintf_number(FILE *file, uint16_t value, uint8_t base);
 
-void fprintf_function(FILE *file, Function *function);
+void fprintf_expression(FILE *file, Ast *ast, ExprId id);
+
+void fprintf_function(FILE *file, Ast *ast, Function *function);
 
 // Input :
 // - file name to write the tokens
 // - Ast that is goinf to be written in the file
 void fprintf_ast(FILE *file, Ast *ast);
 
+// Returns the text written by `fprintf_ast` in memory (to free), and its
+// length in `len`
+char *sprintf_ast(Ast *ast, size_t *len);
+
 void fprintf_line_column(ParseState *state);
 
 void fprintf_current_token(ParseState *state);
@@ -1,10 +1,24 @@
 #include "compiler_to_uxn/compiler.h"
 #include "utils/colors.h"
 #include "utils/files.h"
+#include "vm/vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Number of instructions after which the execution of a test is stopped
+#define EXECUTION_BUDGET (1 << 24)
+
+// Writes the `len` bytes of `text` in the file `path`, to show a result of a
+// test that differs from the expected one
+void write_text(const char *path, const char *text, size_t len) {
+	FILE *file = fopen(path, "w");
+	if (file != NULL) {
+		fwrite(text, 1, len, file);
+		fclose(file);
+	}
+}
+
 int main(int argc, char **argv) {
 	/// There are 4 part of tests :
 	/// - Lexer
@@ -48,6 +62,8 @@ int main(int argc, char **argv) {
 	///// ----- LEXER TEST ----- /////
 	/// 1. Try to lex path_dir/code, and write it to path_dir/lexer_result
 	/// 2. Compare path_dir/lexer_result and path_dir/lexer_expected
+	/// 3. Lex path_dir/code cut in chunks lexed in parallel, write it to
+	/// path_dir/lexer_chunks_result and compare it to path_dir/lexer_result
 	sprintf(path_code, "%s/main.ha", path_dir);
 	sprintf(path_expected, "%s/lexer_expected", path_dir);
 	sprintf(path_result, "%s/lexer_result", path_dir);
@@ -109,24 +125,76 @@ int main(int argc, char **argv) {
 	fclose(file_expected);
 	fclose(file_result);
 
+	/// 3. Lex path_dir/code cut in chunks lexed in parallel
+	sprintf(path_2_result, "%s/lexer_chunks_result", path_dir);
+	error = fopen(path_error, "w");
+	file_code = fopen(path_code, "r");
+	Tokens *tokens_chunks = lexify_chunks(error, file_code, 4);
+	fclose(file_code);
+	fclose(error);
+	if (tokens_chunks == NULL) {
+		red();
+		printf("[Error lexing %s in chunks]\n", path_code);
+		reset();
+		return 0;
+	}
+	file_2_result = fopen(path_2_result, "w");
+	fprintf_tokens(file_2_result, tokens_chunks);
+	fclose(file_2_result);
+	tokens_delete(tokens_chunks);
+
+	file_result = fopen(path_result, "r");
+	file_2_result = fopen(path_2_result, "r");
+	if (!files_equal(file_result, file_2_result)) {
+		red();
+		printf("[Error: lexing in chunks not the same as lexing]\n");
+		reset();
+		return 0;
+	}
+	fclose(file_result);
+	fclose(file_2_result);
+
 	green();
 	printf("[OK lexer]");
 	reset();
 	fflush(stdout);
 
 	///// ----- PARSER TEST ----- /////
-	/// 1. Try to parse the list of tokens (in path_dir/lexer_result)
-	/// 2. Print the Ast in path_dir/parser_result
-	/// 3. Parse and lex the file path_dir/parser_result
-	/// 4. Lex path_dir/parser_result2 and compare with previous results
+	/// 1. Try to parse the list of tokens (in path_dir/lexer_result), or
+	/// load the Ast of path_dir/main.hast if it was saved for this code
+	/// 2. Print the Ast in memory
+	/// 3. Parse and lex the printed Ast and compare it to the Ast
+	/// 4. Parse the printed Ast cut in chunks parsed in parallel
+	/// 5. Load path_dir/main.hast and compare it to the Ast
+	/// 6. Lex the second printed Ast and compare with lexer_expected
+	/// Everything is in memory : path_dir/parser_result, parser_2_result
+	/// and lexer_2_result are only written to show a difference.
 
 	sprintf(path_result, "%s/parser_result", path_dir);
 	sprintf(path_2_result, "%s/parser_2_result", path_dir);
 
-	/// 1. Try to parse the list of tokens (in path_dir/lexer_result)
-	error = fopen(path_error, "w");
-	Ast *ast = parse(error, tokens);
-	fclose(error);
+	/// 1. Try to parse the list of tokens (in path_dir/lexer_result), or
+	/// load the Ast of path_dir/main.hast if it was saved for this code
+	char path_cache[100];
+	ast_cache_path(path_cache, sizeof(path_cache), path_code);
+	file_code = fopen(path_code, "r");
+	uint64_t hash = ast_cache_hash_file(file_code);
+	fclose(file_code);
+
+	Ast *ast = ast_cache_load(path_cache, hash);
+	if (ast != NULL) {
+		tokens_delete(tokens);
+	} else {
+		error = fopen(path_error, "w");
+		ast = parse(error, tokens);
+		fclose(error);
+		if (ast != NULL && !ast_cache_write(ast, hash, path_cache)) {
+			red();
+			printf("[Error writing %s]\n", path_cache + 5);
+			reset();
+			return 0;
+		}
+	}
 
 	if (ast == NULL) {
 		red();
@@ -135,29 +203,29 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
-	/// 2. Print the Ast in path_dir/parser_result
-	file_result = fopen(path_result, "w");
-	fprintf_ast(file_result, ast);
-	fclose(file_result);
+	/// 2. Print the Ast in memory
+	size_t text_len;
+	char *text = sprintf_ast(ast, &text_len);
 
-	/// 3. Parse and lex the file path_dir/parser_result
+	/// 3. Parse and lex the printed Ast and compare it to the Ast
+	/// This time the tokens are parsed while the text is lexed
 	error = fopen(path_error, "w");
-	file_code = fopen(path_result, "r");
-	Tokens *tokens_2 = lexify(error, file_code);
-	if (tokens_2 == NULL) {
+	file_code = fmemopen(text, text_len, "r");
+	Lexer *lexer = lexer_new(error, file_code);
+	fclose(file_code);
+	Ast *ast_2 = parse_lexer(error, lexer);
+	fclose(error);
+	if (lexer_failed(lexer)) {
+		write_text(path_result, text, text_len);
 		red();
 		printf("[Error lexing %s]\n", path_result + 5);
 		reset();
 		return 0;
 	}
-	fclose(file_code);
-	fclose(error);
-
-	error = fopen(path_error, "w");
-	Ast *ast_2 = parse(error, tokens_2);
-	fclose(error);
+	lexer_delete(lexer);
 
 	if (ast_2 == NULL) {
+		write_text(path_result, text, text_len);
 		red();
 		printf("[Error parsing again the result of first parse %s]\n",
 		       path_result);
@@ -165,56 +233,88 @@ int main(int argc, char **argv) {
 		return 0;
 	}
 
-	// writing the second result of parsing
-	file_result = fopen(path_2_result, "w");
-	fprintf_ast(file_result, ast_2);
+	// We check that we obtain the same Ast twice
+	size_t text_2_len;
+	char *text_2 = sprintf_ast(ast_2, &text_2_len);
+	if (ast_hash(ast) != ast_hash(ast_2) || !ast_equal(ast, ast_2)) {
+		write_text(path_result, text, text_len);
+		write_text(path_2_result, text_2, text_2_len);
+		red();
+		printf("[Parsing again not the same output as first parse]\n");
+		reset();
+		return 0;
+	}
 	ast_delete(ast_2);
-	fclose(file_result);
 
-	// We check that we obtain the same result twice
-	file_result = fopen(path_result, "r");
-	file_2_result = fopen(path_2_result, "r");
-	if (!files_equal(file_result, file_2_result)) {
+	/// 4. Parse the printed Ast cut in chunks parsed in parallel
+	error = fopen(path_error, "w");
+	file_code = fmemopen(text, text_len, "r");
+	tokens = lexify(error, file_code);
+	fclose(file_code);
+	if (tokens == NULL) {
+		write_text(path_result, text, text_len);
 		red();
-		printf("[Parsing again not the same output as first parse]\n");
+		printf("[Error lexing the parser output]\n");
 		reset();
 		return 0;
 	}
-	fclose(file_result);
-	fclose(file_2_result);
+	Ast *ast_chunks = parse_chunks(error, tokens, 4);
+	fclose(error);
+	if (ast_chunks == NULL || !ast_equal(ast, ast_chunks)) {
+		write_text(path_result, text, text_len);
+		red();
+		printf("[Error: parsing in chunks not the same as parsing]\n");
+		reset();
+		return 0;
+	}
+	ast_delete(ast_chunks);
 
-	/// 4. Lex path_dir/parser_result2 and compare with previous results
+	/// 5. Load path_dir/main.hast and compare it to the Ast
+	Ast *ast_cache = ast_cache_load(path_cache, hash);
+	if (ast_cache == NULL || !ast_equal(ast, ast_cache)) {
+		red();
+		printf("[Error: loaded %s not the same as parsing]\n",
+		       path_cache + 5);
+		reset();
+		return 0;
+	}
+	ast_delete(ast_cache);
+	free(text);
+
+	/// 6. Lex the second printed Ast and compare with
+	/// path_dir/lexer_expected
 	sprintf(path_expected, "%s/lexer_expected", path_dir);
 	sprintf(path_result, "%s/lexer_2_result", path_dir);
 
-	file_result = fopen(path_result, "w");
-	file_2_result = fopen(path_2_result, "r");
-
 	error = fopen(path_error, "w");
-	tokens = lexify(error, file_2_result);
+	file_code = fmemopen(text_2, text_2_len, "r");
+	tokens = lexify(error, file_code);
+	fclose(file_code);
 	if (tokens == NULL) {
+		write_text(path_2_result, text_2, text_2_len);
 		red();
 		printf("[Error lexing the second parser output]\n");
 		reset();
 		return 0;
 	}
 	fclose(error);
+	free(text_2);
 
+	file_result = open_memstream(&text, &text_len);
 	fprintf_tokens(file_result, tokens);
 	tokens_delete(tokens);
 	fclose(file_result);
-	fclose(file_2_result);
 
-	file_result = fopen(path_result, "r");
 	file_expected = fopen(path_expected, "r");
-	if (!files_equal(file_result, file_expected)) {
+	if (!file_equal_text(file_expected, text, text_len)) {
+		write_text(path_result, text, text_len);
 		red();
 		printf("[Lexing the 2nd parsing not same as first lexing]\n");
 		reset();
 		return 0;
 	}
-	fclose(file_result);
 	fclose(file_expected);
+	free(text);
 
 	green();
 	printf("[OK parser]");
@@ -224,8 +324,10 @@ int main(int argc, char **argv) {
 
 	///// ----- COMPILER TEST ----- /////
 	/// 1. Try to compile
-	sprintf(path_result, "%s/code.uxntal", path_dir);
-
+	/// 2. Write the rom in path_dir/code.rom, its labels in code.rom.sym
+	///    and its translation in C in code.c
+	/// 3. Compare the program with path_dir/code_expected, for the tests
+	///    of the optimisations that have one
 	error = fopen(path_error, "w");
 	Program *uxn_program = compile_to_uxn(error, ast);
 	fclose(error);
@@ -236,43 +338,90 @@ int main(int argc, char **argv) {
 		reset();
 		return 0;
 	}
+
+	/// 2. Write the rom in path_dir/code.rom, its labels in code.rom.sym
+	///    and its translation in C in code.c
+	char *rom;
+	size_t rom_len;
+	file_result = open_memstream(&rom, &rom_len);
+	write_uxn_rom(file_result, uxn_program);
+	fclose(file_result);
+	sprintf(path_result, "%s/code.rom", path_dir);
+	write_text(path_result, rom, rom_len);
+	sprintf(path_result, "%s/code.rom.sym", path_dir);
+	file_result = fopen(path_result, "wb");
+	if (file_result == NULL || !write_uxn_sym(file_result, uxn_program)) {
+		red();
+		printf("[Error: writing %s]\n", path_result);
+		reset();
+		return 0;
+	}
+	fclose(file_result);
+	sprintf(path_result, "%s/code.c", path_dir);
 	file_result = fopen(path_result, "w");
-	fprintf_uxn_program(file_result, uxn_program);
+	if (file_result == NULL || !write_uxn_c(file_result, uxn_program)) {
+		red();
+		printf("[Error: writing %s]\n", path_result);
+		reset();
+		return 0;
+	}
 	fclose(file_result);
 
+	/// 3. Compare the program with path_dir/code_expected
+	sprintf(path_expected, "%s/code_expected", path_dir);
+	file_expected = fopen(path_expected, "r");
+	if (file_expected != NULL) {
+		char *code;
+		size_t code_len;
+		file_result = open_memstream(&code, &code_len);
+		fprintf_uxn_program(file_result, uxn_program);
+		fclose(file_result);
+		if (!file_equal_text(file_expected, code, code_len)) {
+			sprintf(path_result, "%s/code_result", path_dir);
+			write_text(path_result, code, code_len);
+			red();
+			printf("[Error: code is not the one expected]\n");
+			reset();
+			return 0;
+		}
+		fclose(file_expected);
+		free(code);
+	}
+
 	green();
 	printf("[OK compiler]");
 	reset();
 	fflush(stdout);
 
 	///// ----- EXECUTION TEST ----- /////
-	/// 1. Assembling the path_dir/code.uxntal file in path_dir/code.rom
-	/// 2. Executing path_dir/code.rom, put output in path_dir/output_result
-	/// 3. Compare file path_dir/output_expected and path_dir/output_result
-
-	char command[200];
-
-	/// 1. Assembling the path_dir/code.uxntal file in path_dir/code.rom
-	sprintf(command, "uxnasm %s/code.uxntal %s/code.rom > %s/uxnasm_result",
-		path_dir, path_dir, path_dir);
-	system(command);
-
-	/// 2. Executing path_dir/code.rom, put output in path_dir/output_result
-	sprintf(command, "uxncli %s/code.rom > %s/output_result", path_dir,
-		path_dir);
-	system(command);
-
-	/// 3. Compare file path_dir/output_expected and path_dir/output_result
-	sprintf(path_result, "%s/output_result", path_dir);
-	sprintf(path_expected, "%s/output_expected", path_dir);
-
-	file_result = fopen(path_result, "r");
-	if (file_result == NULL) {
+	/// 1. Executing the rom in the Uxn virtual machine, its output is kept
+	///    in memory. Every block is compiled by the JIT (the roms of the
+	///    tests execute most of their code once).
+	/// 2. Compare file path_dir/output_expected and the output
+	/// 3. If they differ, write the output in path_dir/output_result and
+	///    the program in path_dir/code.uxntal
+
+	/// 1. Executing the rom in the Uxn virtual machine
+	char *output;
+	size_t output_len;
+	file_result = open_memstream(&output, &output_len);
+	Uxn *uxn = uxn_new(file_result, stderr);
+	uxn_load_rom(uxn, (uint8_t *)rom, rom_len);
+	free(rom);
+	uxn->jit_hot = 0;
+	UxnStatus status = uxn_run(uxn, EXECUTION_BUDGET);
+	uxn_delete(uxn);
+	fclose(file_result);
+	if (status == UXN_BUDGET) {
 		red();
-		printf("[Error: opening %s]\n", path_result + 5);
+		printf("[Error: execution stopped after %d instructions]\n",
+		       EXECUTION_BUDGET);
 		reset();
 		return 0;
 	}
+
+	/// 2. Compare file path_dir/output_expected and the output
+	sprintf(path_expected, "%s/output_expected", path_dir);
 	file_expected = fopen(path_expected, "r");
 	if (file_expected == NULL) {
 		red();
@@ -280,14 +429,21 @@ int main(int argc, char **argv) {
 		reset();
 		return 0;
 	}
-	if (!files_equal(file_result, file_expected)) {
+	if (!file_equal_text(file_expected, output, output_len)) {
+		/// 3. If they differ, write the output and the program
+		sprintf(path_result, "%s/output_result", path_dir);
+		write_text(path_result, output, output_len);
+		sprintf(path_result, "%s/code.uxntal", path_dir);
+		file_result = fopen(path_result, "w");
+		fprintf_uxn_program(file_result, uxn_program);
+		fclose(file_result);
 		red();
 		printf("[Error: Output is not the one expected]\n");
 		reset();
 		return 0;
 	}
-	fclose(file_result);
 	fclose(file_expected);
+	free(output);
 
 	green();
 	printf("[OK execution]\n");
@@ -295,5 +451,6 @@ int main(int argc, char **argv) {
 	fflush(stdout);
 
 	uxn_program_delete(uxn_program);
+	symbols_delete();
 	return 0;
 }
@@ -0,0 +1,167 @@
+#include "bench/vm_roms.h"
+#include "utils/colors.h"
+#include "vm/vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Runs roms with every engine of the machine and compares the results with
+// the ones of the reference interpreter (`uxn_eval`): the status, the output,
+// the number of instructions, the stacks, the memory and the devices.
+// The roms of `vm_roms.h` loop and call functions, which the roms of the
+// compiler do not do yet.
+
+// Writes in its own code: the literal of `LIT a LIT 02 ADD` is incremented by
+// an STA at every turn of the loop (48 turns), then it writes the pointer of
+// the working stack with DEO:
+// |0100
+//	#00 #00 STZ
+//	&loop
+//		[ LIT &a 01 ] [ LIT 02 ] ADD
+//		#01 LDZ ADD #01 STZ
+//		;&a LDA INC ;&a STA
+//		#00 LDZ INC DUP #00 STZ #30 LTH ,&loop JCN
+//	#01 LDZ #18 DEO
+//	#11 #22 #33 #01 #04 DEO #18 DEO
+// BRK
+const uint8_t self_modifying[] = {
+    0x80, 0x00, 0x80, 0x00, 0x11, 0x80, 0x01, 0x80, 0x02, 0x18, 0x80, 0x01,
+    0x10, 0x18, 0x80, 0x01, 0x11, 0xa0, 0x01, 0x06, 0x14, 0x01, 0xa0, 0x01,
+    0x06, 0x15, 0x80, 0x00, 0x10, 0x01, 0x06, 0x80, 0x00, 0x11, 0x80, 0x30,
+    0x0b, 0x80, 0xdd, 0x0d, 0x80, 0x01, 0x10, 0x80, 0x18, 0x17, 0x80, 0x11,
+    0x80, 0x22, 0x80, 0x33, 0x80, 0x01, 0x80, 0x04, 0x17, 0x80, 0x18, 0x17,
+    0x00,
+};
+
+typedef UxnStatus (*Engine)(Uxn *uxn, uint16_t pc, uint64_t budget);
+
+typedef struct {
+	const char *name;
+	Engine engine;
+	uint32_t jit_hot;
+	bool exact_budget; // false: the budget is only checked by the jumps
+} EngineTest;
+
+// The threaded interpreter fuses `LIT a LIT b ADD` and `LIT a JCN`, which
+// `self_modifying` writes in. The JIT compiles every block, the blocks
+// executed twice, the hot blocks
+const EngineTest engines[] = {
+    {"threaded", uxn_eval_threaded, 0, false},
+    {"jit 0", uxn_eval_jit, 0, true},
+    {"jit 1", uxn_eval_jit, 1, true},
+    {"jit 16", uxn_eval_jit, UXN_JIT_HOT, true},
+};
+
+typedef struct {
+	const char *name;
+	const uint8_t *rom;
+	size_t len;
+	uint64_t budget; // UINT64_MAX: the rom runs until its end
+} RomTest;
+
+// The budgets cut the execution in the middle of a block
+const RomTest roms[] = {
+    {"fib_loop", fib_loop, sizeof(fib_loop), UINT64_MAX},
+    {"fib_recursive", fib_recursive, sizeof(fib_recursive), UINT64_MAX},
+    {"self_modifying", self_modifying, sizeof(self_modifying), UINT64_MAX},
+    {"fib_loop budget", fib_loop, sizeof(fib_loop), 1000003},
+    {"fib_recursive budget", fib_recursive, sizeof(fib_recursive), 999999},
+    {"self_modifying budget", self_modifying, sizeof(self_modifying), 555},
+};
+
+typedef struct {
+	Uxn *uxn;
+	UxnStatus status;
+	char *output;
+	size_t output_len;
+} Run;
+
+Run run(Engine engine, uint32_t jit_hot, const RomTest *rom) {
+	Run run;
+	FILE *out = open_memstream(&run.output, &run.output_len);
+	run.uxn = uxn_new(out, stderr);
+	run.uxn->jit_hot = jit_hot;
+	uxn_load_rom(run.uxn, rom->rom, rom->len);
+	run.status = engine(run.uxn, UXN_PAGE, rom->budget);
+	fclose(out);
+	return run;
+}
+
+void run_delete(Run run) {
+	uxn_delete(run.uxn);
+	free(run.output);
+}
+
+bool stack_equal(UxnStack *s1, UxnStack *s2) {
+	return s1->ptr == s2->ptr && memcmp(s1->data, s2->data, 0x100) == 0;
+}
+
+// Returns what differs between the runs, or NULL
+const char *run_compare(Run *expected, Run *result, bool exact) {
+	if (expected->status != result->status) {
+		return "status";
+	}
+	if (!exact) {
+		// The engine stops at the first jump after the budget
+		if (result->uxn->steps < expected->uxn->steps) {
+			return "steps";
+		}
+		return NULL;
+	}
+	if (expected->output_len != result->output_len ||
+	    memcmp(expected->output, result->output, result->output_len)) {
+		return "output";
+	}
+	if (expected->uxn->steps != result->uxn->steps) {
+		return "steps";
+	}
+	if (!stack_equal(&expected->uxn->wst, &result->uxn->wst)) {
+		return "working stack";
+	}
+	if (!stack_equal(&expected->uxn->rst, &result->uxn->rst)) {
+		return "return stack";
+	}
+	if (memcmp(expected->uxn->memory, result->uxn->memory, 0x10000)) {
+		return "memory";
+	}
+	if (memcmp(expected->uxn->dev, result->uxn->dev, 0x100)) {
+		return "devices";
+	}
+	return NULL;
+}
+
+// Runs the rom with every engine, returns false if one differs from the
+// reference interpreter
+bool test_rom(const RomTest *rom) {
+	bool ok = true;
+	blue();
+	printf("[vm %-21.21s]", rom->name);
+	reset();
+	Run expected = run(uxn_eval, 0, rom);
+	for (size_t i = 0; i < sizeof(engines) / sizeof(*engines); i++) {
+		Run result = run(engines[i].engine, engines[i].jit_hot, rom);
+		bool exact =
+		    engines[i].exact_budget || rom->budget == UINT64_MAX;
+		const char *error = run_compare(&expected, &result, exact);
+		if (error == NULL) {
+			green();
+			printf("[OK %s]", engines[i].name);
+		} else {
+			red();
+			printf("[Error %s: %s]", engines[i].name, error);
+			ok = false;
+		}
+		reset();
+		run_delete(result);
+	}
+	printf("\n");
+	run_delete(expected);
+	return ok;
+}
+
+int main(void) {
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(roms) / sizeof(*roms); i++) {
+		ok = test_rom(&roms[i]) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+Arena arena_empty(void) {
+	Arena arena;
+	arena.blocks = NULL;
+	return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+	size_t align = _Alignof(max_align_t);
+	size = (size + align - 1) & ~(align - 1);
+
+	ArenaBlock *block = arena->blocks;
+	if (block == NULL || block->len + size > block->cap) {
+		size_t cap = ARENA_BLOCK_SIZE;
+		if (size > cap) {
+			cap = size;
+		}
+		block = malloc(sizeof(*block) + cap);
+		block->next = arena->blocks;
+		block->len = 0;
+		block->cap = cap;
+		arena->blocks = block;
+	}
+	void *result = block->data + block->len;
+	block->len += size;
+	return result;
+}
+
+void *arena_copy(Arena *arena, const void *src, size_t size) {
+	if (size == 0) {
+		return NULL;
+	}
+	void *result = arena_alloc(arena, size);
+	memcpy(result, src, size);
+	return result;
+}
+
+void arena_delete(Arena *arena) {
+	ArenaBlock *block = arena->blocks;
+	while (block != NULL) {
+		ArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
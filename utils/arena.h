@@ -0,0 +1,29 @@
+#include <stddef.h>
+
+// An arena allocates memory by moving forward in big blocks, everything
+// allocated in an arena is freed at once by `arena_delete`.
+typedef struct ArenaBlock {
+	struct ArenaBlock *next; // block allocated before this one
+	size_t len;		 // bytes used in `data`
+	size_t cap;		 // size of `data`
+	_Alignas(max_align_t) char data[];
+} ArenaBlock;
+
+typedef struct {
+	ArenaBlock *blocks; // last block allocated
+} Arena;
+
+// Size of a block of the arena (bigger if an allocation does not fit in it)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+Arena arena_empty(void);
+
+// Returns `size` bytes aligned for any type, they are not initialized
+void *arena_alloc(Arena *arena, size_t size);
+
+// Returns a copy of the `size` first bytes of `src` in the arena
+// Returns NULL if size is 0
+void *arena_copy(Arena *arena, const void *src, size_t size);
+
+// Free everything allocated in the arena
+void arena_delete(Arena *arena);
@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 bool files_equal(FILE *file1, FILE *file2) {
 	int buff_size = 100;
@@ -29,3 +30,18 @@ bool files_equal(FILE *file1, FILE *file2) {
 		}
 	}
 }
+
+bool file_equal_text(FILE *file, const char *text, size_t len) {
+	char buff[4096];
+	size_t pos = 0;
+	while (true) {
+		size_t read = fread(buff, 1, sizeof(buff), file);
+		if (read == 0) {
+			return pos == len;
+		}
+		if (read > len - pos || memcmp(buff, text + pos, read) != 0) {
+			return false;
+		}
+		pos += read;
+	}
+}
@@ -1,3 +1,6 @@
 #include <stdbool.h>
 #include <stdio.h>
 bool files_equal(FILE *file1, FILE *file2);
+
+// true if the content of `file` is the `len` bytes of `text`
+bool file_equal_text(FILE *file, const char *text, size_t len);
@@ -0,0 +1,32 @@
+#include "vector.h"
+#include <stdlib.h>
+
+uint32_t vector_grow_cap(uint32_t cap, uint32_t len) {
+	if (cap == 0) {
+		cap = 4;
+	}
+	while (cap < len) {
+		cap *= 2;
+	}
+	return cap;
+}
+
+void *vector_reserve(void *data, uint32_t *cap, uint32_t len, size_t size) {
+	if (len <= *cap) {
+		return data;
+	}
+	*cap = vector_grow_cap(*cap, len);
+	return realloc(data, *cap * size);
+}
+
+void *vector_shrink(void *data, uint32_t *cap, uint32_t len, size_t size) {
+	if (len == *cap) {
+		return data;
+	}
+	*cap = len;
+	if (len == 0) {
+		free(data);
+		return NULL;
+	}
+	return realloc(data, len * size);
+}
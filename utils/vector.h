@@ -0,0 +1,16 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Growable vectors are an array `data` with a length and a capacity `cap`.
+// They work with any type of elements, `size` is the size of an element :
+//     list = vector_reserve(list, &cap, len + 1, sizeof(*list));
+//     list[len++] = element;
+
+// Returns the capacity to hold `len` elements, `cap` doubled until it is enough
+uint32_t vector_grow_cap(uint32_t cap, uint32_t len);
+
+// Returns `data` with room for at least `len` elements (it may have moved)
+void *vector_reserve(void *data, uint32_t *cap, uint32_t len, size_t size);
+
+// Returns `data` with room for exactly `len` elements (it may have moved)
+void *vector_shrink(void *data, uint32_t *cap, uint32_t len, size_t size);
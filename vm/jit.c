@@ -0,0 +1,863 @@
+#include "vm.h"
+#include <stdlib.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// The code is cut in blocks: the instructions from an address to the first
+// jump (JMP, JCN, JSR, JCI, JMI, JSI), a BRK or JIT_BLOCK_LEN instructions.
+// The interpreter counts how many times every block starts and compiles it
+// in machine code when it is hot. A compiled block is a function
+// `uint64_t block(Uxn *uxn)`. At its end it adds its instructions to
+// `uxn->steps` and jumps directly to the body of the next block if it is
+// compiled and `steps` is not over `limit`. Otherwise it returns:
+// - bits 0-15: the address of the next instruction
+// - bit 63: the block stopped after writing in compiled code, the address
+//   written is in the bits 32-47
+// Registers of the compiled code:
+// - rbx: the machine (its memory is at the start of `Uxn`)
+// - rbp: `code_map` of the JIT (number of compiled blocks that contain every
+//   byte), the other fields of the JIT are at JIT_OFFSET from it
+// - r12, r14: data and pointer of the working stack
+// - r13, r15: data and pointer of the return stack
+// - rax, rdx, rsi: operands, rcx: index or address, rdi: temporary
+// The pointers of the stacks only change with 8 bits instructions (r14b,
+// r15b) so they wrap around like in `uxncli`.
+
+_Static_assert(offsetof(Uxn, memory) == 0, "the memory is at rbx");
+
+///// ----- JIT ----- /////
+
+// Longest block in instructions and in bytes
+#define JIT_BLOCK_LEN 64
+#define JIT_BLOCK_BYTES (JIT_BLOCK_LEN * 3)
+// Size of the machine code of the biggest block
+#define JIT_BLOCK_CODE 0x4000
+#define JIT_CODE_SIZE (1 << 22)
+#define JIT_BLOCKS_MAX 0x4000
+
+typedef struct {
+	uint8_t *code; // NULL if the block cannot be compiled
+	uint8_t *body; // after the prologue of `code`
+	uint16_t start;
+	uint16_t len;	// number of bytes
+	uint8_t nb_instructions;
+} JitBlock;
+
+struct UxnJit {
+	uint8_t *buffer; // JIT_CODE_SIZE bytes of executable memory
+	size_t used;
+	JitBlock blocks[JIT_BLOCKS_MAX];
+	uint32_t nb_blocks;
+	JitBlock none; // the blocks that start with a BRK
+	JitBlock *at[0x10000];
+	uint32_t count[0x10000]; // executions of the block that starts there
+	// the compiled code returns when `steps` is over it (so the next block
+	// does not exceed the budget)
+	uint64_t limit;
+	uint8_t code_map[0x10000];
+};
+
+#define JIT_OFFSET(field)                                                      \
+	((int32_t)offsetof(UxnJit, field) - (int32_t)offsetof(UxnJit, code_map))
+
+UxnJit *jit_new(void) {
+	UxnJit *jit = calloc(1, sizeof(*jit));
+	jit->buffer = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->buffer == MAP_FAILED) {
+		free(jit);
+		return NULL;
+	}
+	return jit;
+}
+
+void uxn_forget_jit(Uxn *uxn) {
+	if (uxn->jit != NULL) {
+		munmap(uxn->jit->buffer, JIT_CODE_SIZE);
+		free(uxn->jit);
+		uxn->jit = NULL;
+	}
+}
+
+// Forget every block (the buffer is full)
+void jit_reset(UxnJit *jit) {
+	jit->used = 0;
+	jit->nb_blocks = 0;
+	memset(jit->at, 0, sizeof(jit->at));
+	memset(jit->count, 0, sizeof(jit->count));
+	memset(jit->code_map, 0, sizeof(jit->code_map));
+}
+
+// The byte at `addr` changed: the blocks that contain it are interpreted
+// again until they are hot
+void jit_invalidate(UxnJit *jit, uint16_t addr) {
+	if (jit->code_map[addr] == 0) {
+		return;
+	}
+	for (uint32_t i = 0; i < JIT_BLOCK_BYTES && i <= addr; i++) {
+		JitBlock *block = jit->at[addr - i];
+		if (block == NULL || block->code == NULL || block->len <= i) {
+			continue;
+		}
+		for (uint32_t j = 0; j < block->len; j++) {
+			jit->code_map[block->start + j]--;
+		}
+		jit->at[block->start] = NULL;
+		jit->count[block->start] = 0;
+	}
+}
+
+///// ----- X86-64 ENCODING ----- /////
+
+typedef enum {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+// Opcodes (two bytes opcodes start with 0x0f)
+#define ADD 0x01
+#define OR 0x09
+#define AND 0x21
+#define SUB 0x29
+#define XOR 0x31
+#define CMP 0x39
+#define CMP_LOAD 0x3b
+#define TEST 0x85
+#define MOV_STORE8 0x88
+#define MOV_STORE 0x89
+#define MOV_LOAD 0x8b
+#define LEA 0x8d
+#define MOVZX8 0x0fb6
+#define MOVZX16 0x0fb7
+#define MOVSX8 0x0fbe
+#define IMUL 0x0faf
+#define CMOVE 0x0f44
+#define CMOVNE 0x0f45
+#define SETCC 0x0f90
+// Opcodes with an extension in the register field
+#define GROUP_IMM8 0x80  // add (0), or (1), and (4), sub (5), cmp (7)
+#define GROUP_IMM32 0x81 // same with a 32 bits register
+#define SHIFT_IMM 0xc1	 // shl (4), shr (5)
+#define SHIFT_CL 0xd3	 // shl (4), shr (5)
+#define INC_DEC8 0xfe	 // inc (0), dec (1)
+#define INC_CALL 0xff	 // inc (0), call (2), jmp (4)
+#define DIV 0xf7	 // div (6)
+#define BTS 0x0fba	 // bts (5)
+// Conditions of jcc, setcc and cmovcc
+#define CC_B 0x2
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+
+typedef struct {
+	uint8_t *code;
+	size_t len;
+	size_t epilogue; // where the compiled code returns
+} Asm;
+
+void emit8(Asm *a, uint8_t byte) { a->code[a->len++] = byte; }
+
+void emit32(Asm *a, uint32_t value) {
+	memcpy(a->code + a->len, &value, 4);
+	a->len += 4;
+}
+
+void emit64(Asm *a, uint64_t value) {
+	memcpy(a->code + a->len, &value, 8);
+	a->len += 8;
+}
+
+// `byte`: one of the registers is a byte register, sil and dil need a prefix
+void emit_rex(Asm *a, bool w, bool byte, int reg, int index, int base) {
+	uint8_t rex = 0x40 | w << 3 | (reg >> 3) << 2 | (index >> 3) << 1 |
+		      base >> 3;
+	if (rex != 0x40 || (byte && ((reg >= 4 && reg < 8) ||
+				     (base >= 4 && base < 8)))) {
+		emit8(a, rex);
+	}
+}
+
+void emit_op(Asm *a, uint16_t op) {
+	if (op > 0xff) {
+		emit8(a, op >> 8);
+	}
+	emit8(a, op);
+}
+
+// op reg, rm (both registers)
+void emit_rr(Asm *a, bool w, bool byte, uint16_t op, int reg, int rm) {
+	emit_rex(a, w, byte, reg, 0, rm);
+	emit_op(a, op);
+	emit8(a, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [base + index]
+void emit_rm(Asm *a, bool w, bool byte, uint16_t op, int reg, int base,
+	     int index) {
+	emit_rex(a, w, byte, reg, index, base);
+	emit_op(a, op);
+	// [rbp + index] and [r13 + index] only exist with a displacement
+	bool disp = (base & 7) == RBP;
+	emit8(a, (disp ? 0x40 : 0x00) | (reg & 7) << 3 | 0x04);
+	emit8(a, (index & 7) << 3 | (base & 7));
+	if (disp) {
+		emit8(a, 0);
+	}
+}
+
+// op reg, [base + disp] (base is not rsp nor r12)
+void emit_rm_disp(Asm *a, bool w, bool byte, uint16_t op, int reg, int base,
+		  int32_t disp) {
+	emit_rex(a, w, byte, reg, 0, base);
+	emit_op(a, op);
+	emit8(a, 0x80 | (reg & 7) << 3 | (base & 7));
+	emit32(a, disp);
+}
+
+void emit_mov_imm(Asm *a, int reg, uint32_t value) {
+	emit_rex(a, false, false, 0, 0, reg);
+	emit8(a, 0xb8 | (reg & 7));
+	emit32(a, value);
+}
+
+void emit_mov_imm64(Asm *a, int reg, uint64_t value) {
+	emit_rex(a, true, false, 0, 0, reg);
+	emit8(a, 0xb8 | (reg & 7));
+	emit64(a, value);
+}
+
+// op reg, imm (group of GROUP_IMM8, GROUP_IMM32 and SHIFT_IMM)
+void emit_imm8(Asm *a, bool w, uint16_t op, int ext, int reg, uint8_t imm) {
+	emit_rr(a, w, op == GROUP_IMM8, op, ext, reg);
+	emit8(a, imm);
+}
+
+void emit_imm32(Asm *a, int ext, int reg, uint32_t imm) {
+	emit_rr(a, false, false, GROUP_IMM32, ext, reg);
+	emit32(a, imm);
+}
+
+void emit_push(Asm *a, int reg) {
+	emit_rex(a, false, false, 0, 0, reg);
+	emit8(a, 0x50 | (reg & 7));
+}
+
+void emit_pop(Asm *a, int reg) {
+	emit_rex(a, false, false, 0, 0, reg);
+	emit8(a, 0x58 | (reg & 7));
+}
+
+// Jumps to the epilogue
+void emit_return(Asm *a) {
+	emit8(a, 0xe9);
+	emit32(a, a->epilogue - (a->len + 4));
+}
+
+void emit_return_if(Asm *a, int cc) {
+	emit8(a, 0x0f);
+	emit8(a, 0x80 | cc);
+	emit32(a, a->epilogue - (a->len + 4));
+}
+
+// Conditional jump forward, returns where to write its target
+size_t emit_jcc8(Asm *a, int cc) {
+	emit8(a, 0x70 | cc);
+	emit8(a, 0);
+	return a->len;
+}
+
+size_t emit_jmp8(Asm *a) {
+	emit8(a, 0xeb);
+	emit8(a, 0);
+	return a->len;
+}
+
+size_t emit_jcc32(Asm *a, int cc) {
+	emit8(a, 0x0f);
+	emit8(a, 0x80 | cc);
+	emit32(a, 0);
+	return a->len;
+}
+
+// The jump that ends at `end` goes to the current position
+void patch8(Asm *a, size_t end) { a->code[end - 1] = a->len - end; }
+
+void patch32(Asm *a, size_t end) {
+	uint32_t offset = a->len - end;
+	memcpy(a->code + end - 4, &offset, 4);
+}
+
+///// ----- STACKS ----- /////
+
+typedef struct {
+	int data;
+	int ptr;
+} JitStack;
+
+const JitStack jit_wst = {R12, R14};
+const JitStack jit_rst = {R13, R15};
+
+// Reads in `dst` the byte (or the short) that ends `offset` bytes under the
+// top of the stack
+void jit_read(Asm *a, JitStack stack, uint8_t offset, bool s, int dst) {
+	emit_rr(a, false, false, MOV_LOAD, RCX, stack.ptr);
+	emit_imm8(a, false, GROUP_IMM8, 5, RCX, offset + 1);
+	emit_rm(a, false, false, MOVZX8, dst, stack.data, RCX);
+	if (s) {
+		emit_imm8(a, false, GROUP_IMM8, 5, RCX, 1);
+		emit_rm(a, false, false, MOVZX8, RDI, stack.data, RCX);
+		emit_imm8(a, false, SHIFT_IMM, 4, RDI, 8);
+		emit_rr(a, false, false, OR, RDI, dst);
+	}
+}
+
+void jit_drop(Asm *a, JitStack stack, uint8_t bytes) {
+	if (bytes != 0) {
+		emit_imm8(a, false, GROUP_IMM8, 5, stack.ptr, bytes);
+	}
+}
+
+void jit_push(Asm *a, JitStack stack, bool s, int src) {
+	if (s) {
+		emit_rr(a, false, false, MOV_STORE, src, RDI);
+		emit_imm8(a, false, SHIFT_IMM, 5, RDI, 8);
+		emit_rm(a, false, true, MOV_STORE8, RDI, stack.data, stack.ptr);
+		emit_rr(a, false, true, INC_DEC8, 0, stack.ptr);
+	}
+	emit_rm(a, false, true, MOV_STORE8, src, stack.data, stack.ptr);
+	emit_rr(a, false, true, INC_DEC8, 0, stack.ptr);
+}
+
+void jit_push_imm(Asm *a, JitStack stack, bool s, uint16_t value) {
+	emit_mov_imm(a, RAX, value);
+	jit_push(a, stack, s, RAX);
+}
+
+void jit_save_ptrs(Asm *a) {
+	emit_rm_disp(a, false, true, MOV_STORE8, R14, RBX,
+		     offsetof(Uxn, wst.ptr));
+	emit_rm_disp(a, false, true, MOV_STORE8, R15, RBX,
+		     offsetof(Uxn, rst.ptr));
+}
+
+void jit_load_ptrs(Asm *a) {
+	emit_rm_disp(a, false, false, MOVZX8, R14, RBX,
+		     offsetof(Uxn, wst.ptr));
+	emit_rm_disp(a, false, false, MOVZX8, R15, RBX,
+		     offsetof(Uxn, rst.ptr));
+}
+
+// uxn->steps += executed
+void jit_add_steps(Asm *a, uint32_t executed) {
+	emit_rm_disp(a, true, false, GROUP_IMM32, 0, RBX, offsetof(Uxn, steps));
+	emit32(a, executed);
+}
+
+///// ----- MEMORY ----- /////
+
+// Loads in eax the byte (or the short) at the address in ecx
+void jit_load(Asm *a, bool s) {
+	emit_rm(a, false, false, MOVZX8, RAX, RBX, RCX);
+	if (s) {
+		emit_imm8(a, false, SHIFT_IMM, 4, RAX, 8);
+		emit8(a, 0x66); // inc cx: the address wraps around
+		emit_rr(a, false, false, INC_CALL, 0, RCX);
+		emit_rm(a, false, false, MOVZX8, RDI, RBX, RCX);
+		emit_rr(a, false, false, OR, RDI, RAX);
+	}
+}
+
+// Stores edx at the address in ecx. If it writes in compiled code, the block
+// returns `next` with the address written.
+void jit_store(Asm *a, bool s, uint16_t next, uint32_t executed) {
+	if (s) {
+		emit_rr(a, false, false, MOV_STORE, RDX, RDI);
+		emit_imm8(a, false, SHIFT_IMM, 5, RDI, 8);
+		emit_rm(a, false, true, MOV_STORE8, RDI, RBX, RCX);
+		emit8(a, 0x66);
+		emit_rr(a, false, false, INC_CALL, 0, RCX);
+	}
+	emit_rm(a, false, true, MOV_STORE8, RDX, RBX, RCX);
+	emit_rm(a, false, false, GROUP_IMM8, 7, RBP, RCX);
+	emit8(a, 0);
+	size_t written = emit_jcc32(a, CC_NE);
+	size_t written_before = 0;
+	if (s) {
+		emit8(a, 0x66); // dec cx
+		emit_rr(a, false, false, INC_CALL, 1, RCX);
+		emit_rm(a, false, false, GROUP_IMM8, 7, RBP, RCX);
+		emit8(a, 0);
+		written_before = emit_jcc32(a, CC_NE);
+	}
+	size_t done = emit_jmp8(a);
+	patch32(a, written);
+	if (s) {
+		patch32(a, written_before);
+	}
+	jit_add_steps(a, executed);
+	emit_mov_imm(a, RAX, next);
+	emit_imm8(a, true, SHIFT_IMM, 4, RCX, 32);
+	emit_rr(a, true, false, OR, RCX, RAX);
+	emit_imm8(a, true, BTS, 5, RAX, 63);
+	emit_return(a);
+	patch8(a, done);
+}
+
+///// ----- INSTRUCTIONS ----- /////
+
+// The block ends: goes to the block at the address in eax
+void jit_exit(Asm *a, uint32_t executed) {
+	emit_rr(a, false, false, MOVZX16, RAX, RAX);
+	jit_add_steps(a, executed);
+	// returns if steps > limit
+	emit_rm_disp(a, true, false, MOV_LOAD, RCX, RBX, offsetof(Uxn, steps));
+	emit_rm_disp(a, true, false, CMP_LOAD, RCX, RBP, JIT_OFFSET(limit));
+	emit_return_if(a, CC_A);
+	// mov rcx, [rbp + rax * 8 + at]
+	emit8(a, 0x48);
+	emit8(a, MOV_LOAD);
+	emit8(a, 0x80 | RCX << 3 | 0x04);
+	emit8(a, 0xc0 | RAX << 3 | RBP);
+	emit32(a, JIT_OFFSET(at));
+	emit_rr(a, true, false, TEST, RCX, RCX);
+	emit_return_if(a, CC_E);
+	emit_rm_disp(a, true, false, MOV_LOAD, RCX, RCX,
+		     offsetof(JitBlock, body));
+	emit_rr(a, true, false, TEST, RCX, RCX);
+	emit_return_if(a, CC_E);
+	emit_rr(a, false, false, INC_CALL, 4, RCX);
+}
+
+void jit_exit_imm(Asm *a, uint16_t pc, uint32_t executed) {
+	emit_mov_imm(a, RAX, pc);
+	jit_exit(a, executed);
+}
+
+// eax = `next` + the signed byte in eax (the short in eax is absolute)
+void jit_relative(Asm *a, bool s, uint16_t next) {
+	if (!s) {
+		emit_rr(a, false, false, MOVSX8, RAX, RAX);
+		emit_imm32(a, 0, RAX, next);
+	}
+}
+
+int jit_length(uint8_t inst) {
+	switch (inst) {
+	case 0x20: // JCI
+	case 0x40: // JMI
+	case 0x60: // JSI
+	case 0xa0: // LIT2
+	case 0xe0: // LIT2r
+		return 3;
+	case 0x80: // LIT
+	case 0xc0: // LITr
+		return 2;
+	}
+	return 1;
+}
+
+bool jit_is_jump(uint8_t inst) {
+	uint8_t op = inst & 0x1f;
+	return inst == 0x20 || inst == 0x40 || inst == 0x60 ||
+	       op == 0x0c || op == 0x0d || op == 0x0e;
+}
+
+// Executes DEI and DEO in the machine
+void jit_device(Uxn *uxn, uint16_t pc) { uxn_step(uxn, &pc); }
+
+// Compiles the instruction at `pc` (`executed`-th of the block), returns
+// false if it ends the block
+bool jit_instruction(Asm *a, Uxn *uxn, uint16_t pc, uint32_t executed) {
+	uint8_t *m = uxn->memory;
+	uint8_t inst = m[pc];
+	uint16_t next = pc + jit_length(inst);
+	uint16_t immediate = m[(uint16_t)(pc + 1)] << 8 |
+			     m[(uint16_t)(pc + 2)];
+	switch (inst) {
+	case 0x20: // JCI
+		jit_read(a, jit_wst, 0, false, RDX);
+		jit_drop(a, jit_wst, 1);
+		emit_mov_imm(a, RAX, next);
+		emit_mov_imm(a, RCX, (uint16_t)(next + immediate));
+		emit_rr(a, false, false, TEST, RDX, RDX);
+		emit_rr(a, false, false, CMOVNE, RAX, RCX);
+		jit_exit(a, executed);
+		return false;
+	case 0x40: // JMI
+		jit_exit_imm(a, next + immediate, executed);
+		return false;
+	case 0x60: // JSI
+		jit_push_imm(a, jit_rst, true, next);
+		jit_exit_imm(a, next + immediate, executed);
+		return false;
+	case 0x80: // LIT
+	case 0xc0: // LITr
+		jit_push_imm(a, inst & 0x40 ? jit_rst : jit_wst, false,
+			     m[(uint16_t)(pc + 1)]);
+		return true;
+	case 0xa0: // LIT2
+	case 0xe0: // LIT2r
+		jit_push_imm(a, inst & 0x40 ? jit_rst : jit_wst, true,
+			     immediate);
+		return true;
+	}
+
+	bool s = inst & 0x20;
+	uint8_t size = s ? 2 : 1;
+	JitStack stack = inst & 0x40 ? jit_rst : jit_wst;
+	JitStack other = inst & 0x40 ? jit_wst : jit_rst;
+	// k: the operands are read without being dropped
+	uint8_t keep = inst & 0x80 ? 0 : 0xff;
+
+	switch (inst & 0x1f) {
+	case 0x01: // INC
+		jit_read(a, stack, 0, s, RAX);
+		jit_drop(a, stack, size & keep);
+		emit_imm32(a, 0, RAX, 1);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x02: // POP
+		jit_drop(a, stack, size & keep);
+		break;
+	case 0x03: // NIP
+		jit_read(a, stack, 0, s, RDX);
+		jit_drop(a, stack, 2 * size & keep);
+		jit_push(a, stack, s, RDX);
+		break;
+	case 0x04: // SWP
+		jit_read(a, stack, 0, s, RDX);
+		jit_read(a, stack, size, s, RAX);
+		jit_drop(a, stack, 2 * size & keep);
+		jit_push(a, stack, s, RDX);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x05: // ROT
+		jit_read(a, stack, 0, s, RSI);
+		jit_read(a, stack, size, s, RDX);
+		jit_read(a, stack, 2 * size, s, RAX);
+		jit_drop(a, stack, 3 * size & keep);
+		jit_push(a, stack, s, RDX);
+		jit_push(a, stack, s, RSI);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x06: // DUP
+		jit_read(a, stack, 0, s, RAX);
+		jit_drop(a, stack, size & keep);
+		jit_push(a, stack, s, RAX);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x07: // OVR
+		jit_read(a, stack, 0, s, RDX);
+		jit_read(a, stack, size, s, RAX);
+		jit_drop(a, stack, 2 * size & keep);
+		jit_push(a, stack, s, RAX);
+		jit_push(a, stack, s, RDX);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x08: // EQU
+	case 0x09: // NEQ
+	case 0x0a: // GTH
+	case 0x0b: { // LTH
+		static const int conditions[] = {CC_E, CC_NE, CC_A, CC_B};
+		jit_read(a, stack, 0, s, RDX);
+		jit_read(a, stack, size, s, RAX);
+		jit_drop(a, stack, 2 * size & keep);
+		emit_rr(a, false, false, CMP, RDX, RAX);
+		emit_rr(a, false, true, SETCC | conditions[(inst & 0x1f) - 8],
+			0, RAX);
+		emit_rr(a, false, false, MOVZX8, RAX, RAX);
+		jit_push(a, stack, false, RAX);
+		break;
+	}
+	case 0x0c: // JMP
+		jit_read(a, stack, 0, s, RAX);
+		jit_drop(a, stack, size & keep);
+		jit_relative(a, s, next);
+		jit_exit(a, executed);
+		return false;
+	case 0x0d: // JCN
+		jit_read(a, stack, 0, s, RAX);
+		jit_read(a, stack, size, false, RDX);
+		jit_drop(a, stack, (size + 1) & keep);
+		jit_relative(a, s, next);
+		emit_mov_imm(a, RCX, next);
+		emit_rr(a, false, false, TEST, RDX, RDX);
+		emit_rr(a, false, false, CMOVE, RAX, RCX);
+		jit_exit(a, executed);
+		return false;
+	case 0x0e: // JSR
+		jit_read(a, stack, 0, s, RAX);
+		jit_drop(a, stack, size & keep);
+		emit_mov_imm(a, RDX, next);
+		jit_push(a, other, true, RDX);
+		jit_relative(a, s, next);
+		jit_exit(a, executed);
+		return false;
+	case 0x0f: // STH
+		jit_read(a, stack, 0, s, RAX);
+		jit_drop(a, stack, size & keep);
+		jit_push(a, other, s, RAX);
+		break;
+	case 0x10: // LDZ
+	case 0x12: // LDR
+		jit_read(a, stack, 0, false, RAX);
+		jit_drop(a, stack, 1 & keep);
+		if ((inst & 0x1f) == 0x12) {
+			jit_relative(a, false, next);
+		}
+		emit_rr(a, false, false, MOVZX16, RCX, RAX);
+		jit_load(a, s);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x11: // STZ
+	case 0x13: // STR
+		jit_read(a, stack, 0, false, RAX);
+		jit_read(a, stack, 1, s, RDX);
+		jit_drop(a, stack, (1 + size) & keep);
+		if ((inst & 0x1f) == 0x13) {
+			jit_relative(a, false, next);
+		}
+		emit_rr(a, false, false, MOVZX16, RCX, RAX);
+		jit_store(a, s, next, executed);
+		break;
+	case 0x14: // LDA
+		jit_read(a, stack, 0, true, RAX);
+		jit_drop(a, stack, 2 & keep);
+		emit_rr(a, false, false, MOV_STORE, RAX, RCX);
+		jit_load(a, s);
+		jit_push(a, stack, s, RAX);
+		break;
+	case 0x15: // STA
+		jit_read(a, stack, 0, true, RAX);
+		jit_read(a, stack, 2, s, RDX);
+		jit_drop(a, stack, (2 + size) & keep);
+		emit_rr(a, false, false, MOV_STORE, RAX, RCX);
+		jit_store(a, s, next, executed);
+		break;
+	case 0x16: // DEI
+	case 0x17: // DEO
+		jit_save_ptrs(a);
+		emit_rr(a, true, false, MOV_STORE, RBX, RDI);
+		emit_mov_imm(a, RSI, pc);
+		emit_mov_imm64(a, RAX, (uintptr_t)jit_device);
+		emit_rr(a, false, false, INC_CALL, 2, RAX);
+		jit_load_ptrs(a);
+		break;
+	case 0x18: // ADD
+	case 0x19: // SUB
+	case 0x1a: // MUL
+	case 0x1c: // AND
+	case 0x1d: // ORA
+	case 0x1e: { // EOR
+		static const uint16_t ops[] = {ADD, SUB, 0, 0, AND, OR, XOR};
+		jit_read(a, stack, 0, s, RDX);
+		jit_read(a, stack, size, s, RAX);
+		jit_drop(a, stack, 2 * size & keep);
+		if ((inst & 0x1f) == 0x1a) {
+			emit_rr(a, false, false, IMUL, RAX, RDX);
+		} else {
+			emit_rr(a, false, false, ops[(inst & 0x1f) - 0x18],
+				RDX, RAX);
+		}
+		jit_push(a, stack, s, RAX);
+		break;
+	}
+	case 0x1b: { // DIV (dividing by 0 gives 0)
+		jit_read(a, stack, 0, s, RDX);
+		jit_read(a, stack, size, s, RAX);
+		jit_drop(a, stack, 2 * size & keep);
+		emit_rr(a, false, false, MOV_STORE, RDX, RCX);
+		emit_rr(a, false, false, TEST, RCX, RCX);
+		size_t zero = emit_jcc8(a, CC_E);
+		emit_rr(a, false, false, XOR, RDX, RDX);
+		emit_rr(a, false, false, DIV, 6, RCX);
+		size_t done = emit_jmp8(a);
+		patch8(a, zero);
+		emit_rr(a, false, false, XOR, RAX, RAX);
+		patch8(a, done);
+		jit_push(a, stack, s, RAX);
+		break;
+	}
+	case 0x1f: // SFT
+		jit_read(a, stack, 0, false, RDX);
+		jit_read(a, stack, 1, s, RAX);
+		jit_drop(a, stack, (1 + size) & keep);
+		emit_rr(a, false, false, MOV_STORE, RDX, RCX);
+		emit_imm32(a, 4, RCX, 0x0f);
+		emit_rr(a, false, false, SHIFT_CL, 5, RAX);
+		emit_rr(a, false, false, MOV_STORE, RDX, RCX);
+		emit_imm8(a, false, SHIFT_IMM, 5, RCX, 4);
+		emit_rr(a, false, false, SHIFT_CL, 4, RAX);
+		jit_push(a, stack, s, RAX);
+		break;
+	}
+	return true;
+}
+
+///// ----- COMPILATION ----- /////
+
+// Compiles the block that starts at `start`
+JitBlock *jit_compile(UxnJit *jit, Uxn *uxn, uint16_t start) {
+	if (JIT_CODE_SIZE - jit->used < JIT_BLOCK_CODE ||
+	    jit->nb_blocks == JIT_BLOCKS_MAX) {
+		jit_reset(jit);
+	}
+	if (mprotect(jit->buffer, JIT_CODE_SIZE, PROT_READ | PROT_WRITE)) {
+		return NULL;
+	}
+	Asm a = {.code = jit->buffer + jit->used, .len = 0, .epilogue = 0};
+
+	// The epilogue is before the block so every exit jumps backward
+	jit_save_ptrs(&a);
+	emit_imm8(&a, true, GROUP_IMM8 | 3, 0, RSP, 8); // add rsp, 8
+	static const int saved[] = {RBX, RBP, R12, R13, R14, R15};
+	for (int i = 5; i >= 0; i--) {
+		emit_pop(&a, saved[i]);
+	}
+	emit8(&a, 0xc3); // ret
+	size_t entry = a.len;
+	for (int i = 0; i < 6; i++) {
+		emit_push(&a, saved[i]);
+	}
+	emit_imm8(&a, true, GROUP_IMM8 | 3, 5, RSP, 8); // sub rsp, 8
+	emit_rr(&a, true, false, MOV_STORE, RDI, RBX);
+	emit_mov_imm64(&a, RBP, (uintptr_t)jit->code_map);
+	emit_rm_disp(&a, true, false, LEA, R12, RBX, offsetof(Uxn, wst.data));
+	emit_rm_disp(&a, true, false, LEA, R13, RBX, offsetof(Uxn, rst.data));
+	jit_load_ptrs(&a);
+	size_t body = a.len;
+
+	uint16_t pc = start;
+	uint32_t executed = 0;
+	for (;;) {
+		uint8_t inst = uxn->memory[pc];
+		if (inst == 0x00 || executed == JIT_BLOCK_LEN || pc > 0xfffc ||
+		    a.len > JIT_BLOCK_CODE - 0x100) {
+			jit_exit_imm(&a, pc, executed);
+			break;
+		}
+		executed++;
+		bool next = jit_instruction(&a, uxn, pc, executed);
+		pc += jit_length(inst);
+		if (!next) {
+			break;
+		}
+	}
+	mprotect(jit->buffer, JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+	if (executed == 0) {
+		return &jit->none;
+	}
+
+	JitBlock *block = &jit->blocks[jit->nb_blocks++];
+	block->code = a.code + entry;
+	block->body = a.code + body;
+	block->start = start;
+	block->len = pc - start;
+	block->nb_instructions = executed;
+	jit->used += a.len;
+	for (uint32_t i = 0; i < block->len; i++) {
+		jit->code_map[start + i]++;
+	}
+	return block;
+}
+
+uint64_t jit_call(JitBlock *block, Uxn *uxn) {
+	uint64_t (*code)(Uxn *uxn);
+	memcpy(&code, &block->code, sizeof(code));
+	return code(uxn);
+}
+
+///// ----- EXECUTION ----- /////
+
+// Interprets the instruction at `*pc` and forgets the blocks it writes in
+bool jit_step(UxnJit *jit, Uxn *uxn, uint16_t *pc) {
+	uint8_t inst = uxn->memory[*pc];
+	UxnStack *stack = (inst & 0x40) ? &uxn->rst : &uxn->wst;
+	uint8_t top = stack->data[(uint8_t)(stack->ptr - 1)];
+	int32_t written = -1;
+	switch (inst & 0x1f) {
+	case 0x11: // STZ
+		written = top;
+		break;
+	case 0x13: // STR
+		written = (uint16_t)(*pc + 1 + (int8_t)top);
+		break;
+	case 0x15: // STA
+		written = stack->data[(uint8_t)(stack->ptr - 2)] << 8 | top;
+		break;
+	}
+	if (!uxn_step(uxn, pc)) {
+		return false;
+	}
+	if (written >= 0) {
+		jit_invalidate(jit, written);
+		jit_invalidate(jit, written + 1);
+	}
+	return true;
+}
+
+UxnStatus uxn_eval_jit(Uxn *uxn, uint16_t pc, uint64_t budget) {
+	uxn_forget_threaded(uxn); // its writes do not update the decoded code
+	if (uxn->jit == NULL) {
+		uxn->jit = jit_new();
+		if (uxn->jit == NULL) {
+			return uxn_eval_threaded(uxn, pc, budget);
+		}
+	}
+	UxnJit *jit = uxn->jit;
+	uint64_t end = (budget > UINT64_MAX - uxn->steps) ? UINT64_MAX
+							  : uxn->steps + budget;
+	jit->limit = end > JIT_BLOCK_LEN ? end - JIT_BLOCK_LEN : 0;
+	for (;;) {
+		JitBlock *block = jit->at[pc];
+		if (block == NULL && jit->count[pc]++ >= uxn->jit_hot) {
+			block = jit_compile(jit, uxn, pc);
+			if (block == NULL) { // the memory cannot be executable
+				uxn_forget_jit(uxn);
+				return uxn_eval_threaded(uxn, pc,
+							 end - uxn->steps);
+			}
+			jit->at[pc] = block;
+		}
+		if (block != NULL && block->code != NULL &&
+		    end - uxn->steps >= block->nb_instructions) {
+			uint64_t result = jit_call(block, uxn);
+			pc = result;
+			if (result >> 63) {
+				uint16_t written = result >> 32;
+				jit_invalidate(jit, written - 1);
+				jit_invalidate(jit, written);
+				jit_invalidate(jit, written + 1);
+			}
+			continue;
+		}
+
+		// Interprets the block
+		for (uint32_t i = 0; i < JIT_BLOCK_LEN; i++) {
+			if (uxn->steps == end) {
+				return UXN_BUDGET;
+			}
+			uxn->steps++;
+			uint8_t inst = uxn->memory[pc];
+			if (!jit_step(jit, uxn, &pc)) {
+				return uxn->dev[0x0f] != 0 ? UXN_HALT : UXN_BRK;
+			}
+			if (jit_is_jump(inst)) {
+				break;
+			}
+		}
+	}
+}
+
+#else
+
+void uxn_forget_jit(Uxn *uxn) { (void)uxn; }
+
+UxnStatus uxn_eval_jit(Uxn *uxn, uint16_t pc, uint64_t budget) {
+	return uxn_eval_threaded(uxn, pc, budget);
+}
+
+#endif
@@ -0,0 +1,539 @@
+#include "vm.h"
+#include <stdlib.h>
+
+#ifdef __GNUC__
+// Computed goto (`goto *label`) is an extension of GCC and clang
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Every instruction is decoded once in `uxn->decoded[pc]`: the address of the
+// code that executes it (one for each of the 256 opcodes with their modes,
+// so the modes are known when it is compiled) and an operand. The first time
+// an address is executed its code is `decode`. The sequences emitted by
+// `compile_expr` are fused in one instruction (superinstruction) :
+// - LIT addr LDZ : pushes the variable at `addr`
+// - LIT addr STZ : pops a byte in the variable at `addr`
+// - LIT off JCN : pops a condition and jumps to the address in `value`
+// - LIT n LIT m ADD : pushes the constant n + m kept in `value`
+// A write in the memory at a decoded byte (`is_code`) decodes again the
+// instructions that can contain it (they are at most 5 bytes long).
+
+///// ----- DECODED CODE ----- /////
+
+// Longest instruction decoded (LIT n LIT m ADD)
+#define DECODED_MAX_LEN 5
+
+void decoded_new(Uxn *uxn, const void *decode) {
+	uxn->decoded = malloc(0x10000 * sizeof(*uxn->decoded));
+	uxn->is_code = calloc(0x10000, sizeof(*uxn->is_code));
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		uxn->decoded[i].code = decode;
+		uxn->decoded[i].value = 0;
+	}
+}
+
+// The byte at `addr` changed: it is decoded again when it is executed
+void decoded_invalidate(Uxn *uxn, uint16_t addr, const void *decode) {
+	for (uint16_t i = 0; i < DECODED_MAX_LEN; i++) {
+		uxn->decoded[(uint16_t)(addr - i)].code = decode;
+	}
+	uxn->is_code[addr] = 0;
+}
+
+///// ----- STACKS ----- /////
+
+// The handler of every instruction is compiled 8 times, with the constants
+// S (2: shorts), R (r: return stack) and K (k: keep) of its modes.
+
+#define STACK (R ? rs : ws)
+#define PTR (*(R ? &rp : &wp))
+#define OTHER_STACK (R ? ws : rs)
+#define OTHER_PTR (*(R ? &wp : &rp))
+
+// Byte `n` of the stack from the top (1 is the top)
+#define AT(n) STACK[(uint8_t)(PTR - (n))]
+// Value `j` of the stack from the top (0 is the top) of size S
+#define VAL(j) (S ? AT(2 * (j) + 2) << 8 | AT(2 * (j) + 1) : AT((j) + 1))
+// Removes `bytes` bytes of the stack, except in keep mode
+#define DROP(bytes) PTR -= K ? 0 : (bytes)
+#define SIZE (S ? 2 : 1)
+
+#define PUSH_BYTE(stack, ptr, v) stack[ptr++] = (v)
+#define PUSH_SHORT(stack, ptr, v)                                             \
+	do {                                                                   \
+		uint16_t short_ = (v);                                         \
+		stack[ptr++] = short_ >> 8;                                    \
+		stack[ptr++] = short_;                                         \
+	} while (0)
+#define PUSH(v)                                                                \
+	do {                                                                   \
+		if (S) {                                                       \
+			PUSH_SHORT(STACK, PTR, v);                             \
+		} else {                                                       \
+			PUSH_BYTE(STACK, PTR, v);                              \
+		}                                                              \
+	} while (0)
+
+#define PEEK16(addr) (m[(uint16_t)(addr)] << 8 | m[(uint16_t)((addr) + 1)])
+#define WRITE(addr, v)                                                         \
+	do {                                                                   \
+		uint16_t addr_ = (addr);                                       \
+		m[addr_] = (v);                                                \
+		if (uxn->is_code[addr_]) {                                     \
+			decoded_invalidate(uxn, addr_, &&decode);              \
+		}                                                              \
+	} while (0)
+#define WRITE_VALUE(addr, v)                                                   \
+	do {                                                                   \
+		if (S) {                                                       \
+			WRITE(addr, (v) >> 8);                                 \
+			WRITE((addr) + 1, v);                                  \
+		} else {                                                       \
+			WRITE(addr, v);                                        \
+		}                                                              \
+	} while (0)
+#define READ_VALUE(addr) (S ? PEEK16(addr) : m[(uint16_t)(addr)])
+
+// The pointers of the stacks are kept in registers, the devices read them in
+// the machine
+#define SAVE_PTRS (uxn->wst.ptr = wp, uxn->rst.ptr = rp)
+#define LOAD_PTRS (wp = uxn->wst.ptr, rp = uxn->rst.ptr)
+
+///// ----- DISPATCH ----- /////
+
+#define NEXT goto *d[pc].code
+// The jumps check the budget, so the loops of the program are cut off
+#define JUMP(target)                                                           \
+	do {                                                                   \
+		pc = (target);                                                 \
+		if (steps >= budget) {                                         \
+			goto out_of_budget;                                    \
+		}                                                              \
+		NEXT;                                                          \
+	} while (0)
+
+// Defines the 8 handlers of the opcode `name`: name_0 to name_7, the index
+// is the 3 bits of the modes (2 r k) of the opcode
+#define HANDLER(name, i, ...)                                                  \
+	name##_##i : {                                                         \
+		enum { S = (i) & 1, R = (i) >> 1 & 1, K = (i) >> 2 };         \
+		steps++;                                                       \
+		__VA_ARGS__                                                    \
+	}
+#define HANDLERS(name, ...)                                                    \
+	HANDLER(name, 0, __VA_ARGS__)                                          \
+	HANDLER(name, 1, __VA_ARGS__)                                          \
+	HANDLER(name, 2, __VA_ARGS__)                                          \
+	HANDLER(name, 3, __VA_ARGS__)                                          \
+	HANDLER(name, 4, __VA_ARGS__)                                          \
+	HANDLER(name, 5, __VA_ARGS__)                                          \
+	HANDLER(name, 6, __VA_ARGS__)                                          \
+	HANDLER(name, 7, __VA_ARGS__)
+// The entries of the 8 handlers of `name` in the table of the opcodes
+#define ENTRIES(op, name)                                                      \
+	[op] = &&name##_0, [op | 0x20] = &&name##_1, [op | 0x40] = &&name##_2, \
+	[op | 0x60] = &&name##_3, [op | 0x80] = &&name##_4,                    \
+	[op | 0xa0] = &&name##_5, [op | 0xc0] = &&name##_6,                    \
+	[op | 0xe0] = &&name##_7
+
+// Bodies of the handlers
+
+#define BINARY(expr)                                                           \
+	{                                                                      \
+		uint16_t b = VAL(0), a = VAL(1);                               \
+		DROP(2 * SIZE);                                                \
+		PUSH(expr);                                                    \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define COMPARE(op)                                                            \
+	{                                                                      \
+		uint16_t b = VAL(0), a = VAL(1);                               \
+		DROP(2 * SIZE);                                                \
+		PUSH_BYTE(STACK, PTR, a op b);                                 \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define RELATIVE(a) (S ? (a) : (uint16_t)(pc + 1 + (int8_t)(a)))
+
+#define INC_BODY BINARY_1(a + 1)
+#define BINARY_1(expr)                                                         \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		DROP(SIZE);                                                    \
+		PUSH(expr);                                                    \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define POP_BODY                                                               \
+	{                                                                      \
+		DROP(SIZE);                                                    \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define NIP_BODY                                                               \
+	{                                                                      \
+		uint16_t b = VAL(0);                                           \
+		DROP(2 * SIZE);                                                \
+		PUSH(b);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define SWP_BODY                                                               \
+	{                                                                      \
+		uint16_t b = VAL(0), a = VAL(1);                               \
+		DROP(2 * SIZE);                                                \
+		PUSH(b);                                                       \
+		PUSH(a);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define ROT_BODY                                                               \
+	{                                                                      \
+		uint16_t c = VAL(0), b = VAL(1), a = VAL(2);                   \
+		DROP(3 * SIZE);                                                \
+		PUSH(b);                                                       \
+		PUSH(c);                                                       \
+		PUSH(a);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define DUP_BODY                                                               \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		DROP(SIZE);                                                    \
+		PUSH(a);                                                       \
+		PUSH(a);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define OVR_BODY                                                               \
+	{                                                                      \
+		uint16_t b = VAL(0), a = VAL(1);                               \
+		DROP(2 * SIZE);                                                \
+		PUSH(a);                                                       \
+		PUSH(b);                                                       \
+		PUSH(a);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define JMP_BODY                                                               \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		DROP(SIZE);                                                    \
+		JUMP(RELATIVE(a));                                             \
+	}
+#define JCN_BODY                                                               \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		uint8_t cond = AT(SIZE + 1);                                   \
+		DROP(SIZE + 1);                                                \
+		if (cond) {                                                    \
+			JUMP(RELATIVE(a));                                     \
+		}                                                              \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define JSR_BODY                                                               \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		DROP(SIZE);                                                    \
+		PUSH_SHORT(OTHER_STACK, OTHER_PTR, pc + 1);                    \
+		JUMP(RELATIVE(a));                                             \
+	}
+#define STH_BODY                                                               \
+	{                                                                      \
+		uint16_t a = VAL(0);                                           \
+		DROP(SIZE);                                                    \
+		if (S) {                                                       \
+			PUSH_SHORT(OTHER_STACK, OTHER_PTR, a);                 \
+		} else {                                                       \
+			PUSH_BYTE(OTHER_STACK, OTHER_PTR, a);                  \
+		}                                                              \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define LDZ_BODY                                                               \
+	{                                                                      \
+		uint8_t a = AT(1);                                             \
+		DROP(1);                                                       \
+		PUSH(READ_VALUE(a));                                           \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define STZ_BODY                                                               \
+	{                                                                      \
+		uint8_t a = AT(1);                                             \
+		PTR--;                                                         \
+		uint16_t b = VAL(0);                                           \
+		PTR++;                                                         \
+		DROP(1 + SIZE);                                                \
+		WRITE_VALUE(a, b);                                             \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define LDR_BODY                                                               \
+	{                                                                      \
+		uint16_t a = pc + 1 + (int8_t)AT(1);                           \
+		DROP(1);                                                       \
+		PUSH(READ_VALUE(a));                                           \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define STR_BODY                                                               \
+	{                                                                      \
+		uint16_t a = pc + 1 + (int8_t)AT(1);                           \
+		PTR--;                                                         \
+		uint16_t b = VAL(0);                                           \
+		PTR++;                                                         \
+		DROP(1 + SIZE);                                                \
+		WRITE_VALUE(a, b);                                             \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define LDA_BODY                                                               \
+	{                                                                      \
+		uint16_t a = AT(2) << 8 | AT(1);                               \
+		DROP(2);                                                       \
+		PUSH(READ_VALUE(a));                                           \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define STA_BODY                                                               \
+	{                                                                      \
+		uint16_t a = AT(2) << 8 | AT(1);                               \
+		PTR -= 2;                                                      \
+		uint16_t b = VAL(0);                                           \
+		PTR += 2;                                                      \
+		DROP(2 + SIZE);                                                \
+		WRITE_VALUE(a, b);                                             \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define DEI_BODY                                                               \
+	{                                                                      \
+		uint8_t a = AT(1);                                             \
+		DROP(1);                                                       \
+		SAVE_PTRS;                                                     \
+		uint16_t b = device_read(uxn, a);                              \
+		if (S) {                                                       \
+			b = b << 8 | device_read(uxn, a + 1);                  \
+		}                                                              \
+		PUSH(b);                                                       \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define DEO_BODY                                                               \
+	{                                                                      \
+		uint8_t a = AT(1);                                             \
+		PTR--;                                                         \
+		uint16_t b = VAL(0);                                           \
+		PTR++;                                                         \
+		DROP(1 + SIZE);                                                \
+		SAVE_PTRS;                                                     \
+		if (S) {                                                       \
+			device_write(uxn, a++, b >> 8);                        \
+		}                                                              \
+		device_write(uxn, a, b);                                       \
+		LOAD_PTRS;                                                     \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+#define SFT_BODY                                                               \
+	{                                                                      \
+		uint8_t b = AT(1);                                             \
+		PTR--;                                                         \
+		uint16_t a = VAL(0);                                           \
+		PTR++;                                                         \
+		DROP(1 + SIZE);                                                \
+		PUSH(a >> (b & 0x0f) << (b >> 4));                             \
+		pc++;                                                          \
+		NEXT;                                                          \
+	}
+
+///// ----- INTERPRETER ----- /////
+
+UxnStatus uxn_eval_threaded(Uxn *uxn, uint16_t pc, uint64_t budget) {
+	static const void *opcodes[0x100] = {
+	    [0x00] = &&BRK,	    [0x20] = &&JCI,   [0x40] = &&JMI,
+	    [0x60] = &&JSI,	    [0x80] = &&LIT,   [0xa0] = &&LIT2,
+	    [0xc0] = &&LITr,	    [0xe0] = &&LIT2r, ENTRIES(0x01, INC),
+	    ENTRIES(0x02, POP), ENTRIES(0x03, NIP), ENTRIES(0x04, SWP),
+	    ENTRIES(0x05, ROT), ENTRIES(0x06, DUP), ENTRIES(0x07, OVR),
+	    ENTRIES(0x08, EQU), ENTRIES(0x09, NEQ), ENTRIES(0x0a, GTH),
+	    ENTRIES(0x0b, LTH), ENTRIES(0x0c, JMP), ENTRIES(0x0d, JCN),
+	    ENTRIES(0x0e, JSR), ENTRIES(0x0f, STH), ENTRIES(0x10, LDZ),
+	    ENTRIES(0x11, STZ), ENTRIES(0x12, LDR), ENTRIES(0x13, STR),
+	    ENTRIES(0x14, LDA), ENTRIES(0x15, STA), ENTRIES(0x16, DEI),
+	    ENTRIES(0x17, DEO), ENTRIES(0x18, ADD), ENTRIES(0x19, SUB),
+	    ENTRIES(0x1a, MUL), ENTRIES(0x1b, DIV), ENTRIES(0x1c, AND),
+	    ENTRIES(0x1d, ORA), ENTRIES(0x1e, EOR), ENTRIES(0x1f, SFT),
+	};
+	uxn_forget_jit(uxn); // its writes do not update the compiled code
+	if (uxn->decoded == NULL) {
+		decoded_new(uxn, &&decode);
+	}
+	UxnDecoded *d = uxn->decoded;
+	uint8_t *m = uxn->memory;
+	uint8_t *ws = uxn->wst.data;
+	uint8_t *rs = uxn->rst.data;
+	uint8_t wp, rp;
+	LOAD_PTRS;
+	uint64_t steps = uxn->steps;
+	budget = (budget > UINT64_MAX - steps) ? UINT64_MAX : budget + steps;
+	NEXT;
+
+decode: {
+	uint8_t op = m[pc];
+	uint8_t a = m[(uint16_t)(pc + 1)];
+	uint8_t b = m[(uint16_t)(pc + 2)];
+	const void *code = opcodes[op];
+	uint16_t value = 0;
+	uint16_t len = 1;
+	if (op == 0x20 || op == 0x40 || op == 0x60 || op == 0xa0 ||
+	    op == 0xe0) {
+		len = 3;
+	} else if (op == 0x80 || op == 0xc0) {
+		len = 2;
+	}
+	if (op == 0x80 && b == 0x10) {
+		code = &&LIT_LDZ;
+		value = a;
+		len = 3;
+	} else if (op == 0x80 && b == 0x11) {
+		code = &&LIT_STZ;
+		value = a;
+		len = 3;
+	} else if (op == 0x80 && b == 0x0d) {
+		code = &&LIT_JCN;
+		value = pc + 3 + (int8_t)a;
+		len = 3;
+	} else if (op == 0x80 && b == 0x80 &&
+		   m[(uint16_t)(pc + 4)] == 0x18) {
+		code = &&LIT_LIT_ADD;
+		value = (uint8_t)(a + m[(uint16_t)(pc + 3)]);
+		len = 5;
+	}
+	d[pc].code = code;
+	d[pc].value = value;
+	for (uint16_t i = 0; i < len; i++) {
+		uxn->is_code[(uint16_t)(pc + i)] = 1;
+	}
+	goto *code;
+}
+
+	// Opcode 0
+BRK:
+	steps++;
+	SAVE_PTRS;
+	uxn->steps = steps;
+	return uxn->dev[0x0f] != 0 ? UXN_HALT : UXN_BRK;
+JCI:
+	steps++;
+	if (ws[--wp]) {
+		JUMP(pc + 3 + PEEK16(pc + 1));
+	}
+	pc += 3;
+	NEXT;
+JMI:
+	steps++;
+	JUMP(pc + 3 + PEEK16(pc + 1));
+JSI:
+	steps++;
+	PUSH_SHORT(rs, rp, pc + 3);
+	JUMP(pc + 3 + PEEK16(pc + 1));
+LIT:
+	steps++;
+	PUSH_BYTE(ws, wp, m[(uint16_t)(pc + 1)]);
+	pc += 2;
+	NEXT;
+LIT2:
+	steps++;
+	PUSH_SHORT(ws, wp, PEEK16(pc + 1));
+	pc += 3;
+	NEXT;
+LITr:
+	steps++;
+	PUSH_BYTE(rs, rp, m[(uint16_t)(pc + 1)]);
+	pc += 2;
+	NEXT;
+LIT2r:
+	steps++;
+	PUSH_SHORT(rs, rp, PEEK16(pc + 1));
+	pc += 3;
+	NEXT;
+
+	// Superinstructions
+LIT_LDZ:
+	steps += 2;
+	PUSH_BYTE(ws, wp, m[d[pc].value]);
+	pc += 3;
+	NEXT;
+LIT_STZ: {
+	steps += 2;
+	uint8_t addr = d[pc].value;
+	m[addr] = ws[--wp];
+	if (uxn->is_code[addr]) {
+		decoded_invalidate(uxn, addr, &&decode);
+	}
+	pc += 3;
+	NEXT;
+}
+LIT_JCN:
+	steps += 2;
+	if (ws[--wp]) {
+		JUMP(d[pc].value);
+	}
+	pc += 3;
+	NEXT;
+LIT_LIT_ADD:
+	steps += 3;
+	PUSH_BYTE(ws, wp, d[pc].value);
+	pc += 5;
+	NEXT;
+
+	// The 31 other opcodes with their 8 modes
+	HANDLERS(INC, INC_BODY)
+	HANDLERS(POP, POP_BODY)
+	HANDLERS(NIP, NIP_BODY)
+	HANDLERS(SWP, SWP_BODY)
+	HANDLERS(ROT, ROT_BODY)
+	HANDLERS(DUP, DUP_BODY)
+	HANDLERS(OVR, OVR_BODY)
+	HANDLERS(EQU, COMPARE(==))
+	HANDLERS(NEQ, COMPARE(!=))
+	HANDLERS(GTH, COMPARE(>))
+	HANDLERS(LTH, COMPARE(<))
+	HANDLERS(JMP, JMP_BODY)
+	HANDLERS(JCN, JCN_BODY)
+	HANDLERS(JSR, JSR_BODY)
+	HANDLERS(STH, STH_BODY)
+	HANDLERS(LDZ, LDZ_BODY)
+	HANDLERS(STZ, STZ_BODY)
+	HANDLERS(LDR, LDR_BODY)
+	HANDLERS(STR, STR_BODY)
+	HANDLERS(LDA, LDA_BODY)
+	HANDLERS(STA, STA_BODY)
+	HANDLERS(DEI, DEI_BODY)
+	HANDLERS(DEO, DEO_BODY)
+	HANDLERS(ADD, BINARY(a + b))
+	HANDLERS(SUB, BINARY(a - b))
+	HANDLERS(MUL, BINARY(a * b))
+	HANDLERS(DIV, BINARY(b == 0 ? 0 : a / b))
+	HANDLERS(AND, BINARY(a & b))
+	HANDLERS(ORA, BINARY(a | b))
+	HANDLERS(EOR, BINARY(a ^ b))
+	HANDLERS(SFT, SFT_BODY)
+
+out_of_budget:
+	SAVE_PTRS;
+	uxn->steps = steps;
+	return UXN_BUDGET;
+}
+
+#else
+
+UxnStatus uxn_eval_threaded(Uxn *uxn, uint16_t pc, uint64_t budget) {
+	return uxn_eval(uxn, pc, budget);
+}
+
+#endif
@@ -0,0 +1,363 @@
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+///// ----- MACHINE ----- /////
+
+Uxn *uxn_new(FILE *out, FILE *err) {
+	Uxn *uxn = calloc(1, sizeof(*uxn));
+	uxn->out = out;
+	uxn->err = err;
+	uxn->jit_hot = UXN_JIT_HOT;
+	return uxn;
+}
+
+void uxn_delete(Uxn *uxn) {
+	uxn_forget_decoded(uxn);
+	free(uxn);
+}
+
+void uxn_forget_decoded(Uxn *uxn) {
+	uxn_forget_threaded(uxn);
+	uxn_forget_jit(uxn);
+}
+
+void uxn_forget_threaded(Uxn *uxn) {
+	free(uxn->decoded);
+	free(uxn->is_code);
+	uxn->decoded = NULL;
+	uxn->is_code = NULL;
+}
+
+bool uxn_load_rom(Uxn *uxn, const uint8_t *rom, size_t len) {
+	if (len > 0x10000 - UXN_PAGE) {
+		return false;
+	}
+	memcpy(uxn->memory + UXN_PAGE, rom, len);
+	uxn_forget_decoded(uxn);
+	return true;
+}
+
+const char *uxn_status_name(UxnStatus status) {
+	switch (status) {
+	case UXN_BRK:
+		return "brk";
+	case UXN_HALT:
+		return "halt";
+	case UXN_BUDGET:
+		return "out of budget";
+	}
+	return "unknown";
+}
+
+///// ----- STACKS ----- /////
+
+// The pointers are given separately from the stacks because the instructions
+// in keep mode read the stack without moving its pointer
+
+uint16_t stack_pop(UxnStack *stack, uint8_t *ptr, bool is_short) {
+	uint16_t value = stack->data[--*ptr];
+	if (is_short) {
+		value |= stack->data[--*ptr] << 8;
+	}
+	return value;
+}
+
+void stack_push(UxnStack *stack, bool is_short, uint16_t value) {
+	if (is_short) {
+		stack->data[stack->ptr++] = value >> 8;
+	}
+	stack->data[stack->ptr++] = value;
+}
+
+///// ----- DEVICES ----- /////
+
+uint8_t device_read(Uxn *uxn, uint8_t port) {
+	switch (port) {
+	case 0x04:
+		return uxn->wst.ptr;
+	case 0x05:
+		return uxn->rst.ptr;
+	}
+	return uxn->dev[port];
+}
+
+void device_write(Uxn *uxn, uint8_t port, uint8_t value) {
+	uxn->dev[port] = value;
+	switch (port) {
+	case 0x04:
+		uxn->wst.ptr = value;
+		break;
+	case 0x05:
+		uxn->rst.ptr = value;
+		break;
+	case 0x0e:
+		if (value != 0) {
+			FILE *err = uxn->err;
+			fprintf(err, "WST");
+			for (uint8_t i = 0; i < uxn->wst.ptr; i++) {
+				fprintf(err, " %02x", uxn->wst.data[i]);
+			}
+			fprintf(err, "\nRST");
+			for (uint8_t i = 0; i < uxn->rst.ptr; i++) {
+				fprintf(err, " %02x", uxn->rst.data[i]);
+			}
+			fprintf(err, "\n");
+		}
+		break;
+	case 0x18:
+		fputc(value, uxn->out);
+		break;
+	case 0x19:
+		fputc(value, uxn->err);
+		break;
+	}
+}
+
+///// ----- EVALUATION ----- /////
+
+uint16_t peek16(Uxn *uxn, uint16_t addr) {
+	return uxn->memory[addr] << 8 | uxn->memory[(uint16_t)(addr + 1)];
+}
+
+bool uxn_step(Uxn *uxn, uint16_t *at) {
+	uint8_t *m = uxn->memory;
+	uint16_t pc = *at;
+	uint8_t inst = m[pc++];
+	UxnStack *stack = (inst & 0x40) ? &uxn->rst : &uxn->wst;
+	UxnStack *other = (inst & 0x40) ? &uxn->wst : &uxn->rst;
+
+	// Opcode 0: BRK, the immediate jumps and the literals
+	switch (inst) {
+	case 0x00: // BRK
+		return false;
+	case 0x20: // JCI
+		if (stack_pop(&uxn->wst, &uxn->wst.ptr, false)) {
+			pc += peek16(uxn, pc);
+		}
+		pc += 2;
+		*at = pc;
+		return true;
+	case 0x40: // JMI
+		pc += peek16(uxn, pc) + 2;
+		*at = pc;
+		return true;
+	case 0x60: // JSI
+		stack_push(&uxn->rst, true, pc + 2);
+		pc += peek16(uxn, pc) + 2;
+		*at = pc;
+		return true;
+	case 0x80: // LIT
+	case 0xc0: // LITr
+		stack_push(stack, false, m[pc++]);
+		*at = pc;
+		return true;
+	case 0xa0: // LIT2
+	case 0xe0: // LIT2r
+		stack_push(stack, true, peek16(uxn, pc));
+		pc += 2;
+		*at = pc;
+		return true;
+	}
+
+	bool s = inst & 0x20; // 2: operates on shorts
+	// k: the pops only move a copy of the pointer
+	uint8_t ptr = stack->ptr;
+	uint8_t *p = (inst & 0x80) ? &ptr : &stack->ptr;
+
+	uint16_t a, b, c;
+	switch (inst & 0x1f) {
+	case 0x01: // INC
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a + 1);
+		break;
+	case 0x02: // POP
+		stack_pop(stack, p, s);
+		break;
+	case 0x03: // NIP
+		b = stack_pop(stack, p, s);
+		stack_pop(stack, p, s);
+		stack_push(stack, s, b);
+		break;
+	case 0x04: // SWP
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, b);
+		stack_push(stack, s, a);
+		break;
+	case 0x05: // ROT
+		c = stack_pop(stack, p, s);
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, b);
+		stack_push(stack, s, c);
+		stack_push(stack, s, a);
+		break;
+	case 0x06: // DUP
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a);
+		stack_push(stack, s, a);
+		break;
+	case 0x07: // OVR
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a);
+		stack_push(stack, s, b);
+		stack_push(stack, s, a);
+		break;
+	case 0x08: // EQU
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, false, a == b);
+		break;
+	case 0x09: // NEQ
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, false, a != b);
+		break;
+	case 0x0a: // GTH
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, false, a > b);
+		break;
+	case 0x0b: // LTH
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, false, a < b);
+		break;
+	case 0x0c: // JMP
+		a = stack_pop(stack, p, s);
+		pc = s ? a : pc + (int8_t)a;
+		break;
+	case 0x0d: // JCN
+		a = stack_pop(stack, p, s);
+		if (stack_pop(stack, p, false)) {
+			pc = s ? a : pc + (int8_t)a;
+		}
+		break;
+	case 0x0e: // JSR
+		a = stack_pop(stack, p, s);
+		stack_push(other, true, pc);
+		pc = s ? a : pc + (int8_t)a;
+		break;
+	case 0x0f: // STH
+		a = stack_pop(stack, p, s);
+		stack_push(other, s, a);
+		break;
+	case 0x10: // LDZ
+		a = stack_pop(stack, p, false);
+		stack_push(stack, s, s ? peek16(uxn, a) : m[a]);
+		break;
+	case 0x11: // STZ
+		a = stack_pop(stack, p, false);
+		b = stack_pop(stack, p, s);
+		if (s) {
+			m[a] = b >> 8;
+			m[a + 1] = b;
+		} else {
+			m[a] = b;
+		}
+		break;
+	case 0x12: // LDR
+		a = pc + (int8_t)stack_pop(stack, p, false);
+		stack_push(stack, s, s ? peek16(uxn, a) : m[a]);
+		break;
+	case 0x13: // STR
+		a = pc + (int8_t)stack_pop(stack, p, false);
+		b = stack_pop(stack, p, s);
+		if (s) {
+			m[a] = b >> 8;
+			m[(uint16_t)(a + 1)] = b;
+		} else {
+			m[a] = b;
+		}
+		break;
+	case 0x14: // LDA
+		a = stack_pop(stack, p, true);
+		stack_push(stack, s, s ? peek16(uxn, a) : m[a]);
+		break;
+	case 0x15: // STA
+		a = stack_pop(stack, p, true);
+		b = stack_pop(stack, p, s);
+		if (s) {
+			m[a] = b >> 8;
+			m[(uint16_t)(a + 1)] = b;
+		} else {
+			m[a] = b;
+		}
+		break;
+	case 0x16: // DEI
+		a = stack_pop(stack, p, false);
+		b = device_read(uxn, a);
+		if (s) {
+			b = b << 8 | device_read(uxn, a + 1);
+		}
+		stack_push(stack, s, b);
+		break;
+	case 0x17: // DEO
+		a = stack_pop(stack, p, false);
+		b = stack_pop(stack, p, s);
+		if (s) {
+			device_write(uxn, a++, b >> 8);
+		}
+		device_write(uxn, a, b);
+		break;
+	case 0x18: // ADD
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a + b);
+		break;
+	case 0x19: // SUB
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a - b);
+		break;
+	case 0x1a: // MUL
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a * b);
+		break;
+	case 0x1b: // DIV
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, b == 0 ? 0 : a / b);
+		break;
+	case 0x1c: // AND
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a & b);
+		break;
+	case 0x1d: // ORA
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a | b);
+		break;
+	case 0x1e: // EOR
+		b = stack_pop(stack, p, s);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a ^ b);
+		break;
+	case 0x1f: // SFT
+		b = stack_pop(stack, p, false);
+		a = stack_pop(stack, p, s);
+		stack_push(stack, s, a >> (b & 0x0f) << (b >> 4));
+		break;
+	}
+	*at = pc;
+	return true;
+}
+
+UxnStatus uxn_eval(Uxn *uxn, uint16_t pc, uint64_t budget) {
+	uxn_forget_decoded(uxn); // its writes do not update the decoded code
+	for (; budget > 0; budget--) {
+		uxn->steps++;
+		if (!uxn_step(uxn, &pc)) {
+			return uxn->dev[0x0f] != 0 ? UXN_HALT : UXN_BRK;
+		}
+	}
+	return UXN_BUDGET;
+}
+
+UxnStatus uxn_run(Uxn *uxn, uint64_t budget) {
+	return uxn_eval_jit(uxn, UXN_PAGE, budget);
+}
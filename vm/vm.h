@@ -0,0 +1,106 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Uxn virtual machine that runs the roms in the process, like `uxncli` (the
+// version of september 2023: the stacks wrap around, dividing by 0 gives 0).
+// Devices :
+// - system (0x00-0x0f): 0x04/0x05 pointers of the stacks, 0x0e debug,
+//   0x0f state (something else than 0 halts the machine after the vector)
+// - console (0x10-0x1f): 0x18 write on `out`, 0x19 write on `err`
+// The other devices only keep what is written on them.
+
+// Address where the rom is loaded and where the execution starts
+#define UXN_PAGE 0x100
+
+typedef struct {
+	uint8_t ptr; // number of bytes on the stack (modulo 256)
+	uint8_t data[0x100];
+} UxnStack;
+
+typedef enum {
+	UXN_BRK,    // the vector finished on a BRK
+	UXN_HALT,   // the vector finished and the system state was written
+	UXN_BUDGET, // more instructions than the budget
+} UxnStatus;
+
+// Instruction (or fused sequence of instructions) decoded by the threaded
+// interpreter
+typedef struct {
+	const void *code; // where the interpreter executes it
+	uint16_t value;	  // operand computed when decoding
+} UxnDecoded;
+
+// Code compiled by the JIT (vm/jit.c)
+typedef struct UxnJit UxnJit;
+
+// Number of times a block is executed by the JIT before it is compiled
+#define UXN_JIT_HOT 16
+
+typedef struct {
+	uint8_t memory[0x10000];
+	uint8_t dev[0x100];
+	UxnStack wst; // working stack
+	UxnStack rst; // return stack
+	FILE *out;
+	FILE *err;
+	uint64_t steps; // number of instructions executed
+
+	// Code decoded by the threaded interpreter at every address, NULL until
+	// it runs. `is_code` tells which bytes of the memory were decoded.
+	UxnDecoded *decoded;
+	uint8_t *is_code;
+
+	// Code compiled by the JIT, NULL until it runs. A block of code is
+	// compiled after `jit_hot` executions (UXN_JIT_HOT, 0 compiles
+	// everything).
+	UxnJit *jit;
+	uint32_t jit_hot;
+} Uxn;
+
+// Returns a machine with its memory full of 0 (everything is BRK)
+// `out` and `err` receive what is written on the console
+Uxn *uxn_new(FILE *out, FILE *err);
+
+void uxn_delete(Uxn *uxn);
+
+// Copy the `len` bytes of `rom` at UXN_PAGE
+// Returns false if it does not fit in the memory
+bool uxn_load_rom(Uxn *uxn, const uint8_t *rom, size_t len);
+
+// Executes the instruction at `*pc` and moves `*pc` to the next one
+// Returns false on a BRK (`*pc` does not move)
+bool uxn_step(Uxn *uxn, uint16_t *pc);
+
+// Executes the code at `pc` until a BRK, a halt or after `budget` instructions
+// It decodes every instruction when it executes it (reference interpreter).
+UxnStatus uxn_eval(Uxn *uxn, uint16_t pc, uint64_t budget);
+
+// Same as `uxn_eval` with the threaded interpreter (vm/threaded.c): the code
+// is decoded once, with the sequences emitted by the compiler fused, and the
+// instructions jump directly to the next one. The budget is only checked on
+// the jumps, it can be exceeded by the code between two jumps.
+// Without GCC or clang (no computed goto), this is `uxn_eval`.
+UxnStatus uxn_eval_threaded(Uxn *uxn, uint16_t pc, uint64_t budget);
+
+// Same as `uxn_eval` with the JIT of x86-64 Linux (vm/jit.c): the blocks of
+// code executed `jit_hot` times are compiled in machine code, the others are
+// interpreted. The budget is checked before every block.
+// On another machine or if the memory cannot be executable, this is
+// `uxn_eval_threaded`.
+UxnStatus uxn_eval_jit(Uxn *uxn, uint16_t pc, uint64_t budget);
+
+// Executes the rom loaded (from UXN_PAGE) with the JIT
+UxnStatus uxn_run(Uxn *uxn, uint64_t budget);
+
+// Forget the code decoded by the threaded interpreter and compiled by the JIT
+// (the memory was changed by something else)
+void uxn_forget_decoded(Uxn *uxn);
+void uxn_forget_threaded(Uxn *uxn);
+void uxn_forget_jit(Uxn *uxn);
+
+// Devices of the machine, the pointers of the stacks have to be up to date
+uint8_t device_read(Uxn *uxn, uint8_t port);
+void device_write(Uxn *uxn, uint8_t port, uint8_t value);
+
+const char *uxn_status_name(UxnStatus status);